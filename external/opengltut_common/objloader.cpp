@@ -2,20 +2,223 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <thread>
 
 #include <glm/glm.hpp>
 
+#include "lib/mapped_file.h"
 #include "objloader.hpp"
 
-// Very, VERY simple OBJ loader.
-// Here is a short list of features a real function would provide : 
+// Simple OBJ loader: positions, UVs, normals and polygon faces (split into triangles as a fan).
+// Still missing compared to a real mesh format :
 // - Binary files. Reading a model should be just a few memcpy's away, not parsing a file at runtime. In short : OBJ is not very great.
 // - Animations & bones (includes bones weights)
-// - Multiple UVs
-// - All attributes should be optional, not "forced"
-// - More stable. Change a line in the OBJ file and it crashes.
-// - More secure. Change another line and you can inject code.
+// - Multiple UVs, materials and groups (they are skipped)
 // - Loading from memory, stream, etc
+//
+// The file is mapped into memory and cut into chunks at line ends, every chunk is parsed by its own thread into
+// its own arrays. The chunks are then merged: indices are checked and made absolute, and every chunk writes its
+// triangles into its own part of the output, again in parallel. Numbers are parsed by hand, so the result does not
+// depend on the C locale.
+
+namespace {
+
+// Vertex of a face as written in the file: 0-based indices, -1 for an attribute that is not given
+struct OBJCorner{
+	int vertex, uv, normal;
+};
+
+// Everything one thread read from its chunk
+struct OBJChunk{
+	const char * begin;
+	const char * end;
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<OBJCorner> corners;			// Three per triangle
+	std::vector<size_t> relativeCorners;	// Corners with negative (relative) indices, made absolute when merging
+	std::vector<int> relativeMasks;			// Which indices of these corners are relative: 1 vertex, 2 uv, 4 normal
+	// Amounts of attributes in the chunks before this one
+	size_t vertexOffset, uvOffset, normalOffset;
+	// Lines that could not be read
+	size_t errorLine;
+	bool failed;
+};
+
+inline bool isBlank(char c){
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Locale-free float parser: [sign] digits [. digits] [e [sign] digits]
+inline const char * parseFloat(const char * p, const char * end, float & value){
+	while(p < end && isBlank(*p)) p++;
+	bool negative = false;
+	if(p < end && (*p == '-' || *p == '+')){
+		negative = *p == '-';
+		p++;
+	}
+	unsigned long long mantissa = 0;
+	int exponent = 0;
+	int digits = 0;
+	for(; p < end && *p >= '0' && *p <= '9'; p++, digits++){
+		if(mantissa < 100000000000000000ULL) mantissa = mantissa*10 + (*p - '0');
+		else exponent++;
+	}
+	if(p < end && *p == '.'){
+		for(p++; p < end && *p >= '0' && *p <= '9'; p++, digits++){
+			if(mantissa < 100000000000000000ULL){
+				mantissa = mantissa*10 + (*p - '0');
+				exponent--;
+			}
+		}
+	}
+	if(digits == 0)
+		return NULL;
+	if(p < end && (*p == 'e' || *p == 'E')){
+		const char * q = p + 1;
+		bool negativeExponent = false;
+		if(q < end && (*q == '-' || *q == '+')){
+			negativeExponent = *q == '-';
+			q++;
+		}
+		if(q < end && *q >= '0' && *q <= '9'){
+			int e = 0;
+			for(; q < end && *q >= '0' && *q <= '9'; q++) if(e < 10000) e = e*10 + (*q - '0');
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+	static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+	double result = (double)mantissa;
+	if(exponent >= -22 && exponent <= 22){
+		result = exponent < 0 ? result / powers[-exponent] : result * powers[exponent];
+	}else{
+		result *= pow(10.0, exponent);
+	}
+	value = (float)(negative ? -result : result);
+	return p;
+}
+
+// Integer parser for face indices, returns NULL without digits
+inline const char * parseIndex(const char * p, const char * end, long & value){
+	bool negative = false;
+	if(p < end && *p == '-'){
+		negative = true;
+		p++;
+	}
+	if(p >= end || *p < '0' || *p > '9')
+		return NULL;
+	long result = 0;
+	for(; p < end && *p >= '0' && *p <= '9'; p++) if(result < 1000000000L) result = result*10 + (*p - '0');
+	value = negative ? -result : result;
+	return p;
+}
+
+// Turn an index from the file into a 0-based index: positive ones count from the start of the file, negative
+// ones back from the last attribute read. Relative indices are made absolute within the chunk here and get the
+// offset of the chunk when merging.
+inline bool resolveIndex(long index, size_t count, int & out, int & relative, int bit){
+	if(index > 0){
+		out = (int)(index - 1);
+	}else if(index < 0){
+		out = (int)((long)count + index);
+		relative |= bit;
+	}else{
+		return false;
+	}
+	return true;
+}
+
+void parseOBJChunk(OBJChunk * chunk){
+	const char * p = chunk->begin;
+	const char * end = chunk->end;
+	size_t line = 0;
+	std::vector<OBJCorner> polygon;
+	std::vector<int> polygonRelative;
+	chunk->failed = false;
+
+	while(p < end){
+		line++;
+		const char * lineEnd = (const char *)memchr(p, '\n', end - p);
+		if(lineEnd == NULL) lineEnd = end;
+		while(p < lineEnd && isBlank(*p)) p++;
+
+		bool ok = true;
+		if(lineEnd - p >= 2 && p[0] == 'v' && isBlank(p[1])){
+			glm::vec3 vertex;
+			const char * q = parseFloat(p + 1, lineEnd, vertex.x);
+			if(q) q = parseFloat(q, lineEnd, vertex.y);
+			if(q) q = parseFloat(q, lineEnd, vertex.z);
+			ok = q != NULL;
+			chunk->vertices.push_back(vertex);
+		}else if(lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && isBlank(p[2])){
+			glm::vec2 uv;
+			const char * q = parseFloat(p + 2, lineEnd, uv.x);
+			if(q) q = parseFloat(q, lineEnd, uv.y);
+			ok = q != NULL;
+			uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
+			chunk->uvs.push_back(uv);
+		}else if(lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && isBlank(p[2])){
+			glm::vec3 normal;
+			const char * q = parseFloat(p + 2, lineEnd, normal.x);
+			if(q) q = parseFloat(q, lineEnd, normal.y);
+			if(q) q = parseFloat(q, lineEnd, normal.z);
+			ok = q != NULL;
+			chunk->normals.push_back(normal);
+		}else if(lineEnd - p >= 2 && p[0] == 'f' && isBlank(p[1])){
+			// v, v/vt, v//vn or v/vt/vn per corner, any amount of corners
+			polygon.clear();
+			polygonRelative.clear();
+			const char * q = p + 1;
+			while(ok){
+				while(q < lineEnd && isBlank(*q)) q++;
+				if(q >= lineEnd || *q == '#') break;
+				OBJCorner corner = {-1, -1, -1};
+				int relative = 0;
+				long index;
+				q = parseIndex(q, lineEnd, index);
+				ok = q != NULL && resolveIndex(index, chunk->vertices.size(), corner.vertex, relative, 1);
+				if(ok && q < lineEnd && *q == '/'){
+					q++;
+					if(q < lineEnd && *q != '/'){
+						q = parseIndex(q, lineEnd, index);
+						ok = q != NULL && resolveIndex(index, chunk->uvs.size(), corner.uv, relative, 2);
+					}
+					if(ok && q < lineEnd && *q == '/'){
+						q = parseIndex(q + 1, lineEnd, index);
+						ok = q != NULL && resolveIndex(index, chunk->normals.size(), corner.normal, relative, 4);
+					}
+				}
+				ok = ok && (q >= lineEnd || isBlank(*q));
+				polygon.push_back(corner);
+				polygonRelative.push_back(relative);
+			}
+			ok = ok && polygon.size() >= 3;
+			for(size_t i = 2; ok && i < polygon.size(); i++){
+				size_t fan[3] = {0, i - 1, i};
+				for(int k = 0; k < 3; k++){
+					if(polygonRelative[fan[k]]){
+						chunk->relativeCorners.push_back(chunk->corners.size());
+						chunk->relativeMasks.push_back(polygonRelative[fan[k]]);
+					}
+					chunk->corners.push_back(polygon[fan[k]]);
+				}
+			}
+		}
+		// Everything else (comments, groups, materials) is skipped
+
+		if(!ok && !chunk->failed){
+			chunk->failed = true;
+			chunk->errorLine = line;
+		}
+		p = lineEnd + 1;
+	}
+}
+
+}
 
 bool loadOBJ(
 	const char * path, 
@@ -25,87 +228,126 @@ bool loadOBJ(
 ){
 	printf("Loading OBJ file %s...\n", path);
 
-	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-	std::vector<glm::vec3> temp_vertices; 
-	std::vector<glm::vec2> temp_uvs;
-	std::vector<glm::vec3> temp_normals;
-
-
-	FILE * file = fopen(path, "r");
-	if( file == NULL ){
+	MappedFile file;
+	if( !file.open(path) ){
 		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-		getchar();
 		return false;
 	}
+	file.advise_sequential();
+	const char * begin = file.data();
+	const char * end = begin + file.size();
 
-	while( 1 ){
+	// One chunk per thread, but not less than a few MB per chunk
+	const size_t minimumChunk = 4 << 20;
+	size_t threads = std::max(1u, std::thread::hardware_concurrency());
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threads, file.size() / minimumChunk));
+	std::vector<OBJChunk> chunks(chunkCount);
+	const char * chunkBegin = begin;
+	for(size_t i = 0; i < chunkCount; i++){
+		const char * chunkEnd = i + 1 == chunkCount ? end : begin + file.size() / chunkCount * (i + 1);
+		// Move the end to the next line end, so no line is split
+		if(chunkEnd < chunkBegin) chunkEnd = chunkBegin;
+		const char * lineEnd = chunkEnd < end ? (const char *)memchr(chunkEnd, '\n', end - chunkEnd) : NULL;
+		chunkEnd = lineEnd ? lineEnd + 1 : (chunkEnd < end ? end : chunkEnd);
+		chunks[i].begin = chunkBegin;
+		chunks[i].end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
 
-		char lineHeader[128];
-		// read the first word of the line
-		int res = fscanf(file, "%s", lineHeader);
-		if (res == EOF)
-			break; // EOF = End Of File. Quit the loop.
+	// Parse all chunks at once
+	std::vector<std::thread> workers;
+	for(size_t i = 1; i < chunkCount; i++) workers.push_back(std::thread(parseOBJChunk, &chunks[i]));
+	parseOBJChunk(&chunks[0]);
+	for(size_t i = 0; i < workers.size(); i++) workers[i].join();
 
-		// else : parse lineHeader
-		
-		if ( strcmp( lineHeader, "v" ) == 0 ){
-			glm::vec3 vertex;
-			fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z );
-			temp_vertices.push_back(vertex);
-		}else if ( strcmp( lineHeader, "vt" ) == 0 ){
-			glm::vec2 uv;
-			fscanf(file, "%f %f\n", &uv.x, &uv.y );
-			uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-			temp_uvs.push_back(uv);
-		}else if ( strcmp( lineHeader, "vn" ) == 0 ){
-			glm::vec3 normal;
-			fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z );
-			temp_normals.push_back(normal);
-		}else if ( strcmp( lineHeader, "f" ) == 0 ){
-			std::string vertex1, vertex2, vertex3;
-			unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-			int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2] );
-			if (matches != 9){
-				printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-				return false;
-			}
-			vertexIndices.push_back(vertexIndex[0]);
-			vertexIndices.push_back(vertexIndex[1]);
-			vertexIndices.push_back(vertexIndex[2]);
-			uvIndices    .push_back(uvIndex[0]);
-			uvIndices    .push_back(uvIndex[1]);
-			uvIndices    .push_back(uvIndex[2]);
-			normalIndices.push_back(normalIndex[0]);
-			normalIndices.push_back(normalIndex[1]);
-			normalIndices.push_back(normalIndex[2]);
-		}else{
-			// Probably a comment, eat up the rest of the line
-			char stupidBuffer[1000];
-			fgets(stupidBuffer, 1000, file);
+	// Offsets of the chunks in the merged attribute arrays and in the output
+	size_t vertexCount = 0, uvCount = 0, normalCount = 0, cornerCount = 0;
+	std::vector<size_t> cornerOffsets(chunkCount);
+	for(size_t i = 0; i < chunkCount; i++){
+		if(chunks[i].failed){
+			// Count the lines of the chunks before, so the message points to the line in the file
+			size_t line = chunks[i].errorLine;
+			for(size_t j = 0; j < i; j++) line += std::count(chunks[j].begin, chunks[j].end, '\n');
+			printf("File can't be read by our simple parser :-( Line %lu is invalid\n", (unsigned long)line);
+			return false;
 		}
+		chunks[i].vertexOffset = vertexCount;
+		chunks[i].uvOffset = uvCount;
+		chunks[i].normalOffset = normalCount;
+		cornerOffsets[i] = cornerCount;
+		vertexCount += chunks[i].vertices.size();
+		uvCount += chunks[i].uvs.size();
+		normalCount += chunks[i].normals.size();
+		cornerCount += chunks[i].corners.size();
+	}
 
+	// All attributes in one array each, the chunks hold their own part until they are copied
+	std::vector<glm::vec3> temp_vertices;
+	std::vector<glm::vec2> temp_uvs;
+	std::vector<glm::vec3> temp_normals;
+	temp_vertices.reserve(vertexCount);
+	temp_uvs.reserve(uvCount);
+	temp_normals.reserve(normalCount);
+	for(size_t i = 0; i < chunkCount; i++){
+		temp_vertices.insert(temp_vertices.end(), chunks[i].vertices.begin(), chunks[i].vertices.end());
+		temp_uvs.insert(temp_uvs.end(), chunks[i].uvs.begin(), chunks[i].uvs.end());
+		temp_normals.insert(temp_normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+		std::vector<glm::vec3>().swap(chunks[i].vertices);
+		std::vector<glm::vec2>().swap(chunks[i].uvs);
+		std::vector<glm::vec3>().swap(chunks[i].normals);
 	}
 
-	// For each vertex of each triangle
-	for( unsigned int i=0; i<vertexIndices.size(); i++ ){
-
-		// Get the indices of its attributes
-		unsigned int vertexIndex = vertexIndices[i];
-		unsigned int uvIndex = uvIndices[i];
-		unsigned int normalIndex = normalIndices[i];
-		
-		// Get the attributes thanks to the index
-		glm::vec3 vertex = temp_vertices[ vertexIndex-1 ];
-		glm::vec2 uv = temp_uvs[ uvIndex-1 ];
-		glm::vec3 normal = temp_normals[ normalIndex-1 ];
-		
-		// Put the attributes in buffers
-		out_vertices.push_back(vertex);
-		out_uvs     .push_back(uv);
-		out_normals .push_back(normal);
-	
+	// Every chunk writes the attributes of its corners into its own part of the output
+	size_t outputStart = out_vertices.size();
+	out_vertices.resize(outputStart + cornerCount);
+	out_uvs.resize(outputStart + cornerCount);
+	out_normals.resize(outputStart + cornerCount);
+	std::vector<char> valid(chunkCount, 1);
+	struct Writer{
+		static void write(OBJChunk * chunk, size_t first, char * valid,
+		                  const std::vector<glm::vec3> * vertices, const std::vector<glm::vec2> * uvs, const std::vector<glm::vec3> * normals,
+		                  glm::vec3 * out_vertices, glm::vec2 * out_uvs, glm::vec3 * out_normals){
+			std::vector<OBJCorner> & corners = chunk->corners;
+			for(size_t i = 0; i < chunk->relativeCorners.size(); i++){
+				OBJCorner & corner = corners[chunk->relativeCorners[i]];
+				// Relative indices were counted from the start of the chunk
+				int mask = chunk->relativeMasks[i];
+				if(mask & 1) corner.vertex += (int)chunk->vertexOffset;
+				if(mask & 2) corner.uv += (int)chunk->uvOffset;
+				if(mask & 4) corner.normal += (int)chunk->normalOffset;
+				if(((mask & 1) && corner.vertex < 0) || ((mask & 2) && corner.uv < 0) || ((mask & 4) && corner.normal < 0)){
+					*valid = 0;
+					return;
+				}
+			}
+			for(size_t i = 0; i < corners.size(); i++){
+				const OBJCorner & corner = corners[i];
+				if(corner.vertex < 0 || corner.vertex >= (int)vertices->size() || corner.uv >= (int)uvs->size() ||
+				   corner.normal >= (int)normals->size() || corner.uv < -1 || corner.normal < -1){
+					*valid = 0;
+					return;
+				}
+				// Attributes that are not given are zero
+				out_vertices[first + i] = (*vertices)[corner.vertex];
+				out_uvs[first + i] = corner.uv >= 0 ? (*uvs)[corner.uv] : glm::vec2(0.0f);
+				out_normals[first + i] = corner.normal >= 0 ? (*normals)[corner.normal] : glm::vec3(0.0f);
+			}
+		}
+	};
+	workers.clear();
+	for(size_t i = 0; i < chunkCount; i++){
+		workers.push_back(std::thread(Writer::write, &chunks[i], cornerOffsets[i], &valid[i], &temp_vertices, &temp_uvs, &temp_normals,
+		                              out_vertices.data() + outputStart, out_uvs.data() + outputStart, out_normals.data() + outputStart));
 	}
+	for(size_t i = 0; i < workers.size(); i++) workers[i].join();
 
+	if(std::count(valid.begin(), valid.end(), 0)){
+		printf("File can't be read by our simple parser :-( A face uses a vertex that does not exist\n");
+		out_vertices.resize(outputStart);
+		out_uvs.resize(outputStart);
+		out_normals.resize(outputStart);
+		return false;
+	}
 	return true;
 }
 
@@ -170,4 +412,193 @@ bool loadAssImp(
 
 }
 
+#include <sys/stat.h>
+#ifdef _WIN32
+	#include <direct.h>
+#endif
+
+#include "tangentspace.hpp"
+
+// Directory the imported meshes are stored in
+#define MESH_CACHE_DIRECTORY "meshcache"
+
+/*
+ * Mesh cache
+ *
+ * An imported mesh is stored as MESH_CACHE_DIRECTORY/<hash>.mesh, the hash is taken of the path and the flags.
+ * The file holds the header, then the arrays one after the other: vertices, uvs, normals, tangents, bitangents
+ * (vertexCount each) and indices (indexCount 32-bit values). The header also records the modification time and
+ * size of the source file, a changed source or a file from another version is imported again.
+ */
+struct MeshCacheHeader{
+	char magic[8];
+	unsigned int version;
+	unsigned int flags;
+	long long sourceTime;
+	long long sourceSize;
+	unsigned int vertexCount;
+	unsigned int indexCount;
+};
+
+static const unsigned int MESH_CACHE_VERSION = 1;
+
+static size_t MeshCacheSize(unsigned int vertexCount, unsigned int indexCount){
+	return sizeof(MeshCacheHeader) + (size_t)vertexCount * (4 * sizeof(glm::vec3) + sizeof(glm::vec2))
+	       + (size_t)indexCount * sizeof(unsigned int);
+}
+
+// Point the arrays of the mesh into a cache file in memory
+static void MeshCacheArrays(const char * data, CachedMesh & mesh){
+	MeshCacheHeader header;
+	memcpy(&header, data, sizeof(header));
+	mesh.vertexCount = header.vertexCount;
+	mesh.indexCount = header.indexCount;
+	const char * p = data + sizeof(MeshCacheHeader);
+	mesh.vertices = (const glm::vec3 *)p;   p += header.vertexCount * sizeof(glm::vec3);
+	mesh.uvs = (const glm::vec2 *)p;        p += header.vertexCount * sizeof(glm::vec2);
+	mesh.normals = (const glm::vec3 *)p;    p += header.vertexCount * sizeof(glm::vec3);
+	mesh.tangents = (const glm::vec3 *)p;   p += header.vertexCount * sizeof(glm::vec3);
+	mesh.bitangents = (const glm::vec3 *)p; p += header.vertexCount * sizeof(glm::vec3);
+	mesh.indices = (const unsigned int *)p;
+}
+
+static std::string MeshCachePath(const char * path, unsigned int flags){
+	// 64 bit FNV-1a hash
+	unsigned long long hash = 14695981039346656037ULL;
+	std::string key = path;
+	key.append((const char *)&flags, sizeof(flags));
+	for(size_t i = 0; i < key.size(); i++){
+		hash ^= (unsigned char)key[i];
+		hash *= 1099511628211ULL;
+	}
+	char name[64];
+	snprintf(name, sizeof(name), "/%016llx.mesh", hash);
+	return MESH_CACHE_DIRECTORY + std::string(name);
+}
+
+template <typename T>
+static void MeshCacheAppend(std::vector<char> & blob, const std::vector<T> & values){
+	if(!values.empty())
+		blob.insert(blob.end(), (const char *)&values[0], (const char *)&values[0] + values.size() * sizeof(T));
+}
+
+bool loadAssImpCached(
+	const char * path,
+	CachedMesh & mesh,
+	unsigned int flags
+){
+	struct stat source;
+	if(stat(path, &source) != 0){
+		printf("Impossible to open %s. Are you in the right directory ?\n", path);
+		return false;
+	}
+	std::string cachePath = MeshCachePath(path, flags);
+
+	// A cache file made from this source is mapped and used as it is
+	struct stat cached;
+	mesh.file.close();
+	std::vector<char>().swap(mesh.storage);
+	if(stat(cachePath.c_str(), &cached) == 0 && mesh.file.open(cachePath)){
+		MeshCacheHeader header;
+		bool ok = mesh.file.size() >= sizeof(header);
+		if(ok){
+			memcpy(&header, mesh.file.data(), sizeof(header));
+			ok = memcmp(header.magic, "PIEMESH", 8) == 0 && header.version == MESH_CACHE_VERSION && header.flags == flags
+			     && header.sourceTime == (long long)source.st_mtime && header.sourceSize == (long long)source.st_size
+			     && mesh.file.size() == MeshCacheSize(header.vertexCount, header.indexCount);
+		}
+		if(ok){
+			MeshCacheArrays(mesh.file.data(), mesh);
+			return true;
+		}
+		mesh.file.close();
+	}
+
+	// Import the first mesh, with 32-bit indices
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(path, flags);
+	if( !scene || scene->mNumMeshes == 0 ){
+		fprintf( stderr, "%s\n", importer.GetErrorString());
+		return false;
+	}
+	const aiMesh* aimesh = scene->mMeshes[0];
+	std::vector<glm::vec3> vertices(aimesh->mNumVertices);
+	std::vector<glm::vec2> uvs(aimesh->mNumVertices);
+	std::vector<glm::vec3> normals(aimesh->mNumVertices);
+	for(unsigned int i=0; i<aimesh->mNumVertices; i++){
+		vertices[i] = glm::vec3(aimesh->mVertices[i].x, aimesh->mVertices[i].y, aimesh->mVertices[i].z);
+		if(aimesh->mTextureCoords[0])
+			uvs[i] = glm::vec2(aimesh->mTextureCoords[0][i].x, aimesh->mTextureCoords[0][i].y);
+		if(aimesh->mNormals)
+			normals[i] = glm::vec3(aimesh->mNormals[i].x, aimesh->mNormals[i].y, aimesh->mNormals[i].z);
+	}
+	std::vector<unsigned int> indices;
+	indices.reserve(3*aimesh->mNumFaces);
+	for(unsigned int i=0; i<aimesh->mNumFaces; i++){
+		// Only triangles, points and lines are skipped
+		if(aimesh->mFaces[i].mNumIndices != 3)
+			continue;
+		indices.push_back(aimesh->mFaces[i].mIndices[0]);
+		indices.push_back(aimesh->mFaces[i].mIndices[1]);
+		indices.push_back(aimesh->mFaces[i].mIndices[2]);
+	}
+
+	// computeTangentBasis works on triangle lists, its results are summed per vertex like indexVBO_TBN does
+	std::vector<glm::vec3> cornerVertices(indices.size()), cornerNormals(indices.size());
+	std::vector<glm::vec2> cornerUvs(indices.size());
+	for(size_t i=0; i<indices.size(); i++){
+		cornerVertices[i] = vertices[indices[i]];
+		cornerUvs[i] = uvs[indices[i]];
+		cornerNormals[i] = normals[indices[i]];
+	}
+	std::vector<glm::vec3> cornerTangents, cornerBitangents;
+	computeTangentBasis(cornerVertices, cornerUvs, cornerNormals, cornerTangents, cornerBitangents);
+	std::vector<glm::vec3> tangents(vertices.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> bitangents(vertices.size(), glm::vec3(0.0f));
+	for(size_t i=0; i<indices.size(); i++){
+		tangents[indices[i]] += cornerTangents[i];
+		bitangents[indices[i]] += cornerBitangents[i];
+	}
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "PIEMESH", 8);
+	header.version = MESH_CACHE_VERSION;
+	header.flags = flags;
+	header.sourceTime = (long long)source.st_mtime;
+	header.sourceSize = (long long)source.st_size;
+	header.vertexCount = (unsigned int)vertices.size();
+	header.indexCount = (unsigned int)indices.size();
+	mesh.storage.reserve(MeshCacheSize(header.vertexCount, header.indexCount));
+	mesh.storage.assign((const char *)&header, (const char *)&header + sizeof(header));
+	MeshCacheAppend(mesh.storage, vertices);
+	MeshCacheAppend(mesh.storage, uvs);
+	MeshCacheAppend(mesh.storage, normals);
+	MeshCacheAppend(mesh.storage, tangents);
+	MeshCacheAppend(mesh.storage, bitangents);
+	MeshCacheAppend(mesh.storage, indices);
+	MeshCacheArrays(&mesh.storage[0], mesh);
+
+#ifndef _WIN32
+	mkdir(MESH_CACHE_DIRECTORY, 0755);
+#else
+	_mkdir(MESH_CACHE_DIRECTORY);
+#endif
+	// Written under a temporary name, so a crash never leaves a half written file behind
+	std::string temporary = cachePath + ".tmp";
+	FILE * file = fopen(temporary.c_str(), "wb");
+	if(file != NULL){
+		bool ok = fwrite(&mesh.storage[0], 1, mesh.storage.size(), file) == mesh.storage.size();
+		ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+		// rename does not replace an existing file on Windows, so a stale cache file is removed first
+		if(ok)
+			remove(cachePath.c_str());
+#endif
+		if(!ok || rename(temporary.c_str(), cachePath.c_str()) != 0)
+			remove(temporary.c_str());
+	}
+	return true;
+}
+
 #endif
\ No newline at end of file
@@ -1,6 +1,11 @@
 #ifndef OBJLOADER_H
 #define OBJLOADER_H
 
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "lib/mapped_file.h" // CachedMesh keeps its cache file mapped
+
 bool loadOBJ(
 	const char * path, 
 	std::vector<glm::vec3> & out_vertices, 
@@ -18,4 +23,28 @@ bool loadAssImp(
 	std::vector<glm::vec3> & normals
 );
 
+// A mesh imported by AssImp with tangents computed, read from the mesh cache. The arrays point into the cache
+// file, which stays mapped as long as the CachedMesh lives, so they can be handed to glBufferData directly.
+struct CachedMesh{
+	MappedFile file;
+	std::vector<char> storage; // The data when it was just imported (or the cache could not be written)
+	unsigned int vertexCount;
+	unsigned int indexCount;
+	const glm::vec3 * vertices;
+	const glm::vec2 * uvs;
+	const glm::vec3 * normals;
+	const glm::vec3 * tangents;
+	const glm::vec3 * bitangents;
+	const unsigned int * indices;
+};
+
+// Loads the first mesh of a file through the mesh cache: the cache file is used when it was made from the same
+// file (path, modification time and size) with the same AssImp post processing flags, else the file is imported
+// and the cache written for the next time.
+bool loadAssImpCached(
+	const char * path,
+	CachedMesh & mesh,
+	unsigned int flags = 0
+);
+
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <algorithm>
 using namespace std;
 
@@ -14,24 +15,137 @@ using namespace std;
 
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
-	glewExperimental = GL_TRUE;
-	if(glewInit() != GLEW_OK)
-		throw runtime_error("glewInit failed");
+#ifndef _WIN32
+	#include <sys/stat.h>
+#else
+	#include <direct.h>
+#endif
+
+// Directory the linked programs are stored in
+#define SHADER_CACHE_DIRECTORY "shadercache"
+
+// Read a whole text file, returns false if it could not be opened
+static bool ReadShaderFile(const char * path, std::string & code){
+	std::ifstream stream(path, std::ios::in | std::ios::binary);
+	if(!stream.is_open())
+		return false;
+	std::ostringstream contents;
+	contents << stream.rdbuf();
+	code = contents.str();
+	return true;
+}
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+// 64 bit FNV-1a hash
+static unsigned long long HashShaderKey(const std::string & key){
+	unsigned long long hash = 14695981039346656037ULL;
+	for(size_t i = 0; i < key.size(); i++){
+		hash ^= (unsigned char)key[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+ * Program binary cache
+ *
+ * A linked program is stored as SHADER_CACHE_DIRECTORY/<hash>.bin, the hash is taken of the driver (vendor,
+ * renderer and version string) and both sources, so a new driver or a changed shader never loads an old binary.
+ * The file holds the magic "PIEPROG", the hash, the binary format and the binary. Anything that goes wrong with
+ * the cache (no support, missing or stale file, binary rejected by the driver) silently compiles the sources.
+ */
+struct ShaderCacheHeader{
+	char magic[8];
+	unsigned long long hash;
+	GLenum format;
+	GLint length;
+};
+
+static bool ShaderCacheSupported(){
+	if(!(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary))
+		return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+static std::string ShaderCachePath(unsigned long long hash){
+	char name[64];
+	snprintf(name, sizeof(name), "/%016llx.bin", hash);
+	return SHADER_CACHE_DIRECTORY + std::string(name);
+}
+
+// Returns the program, or 0 if it is not in the cache
+static GLuint LoadCachedProgram(unsigned long long hash){
+	FILE * file = fopen(ShaderCachePath(hash).c_str(), "rb");
+	if(file == NULL)
+		return 0;
+	ShaderCacheHeader header;
+	std::vector<char> binary;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "PIEPROG", 8) == 0
+	          && header.hash == hash && header.length > 0;
+	if(ok){
+		binary.resize(header.length);
+		ok = fread(&binary[0], 1, binary.size(), file) == binary.size();
+	}
+	fclose(file);
+	if(!ok)
+		return 0;
+
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, header.format, &binary[0], header.length);
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if(Result != GL_TRUE){
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	return ProgramID;
+}
+
+static void StoreCachedProgram(GLuint ProgramID, unsigned long long hash){
+	ShaderCacheHeader header;
+	memcpy(header.magic, "PIEPROG", 8);
+	header.hash = hash;
+	header.length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &header.length);
+	if(header.length <= 0)
+		return;
+	std::vector<char> binary(header.length);
+	glGetProgramBinary(ProgramID, header.length, NULL, &header.format, &binary[0]);
+
+#ifndef _WIN32
+	mkdir(SHADER_CACHE_DIRECTORY, 0755);
+#else
+	_mkdir(SHADER_CACHE_DIRECTORY);
+#endif
+	// Written under a temporary name, so a crash never leaves a half written binary behind
+	std::string path = ShaderCachePath(hash);
+	std::string temporary = path + ".tmp";
+	FILE * file = fopen(temporary.c_str(), "wb");
+	if(file == NULL)
+		return;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&binary[0], 1, binary.size(), file) == binary.size();
+	ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+	// rename does not replace an existing file on Windows, so a stale binary is removed first
+	if(ok)
+		remove(path.c_str());
+#endif
+	if(!ok || rename(temporary.c_str(), path.c_str()) != 0)
+		remove(temporary.c_str());
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+	// GLEW is initialised once, by the window or by the first program that is loaded
+	if(glCreateShader == NULL){
+		glewExperimental = GL_TRUE;
+		if(glewInit() != GLEW_OK)
+			throw runtime_error("glewInit failed");
+	}
 
 	// Read the Vertex Shader code from the file
 	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
-	}else{
+	if(!ReadShaderFile(vertex_file_path, VertexShaderCode)){
 		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
 		getchar();
 		return 0;
@@ -39,14 +153,33 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 
 	// Read the Fragment Shader code from the file
 	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+	ReadShaderFile(fragment_file_path, FragmentShaderCode);
+
+	// A program that was linked before by this driver is loaded without compiling
+	bool CacheSupported = ShaderCacheSupported();
+	unsigned long long CacheHash = 0;
+	if(CacheSupported){
+		std::string key;
+		key += (const char *)glGetString(GL_VENDOR);
+		key += '\0';
+		key += (const char *)glGetString(GL_RENDERER);
+		key += '\0';
+		key += (const char *)glGetString(GL_VERSION);
+		key += '\0';
+		key += VertexShaderCode;
+		key += '\0';
+		key += FragmentShaderCode;
+		CacheHash = HashShaderKey(key);
+
+		GLuint CachedID = LoadCachedProgram(CacheHash);
+		if(CachedID != 0)
+			return CachedID;
 	}
 
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
@@ -90,6 +223,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if(CacheSupported)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -108,6 +243,9 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
+	if(CacheSupported && Result == GL_TRUE)
+		StoreCachedProgram(ProgramID, CacheHash);
+
 	return ProgramID;
 }
 
@@ -1,6 +1,13 @@
 #include <vector>
+#include <algorithm>
+#include <thread>
+#include <cmath>
 #include <glm/glm.hpp>
 
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
 #include "tangentspace.hpp"
 
 void computeTangentBasis(
@@ -71,3 +78,200 @@ void computeTangentBasis(
 }
 
 
+namespace {
+
+// Inputs of computeTangentBasisBatched
+struct TangentStreams{
+	const float * px, * py, * pz, * u, * v, * nx, * ny, * nz;
+	const unsigned int * indices;
+};
+
+// Sums of the tangents (t) and bitangents (b) of every vertex
+struct TangentSums{
+	float * tx, * ty, * tz, * bx, * by, * bz;
+};
+
+inline void addTangent(const TangentSums & sums, unsigned int i, float tx, float ty, float tz, float bx, float by, float bz){
+	sums.tx[i] += tx;
+	sums.ty[i] += ty;
+	sums.tz[i] += tz;
+	sums.bx[i] += bx;
+	sums.by[i] += by;
+	sums.bz[i] += bz;
+}
+
+// Adds the tangents of the triangles first..last-1 to the sums of their vertices
+void accumulateTangents(const TangentStreams * in, size_t first, size_t last, TangentSums sums){
+	size_t t = first;
+#ifdef __SSE2__
+	// Four triangles at a time, one per lane: the corners are gathered, the math is done in SSE registers and
+	// the results are added to the vertices one by one (vertices are shared, so they cannot be scattered at once)
+	for(; t + 4 <= last; t += 4){
+		float gathered[3][5][4];
+		for(int lane = 0; lane < 4; lane++){
+			for(int corner = 0; corner < 3; corner++){
+				unsigned int i = in->indices[(t + lane)*3 + corner];
+				gathered[corner][0][lane] = in->px[i];
+				gathered[corner][1][lane] = in->py[i];
+				gathered[corner][2][lane] = in->pz[i];
+				gathered[corner][3][lane] = in->u[i];
+				gathered[corner][4][lane] = in->v[i];
+			}
+		}
+		__m128 x0 = _mm_loadu_ps(gathered[0][0]), y0 = _mm_loadu_ps(gathered[0][1]), z0 = _mm_loadu_ps(gathered[0][2]);
+		__m128 u0 = _mm_loadu_ps(gathered[0][3]), v0 = _mm_loadu_ps(gathered[0][4]);
+
+		// Edges of the triangles : position and UV deltas
+		__m128 dx1 = _mm_sub_ps(_mm_loadu_ps(gathered[1][0]), x0), dx2 = _mm_sub_ps(_mm_loadu_ps(gathered[2][0]), x0);
+		__m128 dy1 = _mm_sub_ps(_mm_loadu_ps(gathered[1][1]), y0), dy2 = _mm_sub_ps(_mm_loadu_ps(gathered[2][1]), y0);
+		__m128 dz1 = _mm_sub_ps(_mm_loadu_ps(gathered[1][2]), z0), dz2 = _mm_sub_ps(_mm_loadu_ps(gathered[2][2]), z0);
+		__m128 du1 = _mm_sub_ps(_mm_loadu_ps(gathered[1][3]), u0), du2 = _mm_sub_ps(_mm_loadu_ps(gathered[2][3]), u0);
+		__m128 dv1 = _mm_sub_ps(_mm_loadu_ps(gathered[1][4]), v0), dv2 = _mm_sub_ps(_mm_loadu_ps(gathered[2][4]), v0);
+
+		// Triangles without UV area add nothing instead of infinities
+		__m128 det = _mm_sub_ps(_mm_mul_ps(du1, dv2), _mm_mul_ps(dv1, du2));
+		__m128 valid = _mm_cmpneq_ps(det, _mm_setzero_ps());
+		__m128 r = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), det), valid);
+
+		float out[6][4];
+		_mm_storeu_ps(out[0], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dx1, dv2), _mm_mul_ps(dx2, dv1)), r));
+		_mm_storeu_ps(out[1], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dy1, dv2), _mm_mul_ps(dy2, dv1)), r));
+		_mm_storeu_ps(out[2], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dz1, dv2), _mm_mul_ps(dz2, dv1)), r));
+		_mm_storeu_ps(out[3], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dx2, du1), _mm_mul_ps(dx1, du2)), r));
+		_mm_storeu_ps(out[4], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dy2, du1), _mm_mul_ps(dy1, du2)), r));
+		_mm_storeu_ps(out[5], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dz2, du1), _mm_mul_ps(dz1, du2)), r));
+
+		for(int lane = 0; lane < 4; lane++){
+			for(int corner = 0; corner < 3; corner++){
+				addTangent(sums, in->indices[(t + lane)*3 + corner],
+				           out[0][lane], out[1][lane], out[2][lane], out[3][lane], out[4][lane], out[5][lane]);
+			}
+		}
+	}
+#endif
+	for(; t < last; t++){
+		const unsigned int * corners = in->indices + t*3;
+		unsigned int i0 = corners[0], i1 = corners[1], i2 = corners[2];
+		float dx1 = in->px[i1] - in->px[i0], dx2 = in->px[i2] - in->px[i0];
+		float dy1 = in->py[i1] - in->py[i0], dy2 = in->py[i2] - in->py[i0];
+		float dz1 = in->pz[i1] - in->pz[i0], dz2 = in->pz[i2] - in->pz[i0];
+		float du1 = in->u[i1] - in->u[i0], du2 = in->u[i2] - in->u[i0];
+		float dv1 = in->v[i1] - in->v[i0], dv2 = in->v[i2] - in->v[i0];
+		float det = du1 * dv2 - dv1 * du2;
+		float r = det != 0.0f ? 1.0f / det : 0.0f;
+		float tx = (dx1 * dv2 - dx2 * dv1)*r, ty = (dy1 * dv2 - dy2 * dv1)*r, tz = (dz1 * dv2 - dz2 * dv1)*r;
+		float bx = (dx2 * du1 - dx1 * du2)*r, by = (dy2 * du1 - dy1 * du2)*r, bz = (dz2 * du1 - dz1 * du2)*r;
+		for(int corner = 0; corner < 3; corner++){
+			addTangent(sums, corners[corner], tx, ty, tz, bx, by, bz);
+		}
+	}
+}
+
+// Adds the partial sums of the other threads to sums for the vertices first..last-1, then orthogonalises and
+// normalises their tangents (Gram-Schmidt, with the handedness of the bitangent, see computeTangentBasis)
+void finishTangents(const TangentStreams * in, size_t first, size_t last, TangentSums sums, const std::vector<TangentSums> * partial){
+	for(size_t p = 0; p < partial->size(); p++){
+		const TangentSums & other = (*partial)[p];
+		for(size_t i = first; i < last; i++){
+			addTangent(sums, (unsigned int)i, other.tx[i], other.ty[i], other.tz[i], other.bx[i], other.by[i], other.bz[i]);
+		}
+	}
+
+	size_t i = first;
+#ifdef __SSE2__
+	// Four vertices at a time, the streams are loaded as they are
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	for(; i + 4 <= last; i += 4){
+		__m128 nx = _mm_loadu_ps(in->nx + i), ny = _mm_loadu_ps(in->ny + i), nz = _mm_loadu_ps(in->nz + i);
+		__m128 tx = _mm_loadu_ps(sums.tx + i), ty = _mm_loadu_ps(sums.ty + i), tz = _mm_loadu_ps(sums.tz + i);
+
+		// t = normalize(t - n * dot(n, t)), zero when nothing is left
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, tx), _mm_mul_ps(ny, ty)), _mm_mul_ps(nz, tz));
+		tx = _mm_sub_ps(tx, _mm_mul_ps(nx, d));
+		ty = _mm_sub_ps(ty, _mm_mul_ps(ny, d));
+		tz = _mm_sub_ps(tz, _mm_mul_ps(nz, d));
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz)));
+		__m128 scale = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), length), _mm_cmpgt_ps(length, zero));
+
+		// Flip t when dot(cross(n, t), b) < 0
+		__m128 cx = _mm_sub_ps(_mm_mul_ps(ny, tz), _mm_mul_ps(nz, ty));
+		__m128 cy = _mm_sub_ps(_mm_mul_ps(nz, tx), _mm_mul_ps(nx, tz));
+		__m128 cz = _mm_sub_ps(_mm_mul_ps(nx, ty), _mm_mul_ps(ny, tx));
+		__m128 handedness = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_loadu_ps(sums.bx + i)), _mm_mul_ps(cy, _mm_loadu_ps(sums.by + i))),
+		                               _mm_mul_ps(cz, _mm_loadu_ps(sums.bz + i)));
+		scale = _mm_xor_ps(scale, _mm_and_ps(_mm_cmplt_ps(handedness, zero), sign));
+
+		_mm_storeu_ps(sums.tx + i, _mm_mul_ps(tx, scale));
+		_mm_storeu_ps(sums.ty + i, _mm_mul_ps(ty, scale));
+		_mm_storeu_ps(sums.tz + i, _mm_mul_ps(tz, scale));
+	}
+#endif
+	for(; i < last; i++){
+		glm::vec3 n(in->nx[i], in->ny[i], in->nz[i]);
+		glm::vec3 t(sums.tx[i], sums.ty[i], sums.tz[i]);
+		glm::vec3 b(sums.bx[i], sums.by[i], sums.bz[i]);
+		t = t - n * glm::dot(n, t);
+		float length = glm::length(t);
+		t = length > 0.0f ? t / length : glm::vec3(0.0f);
+		if (glm::dot(glm::cross(n, t), b) < 0.0f){
+			t = t * -1.0f;
+		}
+		sums.tx[i] = t.x;
+		sums.ty[i] = t.y;
+		sums.tz[i] = t.z;
+	}
+}
+
+}
+
+void computeTangentBasisBatched(
+	// inputs
+	const std::vector<float> & px, const std::vector<float> & py, const std::vector<float> & pz,
+	const std::vector<float> & u, const std::vector<float> & v,
+	const std::vector<float> & nx, const std::vector<float> & ny, const std::vector<float> & nz,
+	const std::vector<unsigned int> & indices,
+	// outputs
+	std::vector<float> & tx, std::vector<float> & ty, std::vector<float> & tz,
+	std::vector<float> & bx, std::vector<float> & by, std::vector<float> & bz,
+	bool parallel
+){
+	size_t vertexCount = px.size();
+	size_t triangleCount = indices.size() / 3;
+	tx.assign(vertexCount, 0.0f); ty.assign(vertexCount, 0.0f); tz.assign(vertexCount, 0.0f);
+	bx.assign(vertexCount, 0.0f); by.assign(vertexCount, 0.0f); bz.assign(vertexCount, 0.0f);
+	if(vertexCount == 0)
+		return;
+
+	TangentStreams in = {&px[0], &py[0], &pz[0], &u[0], &v[0], &nx[0], &ny[0], &nz[0], indices.empty() ? NULL : &indices[0]};
+	TangentSums sums = {&tx[0], &ty[0], &tz[0], &bx[0], &by[0], &bz[0]};
+
+	// At least 16k triangles per thread, the first thread sums into the outputs, the others into their own arrays
+	size_t threadCount = 1;
+	if(parallel){
+		size_t threads = std::max(1u, std::thread::hardware_concurrency());
+		threadCount = std::max<size_t>(1, std::min<size_t>(threads, triangleCount / 16384));
+	}
+	std::vector<float> partialStorage((threadCount - 1) * 6 * vertexCount, 0.0f);
+	std::vector<TangentSums> partial(threadCount - 1);
+	for(size_t p = 0; p < partial.size(); p++){
+		float * base = &partialStorage[p * 6 * vertexCount];
+		TangentSums other = {base, base + vertexCount, base + 2*vertexCount, base + 3*vertexCount, base + 4*vertexCount, base + 5*vertexCount};
+		partial[p] = other;
+	}
+
+	std::vector<std::thread> workers;
+	for(size_t p = 1; p < threadCount; p++){
+		workers.push_back(std::thread(accumulateTangents, &in, triangleCount * p / threadCount, triangleCount * (p + 1) / threadCount, partial[p - 1]));
+	}
+	accumulateTangents(&in, 0, triangleCount / threadCount, sums);
+	for(size_t i = 0; i < workers.size(); i++) workers[i].join();
+
+	// Second pass over ranges of vertices
+	workers.clear();
+	for(size_t p = 1; p < threadCount; p++){
+		workers.push_back(std::thread(finishTangents, &in, vertexCount * p / threadCount, vertexCount * (p + 1) / threadCount, sums, &partial));
+	}
+	finishTangents(&in, 0, vertexCount / threadCount, sums, &partial);
+	for(size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
@@ -11,5 +11,20 @@ void computeTangentBasis(
 	std::vector<glm::vec3> & bitangents
 );
 
+// Same basis for an indexed mesh, with every stream as one array per component (structure of arrays). The
+// tangents and bitangents of the triangles of a vertex are summed, then the tangent is orthogonalised against
+// the normal and normalised. The triangles are processed four at a time with SSE where available, and with
+// parallel in ranges on several threads. The outputs are resized to the vertex count.
+void computeTangentBasisBatched(
+	// inputs
+	const std::vector<float> & px, const std::vector<float> & py, const std::vector<float> & pz,
+	const std::vector<float> & u, const std::vector<float> & v,
+	const std::vector<float> & nx, const std::vector<float> & ny, const std::vector<float> & nz,
+	const std::vector<unsigned int> & indices,
+	// outputs
+	std::vector<float> & tx, std::vector<float> & ty, std::vector<float> & tz,
+	std::vector<float> & bx, std::vector<float> & by, std::vector<float> & bz,
+	bool parallel = false
+);
 
 #endif
\ No newline at end of file
@@ -13,21 +13,35 @@ using namespace glm;
 #include "text2D.hpp"
 
 unsigned int Text2DTextureID;              // Texture containing the font
-unsigned int Text2DVertexBufferID;         // Buffer containing the vertices
-unsigned int Text2DUVBufferID;             //                       UVs
+unsigned int Text2DVertexBufferID;         // Streaming buffer containing the vertices and UVs, interleaved
 unsigned int Text2DShaderID;               // Program used to disaply the text
 unsigned int vertexPosition_screenspaceID; // Location of the program's "vertexPosition_screenspace" attribute
 unsigned int vertexUVID;                   // Location of the program's "vertexUV" attribute
 unsigned int Text2DUniformID;              // Location of the program's texture attribute
 
+// Vertex of a queued character
+struct Text2DVertex{
+	glm::vec2 position;
+	glm::vec2 uv;
+};
+
+// Characters queued since the last flush. The CPU buffer and the GPU buffer are allocated once for
+// TEXT2D_QUEUE_CHARACTERS characters, a queue that runs full is flushed.
+#define TEXT2D_QUEUE_CHARACTERS 8192
+Text2DVertex * Text2DQueue = NULL;
+unsigned int Text2DQueued = 0;              // Characters in the queue
+
 void initText2D(const char * texturePath){
 
 	// Initialize texture
 	Text2DTextureID = loadDDS(texturePath);
 
-	// Initialize VBO
+	// Initialize VBO, the data store is replaced on every flush
 	glGenBuffers(1, &Text2DVertexBufferID);
-	glGenBuffers(1, &Text2DUVBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, Text2DVertexBufferID);
+	glBufferData(GL_ARRAY_BUFFER, TEXT2D_QUEUE_CHARACTERS * 6 * sizeof(Text2DVertex), NULL, GL_STREAM_DRAW);
+	Text2DQueue = new Text2DVertex[TEXT2D_QUEUE_CHARACTERS * 6];
+	Text2DQueued = 0;
 
 	// Initialize Shader
 	Text2DShaderID = LoadShaders( "TextVertexShader.vertexshader", "TextVertexShader.fragmentshader" );
@@ -41,48 +55,40 @@ void initText2D(const char * texturePath){
 
 }
 
-void printText2D(const char * text, int x, int y, int size){
+void queueText2D(const char * text, int x, int y, int size){
 
-	unsigned int length = strlen(text);
-
-	// Fill buffers
-	std::vector<glm::vec2> vertices;
-	std::vector<glm::vec2> UVs;
-	for ( unsigned int i=0 ; i<length ; i++ ){
-		
-		glm::vec2 vertex_up_left    = glm::vec2( x+i*size     , y+size );
-		glm::vec2 vertex_up_right   = glm::vec2( x+i*size+size, y+size );
-		glm::vec2 vertex_down_right = glm::vec2( x+i*size+size, y      );
-		glm::vec2 vertex_down_left  = glm::vec2( x+i*size     , y      );
-
-		vertices.push_back(vertex_up_left   );
-		vertices.push_back(vertex_down_left );
-		vertices.push_back(vertex_up_right  );
-
-		vertices.push_back(vertex_down_right);
-		vertices.push_back(vertex_up_right);
-		vertices.push_back(vertex_down_left);
-
-		char character = text[i];
-		float uv_x = (character%16)/16.0f;
-		float uv_y = (character/16)/16.0f;
-
-		glm::vec2 uv_up_left    = glm::vec2( uv_x           , uv_y );
-		glm::vec2 uv_up_right   = glm::vec2( uv_x+1.0f/16.0f, uv_y );
-		glm::vec2 uv_down_right = glm::vec2( uv_x+1.0f/16.0f, (uv_y + 1.0f/16.0f) );
-		glm::vec2 uv_down_left  = glm::vec2( uv_x           , (uv_y + 1.0f/16.0f) );
-		UVs.push_back(uv_up_left   );
-		UVs.push_back(uv_down_left );
-		UVs.push_back(uv_up_right  );
-
-		UVs.push_back(uv_down_right);
-		UVs.push_back(uv_up_right);
-		UVs.push_back(uv_down_left);
+	for ( unsigned int i=0 ; text[i] != '\0' ; i++ ){
+		if ( Text2DQueued == TEXT2D_QUEUE_CHARACTERS )
+			flushText2D();
+
+		float left = (float)(x+i*size), right = left+size;
+		float bottom = (float)y, top = bottom+size;
+
+		unsigned char character = text[i];
+		float uv_left = (character%16)/16.0f, uv_right = uv_left+1.0f/16.0f;
+		float uv_top = (character/16)/16.0f, uv_bottom = uv_top+1.0f/16.0f;
+
+		// Two triangles: up left, down left, up right and down right, up right, down left
+		Text2DVertex * vertex = Text2DQueue + Text2DQueued*6;
+		vertex[0].position = glm::vec2(left , top   ); vertex[0].uv = glm::vec2(uv_left , uv_top   );
+		vertex[1].position = glm::vec2(left , bottom); vertex[1].uv = glm::vec2(uv_left , uv_bottom);
+		vertex[2].position = glm::vec2(right, top   ); vertex[2].uv = glm::vec2(uv_right, uv_top   );
+		vertex[3].position = glm::vec2(right, bottom); vertex[3].uv = glm::vec2(uv_right, uv_bottom);
+		vertex[4] = vertex[2];
+		vertex[5] = vertex[1];
+		Text2DQueued++;
 	}
+}
+
+void flushText2D(){
+
+	if ( Text2DQueued == 0 )
+		return;
+
+	// Orphan the previous data store, so the upload does not wait for draws that still read it
 	glBindBuffer(GL_ARRAY_BUFFER, Text2DVertexBufferID);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2), &vertices[0], GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, Text2DUVBufferID);
-	glBufferData(GL_ARRAY_BUFFER, UVs.size() * sizeof(glm::vec2), &UVs[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, TEXT2D_QUEUE_CHARACTERS * 6 * sizeof(Text2DVertex), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, Text2DQueued * 6 * sizeof(Text2DVertex), Text2DQueue);
 
 	// Bind shader
 	glUseProgram(Text2DShaderID);
@@ -93,34 +99,41 @@ void printText2D(const char * text, int x, int y, int size){
 	// Set our "myTextureSampler" sampler to user Texture Unit 0
 	glUniform1i(Text2DUniformID, 0);
 
-	// 1rst attribute buffer : vertices
+	// 1rst attribute : vertices
 	glEnableVertexAttribArray(vertexPosition_screenspaceID);
-	glBindBuffer(GL_ARRAY_BUFFER, Text2DVertexBufferID);
-	glVertexAttribPointer(vertexPosition_screenspaceID, 2, GL_FLOAT, GL_FALSE, 0, (void*)0 );
+	glVertexAttribPointer(vertexPosition_screenspaceID, 2, GL_FLOAT, GL_FALSE, sizeof(Text2DVertex), (void*)0 );
 
-	// 2nd attribute buffer : UVs
+	// 2nd attribute : UVs
 	glEnableVertexAttribArray(vertexUVID);
-	glBindBuffer(GL_ARRAY_BUFFER, Text2DUVBufferID);
-	glVertexAttribPointer(vertexUVID, 2, GL_FLOAT, GL_FALSE, 0, (void*)0 );
+	glVertexAttribPointer(vertexUVID, 2, GL_FLOAT, GL_FALSE, sizeof(Text2DVertex), (void*)sizeof(glm::vec2) );
 
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	// Draw call
-	glDrawArrays(GL_TRIANGLES, 0, vertices.size() );
+	// Draw call, one for all queued text
+	glDrawArrays(GL_TRIANGLES, 0, Text2DQueued * 6 );
 
 	glDisable(GL_BLEND);
 
 	glDisableVertexAttribArray(vertexPosition_screenspaceID);
 	glDisableVertexAttribArray(vertexUVID);
 
+	Text2DQueued = 0;
+}
+
+void printText2D(const char * text, int x, int y, int size){
+
+	queueText2D(text, x, y, size);
+	flushText2D();
 }
 
 void cleanupText2D(){
 
 	// Delete buffers
 	glDeleteBuffers(1, &Text2DVertexBufferID);
-	glDeleteBuffers(1, &Text2DUVBufferID);
+	delete[] Text2DQueue;
+	Text2DQueue = NULL;
+	Text2DQueued = 0;
 
 	// Delete texture
 	glDeleteTextures(1, &Text2DTextureID);
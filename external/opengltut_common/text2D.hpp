@@ -3,6 +3,10 @@
 
 void initText2D(const char * texturePath);
 void printText2D(const char * text, int x, int y, int size);
+
+// Batched text: queue any number of strings, then draw them all with one upload and one draw call
+void queueText2D(const char * text, int x, int y, int size);
+void flushText2D();
 void cleanupText2D();
 
 #endif
\ No newline at end of file
@@ -117,95 +117,128 @@ GLuint loadBMP_custom(const char * imagepath){
 #define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
 #define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
 
-GLuint loadDDS(const char * imagepath){
+#define DDSD_MIPMAPCOUNT 0x20000	// Header flag: the mipmap count is valid
+#define DDPF_FOURCC 0x4				// Pixel format flag: the format is a four character code
 
-	unsigned char header[124];
+bool readDDS(const char * imagepath, DDSImage & image){
 
-	FILE *fp; 
- 
-	/* try to open the file */ 
-	fp = fopen(imagepath, "rb"); 
-	if (fp == NULL){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
-		return 0;
+	/* map the file, the pages are read when they are touched */ 
+	if (!image.file.open(imagepath)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		return false;
 	}
+	const unsigned char * file = (const unsigned char *)image.file.data();
+	size_t fileSize = image.file.size();
    
-	/* verify the type of file */ 
-	char filecode[4]; 
-	fread(filecode, 1, 4, fp); 
-	if (strncmp(filecode, "DDS ", 4) != 0) { 
-		fclose(fp); 
-		return 0; 
+	/* verify the type of file and the sizes of the surface desc and its pixel format */ 
+	if (fileSize < 128 || strncmp((const char *)file, "DDS ", 4) != 0) { 
+		printf("%s is not a DDS file\n", imagepath);
+		return false; 
 	}
-	
-	/* get the surface desc */ 
-	fread(&header, 124, 1, fp); 
-
-	unsigned int height      = *(unsigned int*)&(header[8 ]);
-	unsigned int width	     = *(unsigned int*)&(header[12]);
-	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
-	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
-	unsigned int fourCC      = *(unsigned int*)&(header[80]);
-
- 
-	unsigned char * buffer;
-	unsigned int bufsize;
-	/* how big is it going to be including all mipmaps? */ 
-	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
-	buffer = (unsigned char*)malloc(bufsize * sizeof(unsigned char)); 
-	fread(buffer, 1, bufsize, fp); 
-	/* close the file pointer */ 
-	fclose(fp);
-
-	unsigned int components  = (fourCC == FOURCC_DXT1) ? 3 : 4; 
-	unsigned int format;
-	switch(fourCC) 
+	unsigned int header[31];
+	memcpy(header, file + 4, sizeof(header));
+	if (header[0] != 124 || header[18] != 32) {
+		printf("%s has an invalid DDS header\n", imagepath);
+		return false;
+	}
+
+	unsigned int flags       = header[1];
+	unsigned int height      = header[2];
+	unsigned int width       = header[3];
+	unsigned int mipMapCount = (flags & DDSD_MIPMAPCOUNT) && header[6] > 0 ? header[6] : 1;
+	unsigned int formatFlags = header[19];
+	unsigned int fourCC      = header[20];
+
+	switch((formatFlags & DDPF_FOURCC) ? fourCC : 0) 
 	{ 
 	case FOURCC_DXT1: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
+		image.format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
 		break; 
 	case FOURCC_DXT3: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
+		image.format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
 		break; 
 	case FOURCC_DXT5: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
+		image.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
 		break; 
 	default: 
-		free(buffer); 
-		return 0; 
+		printf("%s is not DXT1, DXT3 or DXT5 compressed\n", imagepath);
+		return false; 
+	}
+	if (width == 0 || height == 0) {
+		printf("%s has no pixels\n", imagepath);
+		return false;
 	}
 
+	/* lay out the mip chain, every level is a whole number of 4x4 blocks */ 
+	unsigned int blockSize = (image.format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
+	size_t offset = 128;
+	image.levels.clear();
+	for (unsigned int level = 0; level < mipMapCount; ++level) 
+	{ 
+		DDSLevel mip;
+		mip.width = width;
+		mip.height = height;
+		mip.size = ((width+3)/4)*((height+3)/4)*blockSize; 
+		if (offset + mip.size > fileSize) {
+			printf("%s is cut short, only %u of %u mipmap levels are used\n", imagepath, level, mipMapCount);
+			break;
+		}
+		mip.data = file + offset;
+		image.levels.push_back(mip);
+		offset += mip.size; 
+
+		// The chain ends at 1x1, whatever the header says
+		if (width == 1 && height == 1) break;
+		width  = width > 1 ? width / 2 : 1; 
+		height = height > 1 ? height / 2 : 1; 
+	} 
+	if (image.levels.empty()) {
+		return false;
+	}
+
+	/* touch every page here, so the uploads on the GL thread do not wait for the disk */ 
+	volatile unsigned char touched = 0;
+	for (size_t page = 128; page < offset; page += 4096) touched += file[page];
+
+	return true;
+}
+
+GLuint uploadDDS(const DDSImage & image){
+
 	// Create one OpenGL texture
 	GLuint textureID;
 	glGenTextures(1, &textureID);
 
-	// "Bind" the newly created texture : all future texture functions will modify this texture
+	// Straight from the mapped file, the largest level last so it is made the one that is used
+	for (unsigned int level = image.levels.size(); level-- > 0;) 
+	{ 
+		uploadDDSLevel(textureID, image, level);
+	} 
+
+	return textureID;
+}
+
+void uploadDDSLevel(GLuint textureID, const DDSImage & image, unsigned int level){
+
+	// "Bind" the texture : all future texture functions will modify this texture
 	glBindTexture(GL_TEXTURE_2D, textureID);
 	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
-	
-	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
-	unsigned int offset = 0;
-
-	/* load the mipmaps */ 
-	for (unsigned int level = 0; level < mipMapCount && (width || height); ++level) 
-	{ 
-		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,  
-			0, size, buffer + offset); 
-	 
-		offset += size; 
-		width  /= 2; 
-		height /= 2; 
-
-		// Deal with Non-Power-Of-Two textures. This code is not included in the webpage to reduce clutter.
-		if(width < 1) width = 1;
-		if(height < 1) height = 1;
 
-	} 
+	const DDSLevel & mip = image.levels[level];
+	glCompressedTexImage2D(GL_TEXTURE_2D, level, image.format, mip.width, mip.height,  
+		0, mip.size, mip.data); 
 
-	free(buffer); 
+	// Only the levels that are there are used, so the texture can be drawn while the larger ones are missing
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels.size() - 1);
+}
 
-	return textureID;
+GLuint loadDDS(const char * imagepath){
 
+	DDSImage image;
+	if (!readDDS(imagepath, image)) {
+		return 0;
+	}
+	return uploadDDS(image);
 
-}
\ No newline at end of file
+}
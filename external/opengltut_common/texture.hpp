@@ -1,6 +1,8 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
+#include "lib/mapped_file.h"
+
 // Load a .BMP file using our custom loader
 GLuint loadBMP_custom(const char * imagepath);
 
@@ -12,5 +14,26 @@ GLuint loadBMP_custom(const char * imagepath);
 // Load a .DDS file using GLFW's own loader
 GLuint loadDDS(const char * imagepath);
 
+// The two halves of loadDDS: readDDS only maps and checks the file (no GL calls, so it can run on any thread),
+// uploadDDS creates the texture and has to run on the thread of the GL context. The levels point into the
+// mapped file, so the compressed data is never copied and the image has to live until it is uploaded.
+struct DDSLevel{
+	unsigned int width;
+	unsigned int height;
+	unsigned int size;				// Bytes of compressed data
+	const unsigned char * data;		// Start of the level in the mapped file
+};
+struct DDSImage{
+	MappedFile file;
+	GLenum format;
+	std::vector<DDSLevel> levels;	// Mip chain, largest level first
+};
+bool readDDS(const char * imagepath, DDSImage & image);
+GLuint uploadDDS(const DDSImage & image);
+
+// Upload a single level to a texture made with glGenTextures, and make it the largest level that is used. Uploading
+// the levels from the smallest to the largest shows a blurry texture right away that gets sharper with every level.
+void uploadDDSLevel(GLuint textureID, const DDSImage & image, unsigned int level);
+
 #include "texture.cpp"
 #endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <thread>
 
 #include <glm/glm.hpp>
 
@@ -132,6 +134,228 @@ void indexVBO(
 	}
 }
 
+// Open addressing hash table from packed vertices to their index, with linear probing.
+// The vertices are not stored in the table, only their index in a vertex array.
+class PackedVertexTable{
+	std::vector<unsigned int> slots; // Index + 1 of a vertex in vertices, 0 for an empty slot
+	size_t mask;
+	const std::vector<PackedVertex> & vertices;
+
+	static size_t hash(const PackedVertex & vertex){
+		// FNV-1a over the 8 words of the vertex
+		unsigned int words[sizeof(PackedVertex) / 4];
+		memcpy(words, &vertex, sizeof(PackedVertex));
+		size_t h = 2166136261u;
+		for ( unsigned int i=0; i<sizeof(PackedVertex) / 4; i++ ){
+			h = (h ^ words[i]) * 16777619u;
+		}
+		return h ^ (h >> 15);
+	}
+
+public:
+	// Room for expected vertices, the table is at most half full
+	PackedVertexTable(const std::vector<PackedVertex> & vertices, size_t expected) : vertices(vertices){
+		size_t size = 16;
+		while ( size < expected * 2 ) size *= 2;
+		slots.assign(size, 0);
+		mask = size - 1;
+	}
+
+	// Returns the index of a vertex equal to vertices[index], or adds index for it and returns index
+	unsigned int insert(unsigned int index){
+		const PackedVertex & vertex = vertices[index];
+		for ( size_t slot = hash(vertex) & mask; ; slot = (slot + 1) & mask ){
+			if ( slots[slot] == 0 ){
+				slots[slot] = index + 1;
+				return index;
+			}
+			if ( memcmp(&vertices[slots[slot] - 1], &vertex, sizeof(PackedVertex)) == 0 ){
+				return slots[slot] - 1;
+			}
+		}
+	}
+};
+
+// Merges the vertices first..last-1 of packed: unique gets the first occurrence of every vertex, in order,
+// and indices the position in unique of every vertex.
+void indexPackedVertices(const std::vector<PackedVertex> * packed, size_t first, size_t last,
+                         std::vector<unsigned int> * unique, unsigned int * indices){
+	PackedVertexTable table(*packed, last - first);
+	for ( size_t i=first; i<last; i++ ){
+		unsigned int found = table.insert((unsigned int)i);
+		if ( found == i ){
+			indices[i - first] = (unsigned int)unique->size();
+			unique->push_back((unsigned int)i);
+		}else{
+			indices[i - first] = indices[found - first];
+		}
+	}
+}
+
+void indexVBO32(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	bool parallel
+){
+	size_t count = in_vertices.size();
+	std::vector<PackedVertex> packed(count);
+	// The vertices are hashed and compared as bytes, which needs a struct without padding
+	static_assert(sizeof(PackedVertex) == 8 * sizeof(float), "PackedVertex must not contain padding");
+	for ( size_t i=0; i<count; i++ ){
+		packed[i].position = in_vertices[i];
+		packed[i].uv = in_uvs[i];
+		packed[i].normal = in_normals[i];
+	}
+
+	// Chunks of at least 64k vertices, one per thread
+	size_t chunkCount = 1;
+	if ( parallel ){
+		size_t threads = std::max(1u, std::thread::hardware_concurrency());
+		chunkCount = std::max<size_t>(1, std::min<size_t>(threads, count / 65536));
+	}
+	std::vector<size_t> bounds(chunkCount + 1);
+	for ( size_t c=0; c<=chunkCount; c++ ) bounds[c] = count * c / chunkCount;
+
+	// Merge every chunk on its own, into indices local to the chunk
+	size_t base = out_indices.size();
+	out_indices.resize(base + count);
+	unsigned int * indices = out_indices.data() + base;
+	std::vector< std::vector<unsigned int> > unique(chunkCount);
+	std::vector<std::thread> workers;
+	for ( size_t c=1; c<chunkCount; c++ ){
+		workers.push_back(std::thread(indexPackedVertices, &packed, bounds[c], bounds[c+1], &unique[c], indices + bounds[c]));
+	}
+	indexPackedVertices(&packed, bounds[0], bounds[1], &unique[0], indices);
+	for ( size_t i=0; i<workers.size(); i++ ) workers[i].join();
+
+	// Merge the unique vertices of all chunks, in order, so the result is the same as with a single chunk
+	size_t uniqueCount = 0;
+	for ( size_t c=0; c<chunkCount; c++ ) uniqueCount += unique[c].size();
+	PackedVertexTable table(packed, uniqueCount);
+	std::vector<unsigned int> first;            // Vertex in packed of every output vertex
+	std::vector< std::vector<unsigned int> > remap(chunkCount); // Output vertex of every vertex in unique
+	std::vector<unsigned int> output(count);    // Output vertex of the first occurrences, by position in packed
+	first.reserve(uniqueCount);
+	for ( size_t c=0; c<chunkCount; c++ ){
+		remap[c].resize(unique[c].size());
+		for ( size_t i=0; i<unique[c].size(); i++ ){
+			unsigned int vertex = unique[c][i];
+			unsigned int found = table.insert(vertex);
+			if ( found == vertex ){
+				output[vertex] = (unsigned int)(out_vertices.size() + first.size());
+				first.push_back(vertex);
+			}
+			remap[c][i] = output[found];
+		}
+	}
+
+	size_t outBase = out_vertices.size();
+	out_vertices.resize(outBase + first.size());
+	out_uvs     .resize(outBase + first.size());
+	out_normals .resize(outBase + first.size());
+	for ( size_t i=0; i<first.size(); i++ ){
+		out_vertices[outBase + i] = in_vertices[first[i]];
+		out_uvs     [outBase + i] = in_uvs[first[i]];
+		out_normals [outBase + i] = in_normals[first[i]];
+	}
+
+	// Local indices to output indices, every chunk on its own thread again
+	struct Remap{
+		static void run(unsigned int * indices, size_t count, const std::vector<unsigned int> * remap){
+			for ( size_t i=0; i<count; i++ ) indices[i] = (*remap)[indices[i]];
+		}
+	};
+	workers.clear();
+	for ( size_t c=1; c<chunkCount; c++ ){
+		workers.push_back(std::thread(Remap::run, indices + bounds[c], bounds[c+1] - bounds[c], &remap[c]));
+	}
+	Remap::run(indices, bounds[1], &remap[0]);
+	for ( size_t i=0; i<workers.size(); i++ ) workers[i].join();
+}
+
+// Tipsify: triangles are emitted around a fanning vertex, the next fanning vertex is a vertex of the last
+// triangles that will still be in the cache after its remaining triangles are emitted, preferring the one that
+// entered the cache first. When there is none, the most recently used vertex with triangles left is taken.
+void optimizeVertexCache(
+	std::vector<unsigned int> & indices,
+	unsigned int vertexCount,
+	unsigned int cacheSize
+){
+	size_t triangleCount = indices.size() / 3;
+	if ( triangleCount == 0 ) return;
+
+	// Triangles of every vertex, and how many of them are not emitted yet
+	std::vector<unsigned int> live(vertexCount, 0);
+	for ( size_t i=0; i<triangleCount*3; i++ ) live[indices[i]]++;
+	std::vector<size_t> offsets(vertexCount + 1, 0);
+	for ( unsigned int v=0; v<vertexCount; v++ ) offsets[v+1] = offsets[v] + live[v];
+	std::vector<unsigned int> adjacency(offsets[vertexCount]);
+	std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+	for ( size_t i=0; i<triangleCount*3; i++ ) adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+	std::vector<unsigned int> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<unsigned int> deadEnd;      // Vertices of emitted triangles, most recent last
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> result;
+	result.reserve(triangleCount * 3);
+	unsigned int time = cacheSize + 1;
+	unsigned int cursor = 0;                // Vertices before it have no triangles left
+	long fanning = 0;
+
+	while ( fanning >= 0 ){
+		candidates.clear();
+		for ( size_t a=offsets[fanning]; a<offsets[fanning+1]; a++ ){
+			unsigned int t = adjacency[a];
+			if ( emitted[t] ) continue;
+			emitted[t] = true;
+			for ( int k=0; k<3; k++ ){
+				unsigned int v = indices[t*3 + k];
+				result.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if ( time - cacheTime[v] > cacheSize ){
+					cacheTime[v] = time++;
+				}
+			}
+		}
+
+		// Next fanning vertex among the candidates
+		fanning = -1;
+		long best = -1;
+		for ( size_t i=0; i<candidates.size(); i++ ){
+			unsigned int v = candidates[i];
+			if ( live[v] == 0 ) continue;
+			long priority = 0;
+			if ( time - cacheTime[v] + 2 * live[v] <= cacheSize ) priority = time - cacheTime[v];
+			if ( priority > best ){
+				best = priority;
+				fanning = v;
+			}
+		}
+		// Dead end: a recent vertex with triangles left, or else the next one in order
+		while ( fanning < 0 && !deadEnd.empty() ){
+			unsigned int v = deadEnd.back();
+			deadEnd.pop_back();
+			if ( live[v] > 0 ) fanning = v;
+		}
+		while ( fanning < 0 && cursor < vertexCount ){
+			if ( live[cursor] > 0 ) fanning = cursor;
+			cursor++;
+		}
+	}
+
+	std::copy(result.begin(), result.end(), indices.begin());
+}
+
+
 
 
 
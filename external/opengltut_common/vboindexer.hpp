@@ -13,6 +13,29 @@ void indexVBO(
 );
 
 
+// Same as indexVBO, with 32-bit indices and a hash table instead of a std::map, for meshes of any size.
+// Vertices are merged when they are bitwise equal. With parallel, chunks of the mesh are merged on their
+// own threads first; the result is the same as without.
+void indexVBO32(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	bool parallel = false
+);
+
+// Reorders the triangles of an indexed triangle list so that vertices are reused while they are still in the
+// post-transform cache of the GPU (Tipsify, Sander et al. 2007). The triangles themselves are not changed.
+void optimizeVertexCache(
+	std::vector<unsigned int> & indices,
+	unsigned int vertexCount,
+	unsigned int cacheSize = 16
+);
+
 void indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
@@ -13,6 +13,8 @@
 #include<array>
 #include<iostream>
 #include<map>
+#include<unordered_map>
+#include<memory>
 #include<cmath>
 #include<fstream>
 #include<sstream>
@@ -44,15 +46,23 @@ typedef std::array<vec2d, 2> pos_vel;
         glm::ivec2 Size;
         glm::ivec2 Bearing;
         FT_Pos Advance;
+        glm::vec2 uvOffset;     // Top left corner of the glyph in its (atlas) texture
+        glm::vec2 uvSize;       // Size of the glyph in its texture
     };
 #endif // PIE_ONLY_BACKEND
 
 // Own libraries
 #include "lib/vecmath.h"
+#include "lib/metrics.h"
 #include "lib/simulation.h"
+#include "lib/trajectory.h"
+#include "lib/scenario.h"
+#include "lib/font_atlas.h"
 
 #ifndef PIE_ONLY_BACKEND
+    #include "lib/capture.h"
     #include "lib/visuals.h"
+    #include "lib/assets.h"
 #endif // PIE_ONLY_BACKEND
 
 #endif //PIE_GITHUB_FRAMEWORK_H
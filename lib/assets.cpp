@@ -0,0 +1,99 @@
+//
+// Loading of textures and fonts on worker threads, with the GL uploads on the thread of the GL context.
+//
+
+#include "assets.h"
+
+AssetLoader::~AssetLoader(){
+    for(size_t ii = 0; ii < assets.size(); ii++){
+        assets[ii].ready.wait();
+    }
+}
+unsigned AssetLoader::add(std::string path, std::shared_future<bool> ready, std::function<bool()> upload){
+    Asset asset;
+    asset.path = path;
+    asset.ready = ready;
+    asset.upload = upload;
+    asset.uploaded = false;
+    assets.push_back(asset);
+    return assets.size() - 1;
+}
+void AssetLoader::upload(Asset &asset, bool complete){
+    if(asset.uploaded) return;
+    bool done = true;
+    if(asset.ready.get()){
+        do{
+            done = asset.upload();
+        }while(complete && !done);
+        GLState::invalidate();  // The loaders bind textures directly
+    }else{
+        std::cerr << "[WARN]: could not load asset " << asset.path << std::endl;
+    }
+    if(done){
+        asset.upload = std::function<bool()>();     // Release the decoded data (and unmap the file)
+        asset.uploaded = true;
+    }
+}
+
+unsigned AssetLoader::loadTexture(std::string path, GLuint* texture, bool stream){
+    *texture = 0;
+    std::shared_ptr<DDSImage> image(new DDSImage());
+    std::shared_future<bool> ready = std::async(std::launch::async, [path, image](){
+        return readDDS(path.c_str(), *image);
+    }).share();
+    if(!stream){
+        return add(path, ready, [texture, image](){
+            *texture = uploadDDS(*image);
+            return true;
+        });
+    }
+    // The next level to upload, counting down to the largest (level 0)
+    std::shared_ptr<unsigned> level(new unsigned(0));
+    return add(path, ready, [texture, image, level](){
+        if(*texture == 0){
+            glGenTextures(1, texture);
+            *level = image->levels.size();
+        }
+        (*level)--;
+        uploadDDSLevel(*texture, *image, *level);
+        return *level == 0;
+    });
+}
+unsigned AssetLoader::loadFont(std::string path, TextShader** shader, int numOfChars){
+    *shader = NULL;
+    std::shared_ptr<GlyphAtlas> glyphs(new GlyphAtlas());
+    // A distance field atlas baked next to the font is used instead of rasterising the font
+    std::string atlasPath = path.substr(0, path.rfind('.')) + ".pfnt";
+    std::shared_future<bool> ready = std::async(std::launch::async, [path, atlasPath, glyphs, numOfChars](){
+        if(access(atlasPath.c_str(), R_OK) != 0 || !readFontAtlas(atlasPath.c_str(), *glyphs)){
+            *glyphs = rasteriseFont(path.c_str(), numOfChars);
+        }
+        return true;
+    }).share();
+    return add(path, ready, [shader, glyphs](){
+        *shader = new TextShader(*glyphs);
+        return true;
+    });
+}
+
+void AssetLoader::poll(){
+    for(size_t ii = 0; ii < assets.size(); ii++){
+        if(!assets[ii].uploaded && assets[ii].ready.wait_for(std::chrono::seconds(0)) == std::future_status::ready){
+            upload(assets[ii], false);
+        }
+    }
+}
+void AssetLoader::finish(unsigned asset){
+    if(asset < assets.size()) upload(assets[asset], true);
+}
+void AssetLoader::preview(unsigned asset){
+    if(asset < assets.size()) upload(assets[asset], false);
+}
+void AssetLoader::finishAll(){
+    for(size_t ii = 0; ii < assets.size(); ii++){
+        upload(assets[ii], true);
+    }
+}
+bool AssetLoader::isLoaded(unsigned asset){
+    return asset < assets.size() && assets[asset].uploaded;
+}
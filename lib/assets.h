@@ -0,0 +1,58 @@
+//
+// Loading of textures and fonts on worker threads, with the GL uploads on the thread of the GL context.
+//
+
+#ifndef PIE_GITHUB_FRAMEWORK_H
+
+#include "framework.h"
+
+#endif
+
+#ifndef PIE_GITHUB_ASSETS_H
+#define PIE_GITHUB_ASSETS_H
+
+#include <future>
+#include <functional>
+#include <memory>
+
+// Reads and decodes assets in the background. Every load starts a task that reads the file and does all CPU work
+// (DDS parsing, glyph rasterisation) without GL calls. The GL objects are made by poll() and finish() on the GL
+// thread, so a scene only waits for its own assets and the rest keeps loading while it is drawn.
+class AssetLoader{
+private:
+    struct Asset{
+        std::string path;
+        std::shared_future<bool> ready;     // Result of the worker task, false when the file could not be read
+        std::function<bool()> upload;       // Makes (part of) the GL object from the task's result, true when it is done
+        bool uploaded;
+    };
+    std::vector<Asset> assets;
+
+    unsigned add(std::string path, std::shared_future<bool> ready, std::function<bool()> upload);
+    void upload(Asset &asset, bool complete);
+
+public:
+    // Waits for the tasks that are still running, assets that were not uploaded are dropped
+    ~AssetLoader();
+
+    // Start loading a DDS texture, *texture is set when it is uploaded (0 if it could not be loaded).
+    // Returns the number of the asset for finish() and isLoaded(). A streamed texture is uploaded one mipmap level
+    // per poll(), from the smallest to the largest, so it can be drawn (blurry) before it is complete.
+    unsigned loadTexture(std::string path, GLuint* texture, bool stream = false);
+    // Start loading a font, *shader is set to a new TextShader (owned by the caller) when it is uploaded. The distance
+    // field atlas with the same name and the extension .pfnt is used when it exists, otherwise the font is rasterised.
+    unsigned loadFont(std::string path, TextShader** shader, int numOfChars = 128);
+
+    // Upload the assets whose tasks are done, without waiting
+    void poll();
+    // Wait for an asset (or all of them) and upload it
+    void finish(unsigned asset);
+    // Wait for an asset and upload enough to use it: the smallest level of a streamed texture
+    void preview(unsigned asset);
+    void finishAll();
+    bool isLoaded(unsigned asset);
+};
+
+#include "assets.cpp"
+
+#endif //PIE_GITHUB_ASSETS_H
@@ -0,0 +1,293 @@
+//
+// Screenshots and frame sequences of the window, read back asynchronously and written by a background thread.
+//
+
+#include "capture.h"
+
+FrameCapture::FrameCapture() {
+    _supported = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+    _persistent = _supported && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage);
+    if (!_supported) {
+        std::cerr << "[WARN] Fences are not supported, frames can not be captured" << std::endl;
+    }
+    _writer = std::thread(&FrameCapture::writer_loop, this);
+}
+
+FrameCapture::~FrameCapture() {
+    shutdown();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closing = true;
+    }
+    _slotReady.notify_one();
+    _writer.join();
+}
+
+void FrameCapture::shutdown() {
+    stop();
+    flush();
+    release();
+}
+
+/*
+ * allocate()
+ *
+ * (Re)create the PBOs for frames of width x height pixels. Only called when no slot is in use.
+ */
+void FrameCapture::allocate(int width, int height) {
+    release();
+    _width = width;
+    _height = height;
+    GLsizeiptr size = (GLsizeiptr)width * height * 4;
+
+    for (unsigned ii = 0; ii < SLOTS; ++ii) {
+        Slot &slot = _slots[ii];
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        if (_persistent) {
+            // Coherent, so the pixels are visible to the CPU as soon as the fence has passed
+            GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_PACK_BUFFER, size, NULL, flags);
+            slot.pixels = (const char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, flags);
+            if (slot.pixels == NULL) {
+                std::cerr << "[WARN] Could not map the capture buffers persistently, copying the frames instead" << std::endl;
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                _persistent = false;
+                allocate(width, height);
+                return;
+            }
+        } else {
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+            slot.copy.resize(size);
+            slot.pixels = slot.copy.data();
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void FrameCapture::release() {
+    if (_width == 0) {
+        return;     // Nothing allocated, or already released (then there may be no GL context anymore)
+    }
+    for (unsigned ii = 0; ii < SLOTS; ++ii) {
+        Slot &slot = _slots[ii];
+        if (slot.buffer == 0) {
+            continue;
+        }
+        if (_persistent && slot.pixels != NULL) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glDeleteBuffers(1, &slot.buffer);
+        slot.buffer = 0;
+        slot.pixels = NULL;
+        std::vector<char>().swap(slot.copy);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _width = 0;
+    _height = 0;
+}
+
+/*
+ * collect()
+ *
+ * Hand the slots whose copy is done to the writer thread, in the order they were read. Without wait it
+ * returns at the first slot that is not done yet, with wait it blocks until all are handed over.
+ */
+void FrameCapture::collect(bool wait) {
+    while (_reading.size()) {
+        unsigned index = _reading.front();
+        Slot &slot = _slots[index];
+        GLenum result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GLuint64(1E9) : 0);
+        if (result == GL_TIMEOUT_EXPIRED && !wait) {
+            return;
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        _reading.pop_front();
+
+        if (!_persistent) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            GLsizeiptr size = slot.copy.size();
+            const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+            if (mapped != NULL) {
+                std::memcpy(slot.copy.data(), mapped, size);
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            slot.state = WRITING;
+            _full.push_back(index);
+        }
+        _slotReady.notify_one();
+    }
+}
+
+// Wait until every frame that was read back is on disk
+void FrameCapture::flush() {
+    collect(true);
+    std::unique_lock<std::mutex> lock(_mutex);
+    _slotFree.wait(lock, [this]() {
+        for (unsigned ii = 0; ii < SLOTS; ++ii) {
+            if (_slots[ii].state != FREE) return false;
+        }
+        return true;
+    });
+}
+
+bool FrameCapture::start(std::string prefix) {
+    if (!_supported) {
+        return false;
+    }
+    stop();
+    _prefix = prefix;
+    _recording = true;
+    _sequenceFrame = 0;
+    _frames = 0;
+    _dropped = 0;
+    _maxCost = 0;
+    _failed = false;
+    return true;
+}
+
+void FrameCapture::stop() {
+    if (!_recording) {
+        return;
+    }
+    _recording = false;
+    flush();
+    if (_dropped) {
+        std::cerr << "[WARN] " << _dropped << " of " << _sequenceFrame << " frames were dropped while capturing to "
+                  << _prefix << std::endl;
+    }
+}
+
+void FrameCapture::screenshot(std::string path) {
+    if (!_supported) {
+        return;
+    }
+    _screenshot = path;
+}
+
+/*
+ * frame()
+ *
+ * Queue the readback of the back buffer into the next free PBO. Costs the glReadPixels call and a fence,
+ * the pixels are picked up in a later frame by collect().
+ */
+void FrameCapture::frame(int width, int height) {
+    if (!_supported || (_reading.empty() && !_recording && _screenshot.empty())) {
+        return;
+    }
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+    collect(false);
+    if ((_recording || _screenshot.size()) && width > 0 && height > 0) {
+        if (width != _width || height != _height) {
+            // The window was resized, new buffers once the old frames are written
+            flush();
+            allocate(width, height);
+        }
+
+        Slot &slot = _slots[_next];
+        bool free;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            free = slot.state == FREE && !_failed;
+        }
+        if (free) {
+            slot.paths.clear();
+            if (_recording) {
+                char number[32];
+                std::snprintf(number, sizeof(number), "%06llu.ppm", _sequenceFrame);
+                slot.paths.push_back(_prefix + number);
+            }
+            if (_screenshot.size()) {
+                slot.paths.push_back(_screenshot);
+                _screenshot.clear();
+            }
+
+            // Only queues the copy on the GPU
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadBuffer(GL_BACK);
+            glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, (void*)0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            slot.state = READING;
+            _reading.push_back(_next);
+            _next = (_next + 1) % SLOTS;
+            if (_recording) ++_frames;
+        } else if (_recording) {
+            ++_dropped;
+        }
+        if (_recording) ++_sequenceFrame;
+    }
+
+    double cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    _maxCost = std::max(_maxCost, cost);
+}
+
+/*
+ * writer_loop()
+ *
+ * Runs on the writer thread: write the frames handed over by collect() and free their slots.
+ */
+void FrameCapture::writer_loop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _slotReady.wait(lock, [this]() { return _full.size() || _closing; });
+        if (_full.empty() && _closing) {
+            break;
+        }
+
+        unsigned index = _full.front();
+        _full.pop_front();
+        lock.unlock();
+
+        bool ok = write_ppm(_slots[index]);
+
+        lock.lock();
+        _failed = _failed || !ok;
+        _slots[index].state = FREE;
+        _slotFree.notify_all();
+    }
+}
+
+/*
+ * write_ppm()
+ *
+ * Convert the BGRA rows (bottom row first) to a binary PPM image (top row first, RGB) and write it to
+ * every path of the slot.
+ */
+bool FrameCapture::write_ppm(const Slot &slot) {
+    char header[64];
+    int headerSize = std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", _width, _height);
+    _image.resize(headerSize + (size_t)_width * _height * 3);
+    std::memcpy(&_image[0], header, headerSize);
+
+    unsigned char* out = (unsigned char*)&_image[headerSize];
+    for (int yy = _height - 1; yy >= 0; --yy) {
+        const unsigned char* in = (const unsigned char*)slot.pixels + (size_t)yy * _width * 4;
+        for (int xx = 0; xx < _width; ++xx, in += 4, out += 3) {
+            out[0] = in[2];
+            out[1] = in[1];
+            out[2] = in[0];
+        }
+    }
+
+    bool ok = true;
+    for (size_t ii = 0; ii < slot.paths.size(); ++ii) {
+        FILE* file = std::fopen(slot.paths[ii].c_str(), "wb");
+        bool written = file != NULL && std::fwrite(&_image[0], 1, _image.size(), file) == _image.size();
+        written = (file != NULL && std::fclose(file) == 0) && written;
+        if (!written) {
+            std::cerr << "[WARN] Could not write frame " << slot.paths[ii] << ", stopped capturing" << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
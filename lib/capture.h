@@ -0,0 +1,118 @@
+//
+// Screenshots and frame sequences of the window, read back asynchronously and written by a background thread.
+//
+
+#ifndef PIE_GITHUB_FRAMEWORK_H
+
+#include "framework.h"
+
+#endif
+
+#ifndef PIE_GITHUB_CAPTURE_H
+#define PIE_GITHUB_CAPTURE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * A frame is read back with glReadPixels into a pixel buffer object (PBO) of a small ring. The call only
+ * queues a copy on the GPU and returns, a fence marks when the copy is done. Frames later, when the fence
+ * has passed, the PBO is handed to the writer thread, which converts the pixels and writes a binary PPM
+ * file. The render thread never waits for the GPU or the disk: when every PBO is still in use the frame is
+ * dropped and counted instead.
+ *
+ * With GL_ARB_buffer_storage the PBOs stay mapped, so the writer thread reads the pixels in place and the
+ * render thread copies nothing. Without it the pixels are copied out of the mapped PBO on the render thread.
+ * Fences (GL 3.2 or GL_ARB_sync) are required, without them capturing is disabled with a warning.
+ */
+class FrameCapture{
+private:
+    // States of a PBO of the ring
+    static const unsigned FREE = 0;         // Can be read into
+    static const unsigned READING = 1;      // The GPU copies a frame into it
+    static const unsigned WRITING = 2;      // The writer thread writes it to disk
+
+    struct Slot{
+        GLuint buffer = 0;
+        GLsync fence = 0;
+        const char* pixels = NULL;      // Persistent mapping of the buffer, or copy
+        std::vector<char> copy;         // Pixels copied out of the buffer when it cannot stay mapped
+        unsigned state = FREE;
+        std::vector<std::string> paths; // Files the frame is written to
+    };
+
+    static const unsigned SLOTS = 3;
+    Slot _slots[SLOTS];
+    unsigned _next = 0;                 // Slot the next frame is read into
+    std::deque<unsigned> _reading;      // Slots in the READING state, oldest first
+    int _width = 0;                     // Size the PBOs are allocated for
+    int _height = 0;
+    bool _supported;
+    bool _persistent;
+
+    // What to capture
+    bool _recording = false;
+    std::string _prefix;                // Frame k of a sequence is written to <prefix><k, 6 digits>.ppm
+    std::string _screenshot;            // Path of a requested screenshot, empty for none
+    unsigned long long _sequenceFrame = 0;  // Frames since start(), dropped frames included
+    unsigned long long _frames = 0;     // Frames read back since start()
+    unsigned long long _dropped = 0;    // Frames dropped since start() because no PBO was free
+    double _maxCost = 0;                // Longest time frame() took on the render thread since start() [s]
+
+    // Hand over between the render and the writer thread, the writer owns the slots in _full
+    std::deque<unsigned> _full;
+    std::mutex _mutex;
+    std::condition_variable _slotReady;
+    std::condition_variable _slotFree;
+    bool _closing = false;
+    bool _failed = false;
+    std::thread _writer;
+    std::vector<char> _image;           // PPM file being written, only used by the writer thread
+
+    void allocate(int width, int height);
+    void release();
+    void collect(bool wait);
+    void flush();
+    void writer_loop();
+    bool write_ppm(const Slot &slot);
+
+    // Not copyable, the PBOs and the writer thread have a single owner
+    FrameCapture(const FrameCapture &);
+    FrameCapture &operator=(const FrameCapture &);
+
+public:
+    // Needs a current GL context
+    FrameCapture();
+    ~FrameCapture();
+
+    // Write every frame from now on to <prefix>000000.ppm, <prefix>000001.ppm, ... The numbers count all frames,
+    // so a dropped frame leaves a gap in the sequence.
+    bool start(std::string prefix);
+
+    // Stop the sequence and wait until all its frames are on disk
+    void stop();
+
+    // Write the frames still in flight and delete the PBOs. Needs the GL context, so call it before the context is
+    // destroyed; the destructor only stops the writer thread afterwards.
+    void shutdown();
+
+    // Write the next frame to a file (also while a sequence is captured)
+    void screenshot(std::string path);
+
+    // Call when a frame is drawn, before the buffers are swapped. Reads the back buffer of width x height pixels
+    // when something is captured and hands earlier frames that are done to the writer thread.
+    void frame(int width, int height);
+
+    bool is_recording() const { return _recording; }
+    unsigned long long frames() const { return _frames; }
+    unsigned long long dropped() const { return _dropped; }
+    double max_cost() const { return _maxCost; }
+};
+
+#include "capture.cpp"
+
+#endif //PIE_GITHUB_CAPTURE_H
@@ -0,0 +1,63 @@
+//
+// Baked signed distance field font atlases: one texture per font that draws crisp text at any size.
+//
+
+#include "font_atlas.h"
+
+#include <cstdio>
+
+bool FontAtlasFile::open(std::string path) {
+    if (!_file.open(path)) {
+        return false;
+    }
+    if (_file.size() < sizeof(FontAtlasHeader) || std::memcmp(_file.data(), "PIEFONT", 8) != 0) {
+        std::cerr << "[WARN] " << path << " is not a font atlas" << std::endl;
+        _file.close();
+        return false;
+    }
+    std::memcpy(&_header, _file.data(), sizeof(_header));
+
+    // The glyph records are used in place, so they have to be aligned and inside the file
+    uint64_t glyphEnd = (uint64_t)_header.header_size + (uint64_t)_header.glyph_count * sizeof(FontAtlasGlyph);
+    uint64_t pixelEnd = (uint64_t)_header.pixel_offset + (uint64_t)_header.width * _header.height;
+    if (_header.version != 1 || _header.header_size < sizeof(FontAtlasHeader) || _header.header_size % 4 != 0 ||
+        glyphEnd > _header.pixel_offset || pixelEnd > _file.size() || _header.pixel_size == 0) {
+        std::cerr << "[WARN] Unsupported or damaged font atlas " << path << std::endl;
+        _file.close();
+        return false;
+    }
+    for (uint32_t ii = 0; ii < _header.glyph_count; ++ii) {
+        const FontAtlasGlyph &glyph = glyphs()[ii];
+        if (glyph.width < 0 || glyph.height < 0 || glyph.x < 0 || glyph.y < 0 ||
+            glyph.x + glyph.width > (int64_t)_header.width || glyph.y + glyph.height > (int64_t)_header.height) {
+            std::cerr << "[WARN] Glyph " << ii << " lies outside the font atlas " << path << std::endl;
+            _file.close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void FontAtlasFile::prefault() const {
+    volatile unsigned char touched = 0;
+    for (size_t offset = 0; offset < _file.size(); offset += 4096) {
+        touched += _file.data()[offset];
+    }
+}
+
+bool FontAtlasFile::save(std::string path, const FontAtlasHeader &header, const std::vector<FontAtlasGlyph> &glyphs,
+                         const std::vector<unsigned char> &pixels) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        std::cerr << "[WARN] Could not open font atlas " << path << std::endl;
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && (glyphs.empty() || std::fwrite(&glyphs[0], sizeof(FontAtlasGlyph), glyphs.size(), file) == glyphs.size());
+    ok = ok && (pixels.empty() || std::fwrite(&pixels[0], 1, pixels.size(), file) == pixels.size());
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok) {
+        std::cerr << "[WARN] Could not write font atlas " << path << std::endl;
+    }
+    return ok;
+}
@@ -0,0 +1,79 @@
+//
+// Baked signed distance field font atlases: one texture per font that draws crisp text at any size.
+//
+
+#ifndef PIE_GITHUB_FRAMEWORK_H
+
+#include "framework.h"
+
+#endif
+
+#ifndef PIE_GITHUB_FONT_ATLAS_H
+#define PIE_GITHUB_FONT_ATLAS_H
+
+#include <cstdint>
+#include <cstring>
+
+#include "mapped_file.h"
+
+/*
+ * File layout (all values little endian), written by pie_fontbake:
+ *
+ *   FontAtlasHeader
+ *   glyph_count FontAtlasGlyph records, indexed by character code
+ *   width x height pixels of one byte
+ *
+ * Every pixel holds the distance to the outline of the nearest glyph: 128 on the outline, above it inside
+ * and below it outside, 127 steps per spread pixels. Drawing the atlas with a threshold at 128 gives sharp
+ * edges at every scale, so one atlas serves all text sizes.
+ *
+ * Glyph metrics are in pixels of the baked size (pixel_size pixels per em), with the spread included in the
+ * size and bearing, so a glyph quad covers its whole distance field. advance is in 1/64 pixels, like FreeType.
+ */
+struct FontAtlasHeader{
+    char magic[8];          // "PIEFONT" with a trailing zero
+    uint32_t version;
+    uint32_t header_size;   // sizeof(FontAtlasHeader), offset of the first glyph record
+    uint32_t width;         // Atlas dimensions in pixels
+    uint32_t height;
+    uint32_t glyph_count;   // Amount of glyph records
+    uint32_t pixel_size;    // Size the glyphs are baked at
+    uint32_t spread;        // Distance in pixels from the outline to the ends of the value range
+    uint32_t pixel_offset;  // Offset of the atlas pixels
+};
+
+struct FontAtlasGlyph{
+    int32_t width;          // Size of the glyph quad
+    int32_t height;
+    int32_t bearing_x;      // Offset of the quad from the pen position, y upwards
+    int32_t bearing_y;
+    int32_t advance;        // Pen movement to the next glyph [1/64 pixel]
+    int32_t x;              // Top left corner of the glyph in the atlas
+    int32_t y;
+};
+
+// A baked atlas file, mapped into memory. The glyphs and pixels are used in place, nothing is copied.
+class FontAtlasFile{
+private:
+    MappedFile _file;
+    FontAtlasHeader _header;
+
+public:
+    // Map and check the file, returns false (with a warning) if it is not a valid atlas
+    bool open(std::string path);
+
+    const FontAtlasHeader &header() const { return _header; }
+    const FontAtlasGlyph* glyphs() const { return (const FontAtlasGlyph*)(_file.data() + _header.header_size); }
+    const unsigned char* pixels() const { return (const unsigned char*)_file.data() + _header.pixel_offset; }
+
+    // Read all pages, so later use of the pixels does not wait for the disk
+    void prefault() const;
+
+    // Write an atlas file
+    static bool save(std::string path, const FontAtlasHeader &header, const std::vector<FontAtlasGlyph> &glyphs,
+                     const std::vector<unsigned char> &pixels);
+};
+
+#include "font_atlas.cpp"
+
+#endif //PIE_GITHUB_FONT_ATLAS_H
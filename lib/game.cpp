@@ -34,28 +34,49 @@ void maingame(int startScene) {
     Window window = Window(pixRatio*universeWidth,pixRatio*universeHeight,vis::NO_RESIZE);
     window.pixRatio = pixRatio;
 
-    // load all textures with a texture loader provided by openGL_tutorials
-    GLuint menuTex = loadDDS("Textures/MenuTextures.DDS");
-    GLuint tutorialDDS = loadDDS("Textures/Tutorial2.DDS");
-    GLuint space = loadDDS("Textures/SpaceCrop.DDS");
-
-    // Creaqte Texture shaders containing the Textures previously loaded
-    TextureShader menuMultiTex = TextureShader(menuTex);
-    TextureShader tutorialTex = TextureShader(tutorialDDS);
+    // Read the textures and rasterise the fonts on worker threads while the shaders are compiled here. The GL objects
+    // are made when a scene needs them, or by assets.poll() while the menu is shown.
+    AssetLoader assets;
+    GLuint uiTex, space;
+    unsigned uiAsset = assets.loadTexture("Textures/UI.DDS", &uiTex);     // Menu and tutorial sprites (see UI.sprites)
+    unsigned spaceAsset = assets.loadTexture("Textures/SpaceCrop.DDS", &space, true);  // Sharpens while the menu is shown
+    // Textshaders for Score and the about scene
+    TextShader* scoreText;
+    TextShader* aboutText;
+    unsigned scoreAsset = assets.loadFont("Fonts/Courier New Bold.ttf", &scoreText);
+    unsigned aboutAsset = assets.loadFont("Fonts/verdana.ttf", &aboutText);
+
+    // Create a circle shader to draw all Objects in one draw call
+    InstancedCircleShader allDebrisShader;
+    // Heat map of the objects, the D key switches to it
+    DensityShader densityShader;
+    window.densityShader = &densityShader;
+    // Fading trails behind the objects, the T key switches them on
+    TrailShader trailShader;
+    window.trailShader = &trailShader;
+    // Screenshots (F12) and frame sequences (F9) of the window
+    FrameCapture capture;
+    window.capture = &capture;
+
+    // Create the shaders for the textures, the menu can not be shown without its sprites. All menu and tutorial
+    // images are sprites of one atlas, drawn by one SpriteBatch.
+    SpriteAtlas uiAtlas;
+    readSpriteAtlas("Textures/UI.atlas", uiAtlas);
+    assets.finish(uiAsset);
+    assets.preview(spaceAsset);
+    SpriteBatch uiSprites = SpriteBatch(uiTex, uiAtlas);
     TextureShader spaceTex = TextureShader(space);
 
-    // Store the size of the tutorial image for drawing and initilizing
+    // Store the sprite and size of the tutorial image for drawing and initilizing
+    int tutorialSprite = uiAtlas.find("tutorial");
     vec2d tutorialSize = {640, 480};
+    if (tutorialSprite >= 0) {
+        tutorialSize = {(double)uiAtlas.sprites[tutorialSprite].size.x, (double)uiAtlas.sprites[tutorialSprite].size.y};
+    }
 
-    // Create a circle shader to draw Objects
-    CircleShader allDebrisShader;
-
-    // Create textshaders for Score and the about scene
-    TextShader scoreText = TextShader("Fonts/Courier New Bold.ttf");
-    TextShader aboutText = TextShader("Fonts/verdana.ttf");
-
-    // Load menu resources and store the transformation matrices necessary to display
-    std::vector<glm::mat3> tMats = loadMenuResources(&menuMultiTex);
+    // Load menu resources and store the sprites and transformation matrices necessary to display
+    std::vector<int> menuSprites;
+    std::vector<glm::mat3> tMats = loadMenuResources(uiAtlas, menuSprites);
 
     do {
 
@@ -71,7 +92,7 @@ void maingame(int startScene) {
             Joystick = glfwJoystickPresent(GLFW_JOYSTICK_1);
 
             // Show the menu
-            scene = show_menu(&window, &menuMultiTex, tMats, &allDebrisShader,&spaceTex);
+            scene = show_menu(&window, &uiSprites, menuSprites, tMats, &allDebrisShader,&spaceTex,&assets);
 
             // Clear all heap variables
             window.bindUniverse(NULL);
@@ -80,7 +101,8 @@ void maingame(int startScene) {
 
         // Show the about scene
         if (scene == SCENE_ABOUT) {
-            scene = show_about(&window, &aboutText);
+            assets.finish(aboutAsset);
+            scene = show_about(&window, aboutText);
             continue;
         }
 
@@ -90,6 +112,8 @@ void maingame(int startScene) {
             window.bindUniverse(universe);
 
             generateStandardUniverse(&window);
+            // The rest of the background, if the menu was left before it was streamed in
+            assets.finish(spaceAsset);
 
             // Check if joystick is present for this scene
             Joystick = glfwJoystickPresent(GLFW_JOYSTICK_1);
@@ -105,12 +129,13 @@ void maingame(int startScene) {
 
         if (scene == SCENE_TUTORIAL) {
             shownTutorial = true;
-            scene = show_tutorial(&window,&allDebrisShader,&tutorialTex,tutorialSize,&spaceTex);
+            scene = show_tutorial(&window,&allDebrisShader,&uiSprites,tutorialSprite,tutorialSize,&spaceTex);
 
         }
 
         if (scene == SCENE_INGAME) {
-            scene = show_ingame(&window, &allDebrisShader,&scoreText,&spaceTex);
+            assets.finish(scoreAsset);
+            scene = show_ingame(&window, &allDebrisShader,scoreText,&spaceTex);
         }
 
         if (scene == SCENE_DIED) {
@@ -119,13 +144,14 @@ void maingame(int startScene) {
             // Display the score
             std::stringstream diedText;
             diedText << "You hit something! Press the ESC key to return to the menu";
-            aboutText.draw(diedText.str(), {0,0}, DRAWTEXT::ALIGN_CENTER, window.windowSize(), 0.02);
+            assets.finish(aboutAsset);
+            aboutText->drawCached(diedText.str(), {0,0}, DRAWTEXT::ALIGN_CENTER, window.windowSize(), 0.02);
 
             int joyCount;
             const unsigned char* joyButtons;
             bool hitButton=false;
             glfwSetKeyCallback(window.GLFWpointer,escape_key_callback);
-            glfwSwapBuffers(window.GLFWpointer);
+            window.swapBuffers();
             do {
                 keyHandler ={};
                 glfwPollEvents();
@@ -168,9 +194,14 @@ void maingame(int startScene) {
     if (window.boundUniverse!=NULL){
         delete window.boundUniverse;
     }
+    delete scoreText;
+    delete aboutText;
+    // The last frames of a sequence are read back through the GL context, so finish them before it is gone
+    capture.shutdown();
+    window.capture = NULL;
     glfwTerminate();
 }
-int show_ingame (Window* window, CircleShader* circleShader, TextShader* textShader, TextureShader* background) {
+int show_ingame (Window* window, InstancedCircleShader* circleShader, TextShader* textShader, TextureShader* background) {
     int exitFlag = SCENE_INGAME;
 
     // Initialise a few variables to store time data etc.
@@ -194,17 +225,21 @@ int show_ingame (Window* window, CircleShader* circleShader, TextShader* textSha
         glClear(GL_COLOR_BUFFER_BIT);
         // if a background shader is provided, draw that background
         if(background!=NULL){
-            background->draw();
+            window->renderQueue.add(background, LAYER_BACKGROUND);
         }
         // Do a physics step and draw the universe
         window->boundUniverse->simulate_one_time_unit(window->fps);
-        window->drawObjectList(circleShader);
+        window->queueTrails(LAYER_TRAILS);
+        window->queueObjectList(circleShader, LAYER_OBJECTS);
         // If a textShader is provided draw the score to the screen
         if(textShader!=NULL) {
             scoreText.str(std::string());
             scoreText << "Score: " << window->boundUniverse->score;
-            textShader->draw(scoreText.str() ,{0, -0.92},DRAWTEXT::ALIGN_CENTER, window->windowSize() , 0.02);
+            textShader->add(scoreText.str() ,{0, -0.92},DRAWTEXT::ALIGN_CENTER, window->windowSize() , 0.02);
+            window->renderQueue.add(textShader, LAYER_INTERFACE);
         }
+        // Draw everything with the least state changes
+        window->renderQueue.submit();
 
         // Determine if we want to add another piece of debris (once every MORE_OBJECT_DELAY starting at NEW_OBJECTS_DELAY)
         now_time = std::chrono::steady_clock::now();
@@ -231,7 +266,7 @@ int show_ingame (Window* window, CircleShader* circleShader, TextShader* textSha
         window->pace_frame();
 
         // Put buffer on screen and find all pressed keys.
-        glfwSwapBuffers(window->GLFWpointer);
+        window->swapBuffers();
         keyHandler = {};
         glfwPollEvents();
 
@@ -259,18 +294,18 @@ int show_about (Window* window, TextShader* newText) {
     // Create white letters
     newText->colour = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
 
-    // Draw line by line the text to this buffer
-    newText->draw("Space Debris Evaders is a game developed for the course", {0, 0.8}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
-    newText->draw("'Programming in Engineering' at the University of Twente", {0, 0.7}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
-    newText->draw("The goal is to learn C++ by developing a game.", {0, 0.6}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
-    newText->draw("Authors:", {0, 0.4}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
-    newText->draw("Arash Edrisi", {0, 0.3}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
-    newText->draw("Yvan Klaver", {0, 0.2}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
-    newText->draw("Paul van Swinderen", {0, 0.1}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
-    newText->draw("Press ESC to return to the menu", {0, -0.4}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
+    // Draw line by line the text to this buffer, the lines are laid out once and kept on the GPU
+    newText->drawCached("Space Debris Evaders is a game developed for the course", {0, 0.8}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
+    newText->drawCached("'Programming in Engineering' at the University of Twente", {0, 0.7}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
+    newText->drawCached("The goal is to learn C++ by developing a game.", {0, 0.6}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
+    newText->drawCached("Authors:", {0, 0.4}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
+    newText->drawCached("Arash Edrisi", {0, 0.3}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
+    newText->drawCached("Yvan Klaver", {0, 0.2}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
+    newText->drawCached("Paul van Swinderen", {0, 0.1}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
+    newText->drawCached("Press ESC to return to the menu", {0, -0.4}, DRAWTEXT::ALIGN_CENTER, window->windowSize(), 0.02);
 
     // put the buffer on screen and set a escape key callback
-    glfwSwapBuffers(window->GLFWpointer);
+    window->swapBuffers();
     glfwSetKeyCallback(window->GLFWpointer,escape_key_callback);
     do {
         // keep reseting the keyhandler and poll events to store to the key handler
@@ -296,7 +331,7 @@ int show_about (Window* window, TextShader* newText) {
 
 }
 
-int show_tutorial(Window* window, CircleShader* circleShader,TextureShader* tutorialTex, vec2d tutorialSize, TextureShader* background){
+int show_tutorial(Window* window, InstancedCircleShader* circleShader,SpriteBatch* sprites, int tutorialSprite, vec2d tutorialSize, TextureShader* background){
     // Default
     int exitFlag = SCENE_TUTORIAL;
 
@@ -319,17 +354,19 @@ int show_tutorial(Window* window, CircleShader* circleShader,TextureShader* tuto
 
     // Scale the tutorial image to window size
     winSize = window->windowSize();
-    tutorialTex->tMatrixReset();
-    tutorialTex->tMatrixScale({tutorialSize[0]*window->pixRatio/(winSize[0]*25), tutorialSize[1]*window->pixRatio/(winSize[1]*25)});
+    glm::mat3 tutorialMatrix = glm::mat3(1.0f);
+    tutorialMatrix[0][0] = tutorialSize[0]*window->pixRatio/(winSize[0]*25);
+    tutorialMatrix[1][1] = tutorialSize[1]*window->pixRatio/(winSize[1]*25);
 
     // Draw the universe objects
     window->drawObjectList(circleShader);
 
     // Draw the tutorial image
-    tutorialTex->draw();
+    sprites->add(tutorialSprite, tutorialMatrix);
+    sprites->flush();
 
     // Display the display buffer to the user
-    glfwSwapBuffers(window->GLFWpointer);
+    window->swapBuffers();
     const float* axisStates;
     // While not moving to another scene
     while(exitFlag == SCENE_TUTORIAL){
@@ -360,7 +397,7 @@ int show_tutorial(Window* window, CircleShader* circleShader,TextureShader* tuto
     return exitFlag;
 }
 
-int show_menu(Window* window, TextureShader * menuMultiTex, std::vector<glm::mat3> menuElementTMat, CircleShader * circleShader, TextureShader* background){
+int show_menu(Window* window, SpriteBatch * sprites, std::vector<int> menuSprites, std::vector<glm::mat3> menuElementTMat, InstancedCircleShader * circleShader, TextureShader* background, AssetLoader* assets){
     int exitFlag = SCENE_MENU;
 
     //get set resources;
@@ -392,12 +429,17 @@ int show_menu(Window* window, TextureShader * menuMultiTex, std::vector<glm::mat
     while(exitFlag == SCENE_MENU){
         // reset buttonhit
         buttonHit = false;
+        // Upload the assets of the other scenes that are done loading
+        if(assets!=NULL){
+            assets->poll();
+        }
         // Do a physics step and draw the universe
         glClear(GL_COLOR_BUFFER_BIT);
         if(background!=NULL){
-            background->draw();
+            window->renderQueue.add(background, LAYER_BACKGROUND);
         }
-        window->drawObjectList(circleShader);
+        window->queueTrails(LAYER_TRAILS);
+        window->queueObjectList(circleShader, LAYER_OBJECTS);
         window->boundUniverse->simulate_one_time_unit(window->fps);
         double newWidthScale = initScreenRatio/(window->windowSize()[0]/window->windowSize()[1]);
 
@@ -458,8 +500,7 @@ int show_menu(Window* window, TextureShader * menuMultiTex, std::vector<glm::mat
         mousedButton = -1;
         for(int ii = 0; ii < menuElementTMat.size(); ii++) {
             // Set position and apply appropriate rescale if window proportions have been altered
-            menuMultiTex->transformationMatrix = menuElementTMat[ii];
-            menuMultiTex->tMatrixScale({newWidthScale,1});
+            glm::mat3 matrix = menuElementTMat[ii] * glm::mat3(newWidthScale, 0, 0, 0, 1, 0, 0, 0, 1);
             // check if cursor is positioned ontop of the menu element and set it to highlighted
             if(cursorPos[0] > menuElementTMat[ii][0][2] - menuElementTMat[ii][0][0] && cursorPos[0] <menuElementTMat[ii][0][2] + menuElementTMat[ii][0][0]){
                 if(cursorPos[1] > menuElementTMat[ii][1][2] - menuElementTMat[ii][1][1] && cursorPos[1] <menuElementTMat[ii][1][2] + menuElementTMat[ii][1][1]){
@@ -471,14 +512,16 @@ int show_menu(Window* window, TextureShader * menuMultiTex, std::vector<glm::mat
             }
             // upscale the highlighted button
             if(highlightedButton > 0 && ii == highlightedButton) {
-                menuMultiTex->transformationMatrix[0][0] *= 1.2;
-                menuMultiTex->transformationMatrix[1][1] *= 1.2;
+                matrix[0][0] *= 1.2;
+                matrix[1][1] *= 1.2;
             }
-            // draw the menu element
-            menuMultiTex->draw(ii);
+            // add the menu element to the batch, all elements are drawn with one draw call
+            sprites->add(menuSprites[ii], matrix);
         };
+        window->renderQueue.add(sprites, LAYER_INTERFACE);
+        window->renderQueue.submit();
         // swap screen buffers and poll events (reset keyHandler)
-        glfwSwapBuffers(window->GLFWpointer);
+        window->swapBuffers();
         keyHandler = {};
         glfwPollEvents();
         // Check if mouse or button is selecting a button and switch to the corresponding scene
@@ -532,6 +575,25 @@ void escape_key_callback(GLFWwindow* window, int key, int scancode, int action,
     if(key == GLFW_KEY_ESCAPE && action == GLFW_PRESS){
         keyHandler.push_back(key);
     }
+    // D switches between circles and the density map
+    if(key == GLFW_KEY_D && action == GLFW_PRESS){
+        static_cast<Window*>(glfwGetWindowUserPointer(window))->toggleVisualMode();
+    }
+    // T switches the trails on and off
+    if(key == GLFW_KEY_T && action == GLFW_PRESS){
+        static_cast<Window*>(glfwGetWindowUserPointer(window))->toggleTrails();
+    }
+    // G shows the GL calls per frame in the window title
+    if(key == GLFW_KEY_G && action == GLFW_PRESS){
+        static_cast<Window*>(glfwGetWindowUserPointer(window))->toggleGLStats();
+    }
+    // F12 takes a screenshot, F9 starts and stops capturing every frame
+    if(key == GLFW_KEY_F12 && action == GLFW_PRESS){
+        static_cast<Window*>(glfwGetWindowUserPointer(window))->screenshot();
+    }
+    if(key == GLFW_KEY_F9 && action == GLFW_PRESS){
+        static_cast<Window*>(glfwGetWindowUserPointer(window))->toggleCapture();
+    }
 }
 // Callback function to push all pressed keys to the keyhandler
 void tutorial_key_callback(GLFWwindow* window, int key, int scancode, int action, int mods){
@@ -540,28 +602,15 @@ void tutorial_key_callback(GLFWwindow* window, int key, int scancode, int action
     }
 }
 
-std::vector<glm::mat3> loadMenuResources(TextureShader* myMultiTex){
+std::vector<glm::mat3> loadMenuResources(const SpriteAtlas &atlas, std::vector<int> &sprites){
     //// Input for menu properties
-    const GLfloat imageSize = 1024;         // input image needs to be 2^n in width and height
     const GLfloat menuMeasHeight = 900;
     const GLfloat menuMeasWidth = 1200;   //The scales used for measuring the objects Origins and sizes
-    GLfloat UVs[] = {       // UV uses the actual file supplied
-            1, 160,       //Menu title
-            1, 160+131,
-            1+1020, 160+131,
-            1+1020, 160,
-            554, 5,     //Button 1
-            554, 5+52,
-            554+183, 5+52,
-            554+183, 5,
-            741, 1,   //Button 2
-            741, 1+71,
-            741+156, 1+71,
-            741+156, 1,
-            900, 1,     //Button 3
-            900, 1+48,
-            900+123, 1+48,
-            900+123, 1
+    const char* spriteNames[] = {   // Sprites of the UI atlas (see Textures/UI.sprites)
+            "title",    //Menu title
+            "about",    //Button 1
+            "play",     //Button 2
+            "quit"      //Button 3
     };
     GLfloat objectOriginCoords[]{ // objectOriginCoords uses the alignment we wish on screen (origin is top left corner)
             68, 183,
@@ -576,30 +625,11 @@ std::vector<glm::mat3> loadMenuResources(TextureShader* myMultiTex){
             123, 48
     };
 
-    //// Make the multi texture and get transformation matrices (so we can solve resizing later)
-    // Create a standard set of UVs for each part of the texture
-    int coords = sizeof(UVs)/sizeof(GLfloat);
-    if(coords%8) std::cerr << "[Warning]: There is a incorrect amount of coordinates supplied in the UVs of the loadMenu" << std::endl;
-    GLfloat vertices[coords];
-    for(int ii = 0; ii<coords; ii++){
-        UVs[ii] /= imageSize;
-        switch (ii%8) {
-            case 0: vertices[ii] = -1; break;
-            case 1: vertices[ii] = 1; break;
-            case 2: vertices[ii] = -1; break;
-            case 3: vertices[ii] = -1; break;
-            case 4: vertices[ii] = 1; break;
-            case 5: vertices[ii] = -1; break;
-            case 6: vertices[ii] = 1; break;
-            case 7: vertices[ii] = 1; break;
-        }
-    }
-    // change the vertices and coordinates of the textureShader
-    myMultiTex->setNewUVCoordinates(coords, &UVs[0], &vertices[0]);
-    // Handle the output interpretation
+    //// Find the sprites and get transformation matrices (so we can solve resizing later)
     const int numBoxes = sizeof(objectOriginCoords)/(sizeof(GLfloat)*2);
-    if(numBoxes != coords/8){
-        std::cerr << "[Warning]: The vertical coordinates do not match the amount of coordinates in UVs. horCoords: "<< numBoxes << " images, UVs: " << coords/(double)8 << " images." << std::endl;
+    sprites.clear();
+    for (int ii = 0; ii< numBoxes; ii++){
+        sprites.push_back(atlas.find(spriteNames[ii]));
     }
     // Normalize the object sizes and positions and create a matrix out of it.
     std::vector<glm::mat3> outputTMatrices;
@@ -22,6 +22,12 @@ const int SCENE_INGAME = 12;
 const int SCENE_PAUSE = 13;
 const int SCENE_DIED = 14;
 
+// Render queue layers, higher layers are drawn on top
+const unsigned LAYER_BACKGROUND = 0;
+const unsigned LAYER_TRAILS = 1;
+const unsigned LAYER_OBJECTS = 2;
+const unsigned LAYER_INTERFACE = 3;
+
 // Menu measured screen ratio
 double initScreenRatio = 1200/900;
 
@@ -29,13 +35,13 @@ double initScreenRatio = 1200/900;
 void maingame(int startScene = SCENE_MENU);
 
 // Scene functions
-int show_menu(Window* window, TextureShader * menuMultiTex, std::vector<glm::mat3> menuElementTMat, CircleShader * circleShader = NULL,TextureShader* background=NULL);
+int show_menu(Window* window, SpriteBatch * sprites, std::vector<int> menuSprites, std::vector<glm::mat3> menuElementTMat, InstancedCircleShader * circleShader = NULL,TextureShader* background=NULL, AssetLoader* assets=NULL);
 int show_about(Window* window, TextShader* newText);
-int show_tutorial(Window* window, CircleShader* circleShader,TextureShader* tutorialTex, vec2d tutorialSize, TextureShader* background=NULL);
-int show_ingame(Window* window, CircleShader* circleShader = NULL, TextShader* textShader =NULL, TextureShader* background =NULL);
+int show_tutorial(Window* window, InstancedCircleShader* circleShader,SpriteBatch* sprites, int tutorialSprite, vec2d tutorialSize, TextureShader* background=NULL);
+int show_ingame(Window* window, InstancedCircleShader* circleShader = NULL, TextShader* textShader =NULL, TextureShader* background =NULL);
 
 // Load menu resources
-std::vector<glm::mat3> loadMenuResources(TextureShader * myMultiTex);
+std::vector<glm::mat3> loadMenuResources(const SpriteAtlas &atlas, std::vector<int> &sprites);
 
 // Key callback functions
 void tutorial_key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
@@ -0,0 +1,132 @@
+//
+// Read-only memory mapping of a file, used to read large data files without copying them.
+//
+
+#include "mapped_file.h"
+
+#include <iostream>
+#include <cstdio>
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#else
+    #ifndef NOMINMAX
+        #define NOMINMAX            // Keep std::min and std::max usable in the rest of the build
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    #undef near                     // Empty legacy macros, they would remove variables of these names
+    #undef far
+#endif
+
+MappedFile::MappedFile() {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+/*
+ * open()
+ *
+ * Map the whole file read-only. Empty files are valid, they have data() == NULL and size() == 0.
+ * POSIX systems use mmap, Windows a file mapping object with a view of the whole file.
+ */
+bool MappedFile::open(std::string path) {
+    close();
+
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "[WARN] Could not open " << path << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        std::cerr << "[WARN] Could not get the size of " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    _size = info.st_size;
+
+    if (_size > 0) {
+        void* address = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            std::cerr << "[WARN] Could not map " << path << " into memory" << std::endl;
+            ::close(fd);
+            _size = 0;
+            return false;
+        }
+        _data = (const char*)address;
+        _mapped = true;
+    }
+
+    // The mapping stays valid after closing the file descriptor
+    ::close(fd);
+    _open = true;
+    return true;
+#else
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "[WARN] Could not open " << path << std::endl;
+        return false;
+    }
+
+    LARGE_INTEGER info;
+    if (!GetFileSizeEx(file, &info) || (unsigned long long)info.QuadPart > (size_t)-1) {
+        std::cerr << "[WARN] Could not get the size of " << path << " or it does not fit in memory" << std::endl;
+        CloseHandle(file);
+        return false;
+    }
+    _size = (size_t)info.QuadPart;
+
+    if (_size > 0) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        void* address = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (mapping != NULL) {
+            CloseHandle(mapping);   // The view keeps the mapping alive
+        }
+        if (address == NULL) {
+            std::cerr << "[WARN] Could not map " << path << " into memory" << std::endl;
+            CloseHandle(file);
+            _size = 0;
+            return false;
+        }
+        _data = (const char*)address;
+        _mapped = true;
+    }
+
+    // The view stays valid after closing the file handle
+    CloseHandle(file);
+    _open = true;
+    return true;
+#endif
+}
+
+void MappedFile::close() {
+    if (_data != NULL && _mapped) {
+#ifndef _WIN32
+        munmap((void*)_data, _size);
+#else
+        UnmapViewOfFile(_data);
+#endif
+    }
+    _data = NULL;
+    _size = 0;
+    _mapped = false;
+    _open = false;
+}
+
+void MappedFile::advise_sequential() {
+#ifndef _WIN32
+    if (_mapped) {
+        madvise((void*)_data, _size, MADV_SEQUENTIAL);
+    }
+#endif
+}
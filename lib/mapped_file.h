@@ -0,0 +1,42 @@
+//
+// Read-only memory mapping of a file, used to read large data files without copying them.
+//
+
+#ifndef PIE_GITHUB_MAPPED_FILE_H
+#define PIE_GITHUB_MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+// A file mapped into memory. The pages are loaded by the OS when they are touched, so opening a
+// multi-GB file is instant and only the parts that are read cost anything.
+class MappedFile{
+private:
+    const char* _data = NULL;
+    size_t _size = 0;
+    bool _mapped = false;   // False for empty files, which have nothing to map
+    bool _open = false;
+
+    // Not copyable, the mapping has a single owner
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Map the file, returns false (with a warning) when it could not be opened
+    bool open(std::string path);
+    void close();
+
+    // Hint that the file will be read from start to end (more read-ahead)
+    void advise_sequential();
+
+    bool is_open() const { return _open; }
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+};
+
+#include "mapped_file.cpp"
+
+#endif //PIE_GITHUB_MAPPED_FILE_H
@@ -0,0 +1,317 @@
+//
+// Counters, gauges and histograms of the simulation, with a file sink for monitoring.
+//
+
+#include "metrics.h"
+
+/*
+ * Histogram constructor
+ *
+ * The bounds are the (sorted) upper bounds of the buckets, an extra +Inf bucket is always added.
+ */
+Histogram::Histogram(std::vector<double> bounds) : _bounds(bounds), _count(0), _sum(0), bounds(_bounds) {
+    std::sort(_bounds.begin(), _bounds.end());
+
+    _buckets = new std::atomic<unsigned long long>[_bounds.size() + 1];
+    for (int ii = 0; ii < _bounds.size() + 1; ++ii) {
+        _buckets[ii].store(0, std::memory_order_relaxed);
+    }
+}
+
+Histogram::~Histogram() {
+    delete[] _buckets;
+}
+
+/*
+ * observe()
+ *
+ * Add a value to the histogram. The amount of buckets is small, so a linear search is faster
+ * than a binary search here.
+ */
+void Histogram::observe(double value) {
+    unsigned bucket = 0;
+    while (bucket < _bounds.size() && value > _bounds[bucket]) {
+        ++bucket;
+    }
+    _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+
+    // There is no atomic add for doubles in C++11, only the flushing thread competes for it
+    double sum = _sum.load(std::memory_order_relaxed);
+    while (!_sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+}
+
+unsigned long long Histogram::bucket_count(unsigned bucket) const {
+    if (bucket > _bounds.size()) {
+        return 0;
+    }
+    return _buckets[bucket].load(std::memory_order_relaxed);
+}
+
+MetricsRegistry::MetricsRegistry() {
+    _created = std::chrono::steady_clock::now();
+}
+
+/*
+ * MetricsRegistry destructor
+ *
+ * Stop the flushing thread first, it might still be reading the metrics.
+ */
+MetricsRegistry::~MetricsRegistry() {
+    stop_flushing();
+
+    for (std::map<std::string, Counter*>::iterator it = _counters.begin(); it != _counters.end(); ++it) {
+        delete it->second;
+    }
+    for (std::map<std::string, Gauge*>::iterator it = _gauges.begin(); it != _gauges.end(); ++it) {
+        delete it->second;
+    }
+    for (std::map<std::string, Histogram*>::iterator it = _histograms.begin(); it != _histograms.end(); ++it) {
+        delete it->second;
+    }
+}
+
+/*
+ * counter(), gauge() and histogram()
+ *
+ * Return the metric with the given name, or register a new one. Registering the same name as a
+ * different type is not possible, in that case NULL is returned.
+ */
+Counter* MetricsRegistry::counter(std::string name, std::string help) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_counters.count(name)) {
+        return _counters[name];
+    }
+    if (_gauges.count(name) || _histograms.count(name)) {
+        std::cerr << "[WARN] Metric " << name << " is already registered with a different type" << std::endl;
+        return NULL;
+    }
+    _help[name] = help;
+    return _counters[name] = new Counter;
+}
+
+Gauge* MetricsRegistry::gauge(std::string name, std::string help) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_gauges.count(name)) {
+        return _gauges[name];
+    }
+    if (_counters.count(name) || _histograms.count(name)) {
+        std::cerr << "[WARN] Metric " << name << " is already registered with a different type" << std::endl;
+        return NULL;
+    }
+    _help[name] = help;
+    return _gauges[name] = new Gauge;
+}
+
+Histogram* MetricsRegistry::histogram(std::string name, std::vector<double> bounds, std::string help) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_histograms.count(name)) {
+        return _histograms[name];
+    }
+    if (_counters.count(name) || _gauges.count(name)) {
+        std::cerr << "[WARN] Metric " << name << " is already registered with a different type" << std::endl;
+        return NULL;
+    }
+    _help[name] = help;
+    return _histograms[name] = new Histogram(bounds);
+}
+
+/*
+ * to_json_line()
+ *
+ * Export all metrics as a single line JSON object. Histograms are exported as an object with the
+ * count, sum, bucket bounds and the (non-cumulative) counts per bucket.
+ */
+std::string MetricsRegistry::to_json_line() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::ostringstream out;
+    out.precision(10);
+
+    // Non-finite numbers do not exist in JSON
+    auto number = [&out](double value) {
+        if (std::isfinite(value)) {
+            out << value;
+        } else {
+            out << "null";
+        }
+    };
+
+    out << "{\"timestamp\":" << std::time(NULL);
+    out << ",\"uptime\":";
+    number(std::chrono::duration<double>(std::chrono::steady_clock::now() - _created).count());
+
+    for (std::map<std::string, Counter*>::iterator it = _counters.begin(); it != _counters.end(); ++it) {
+        out << ",\"" << it->first << "\":" << it->second->value();
+    }
+    for (std::map<std::string, Gauge*>::iterator it = _gauges.begin(); it != _gauges.end(); ++it) {
+        out << ",\"" << it->first << "\":";
+        number(it->second->value());
+    }
+    for (std::map<std::string, Histogram*>::iterator it = _histograms.begin(); it != _histograms.end(); ++it) {
+        Histogram* h = it->second;
+        out << ",\"" << it->first << "\":{\"count\":" << h->count() << ",\"sum\":";
+        number(h->sum());
+        out << ",\"bounds\":[";
+        for (int ii = 0; ii < h->bounds.size(); ++ii) {
+            out << (ii ? "," : "");
+            number(h->bounds[ii]);
+        }
+        out << "],\"buckets\":[";
+        for (int ii = 0; ii <= h->bounds.size(); ++ii) {
+            out << (ii ? "," : "") << h->bucket_count(ii);
+        }
+        out << "]}";
+    }
+    out << "}\n";
+
+    return out.str();
+}
+
+/*
+ * to_prometheus()
+ *
+ * Export all metrics in the Prometheus text format (version 0.0.4), as read by for instance the
+ * textfile collector of the node exporter.
+ */
+std::string MetricsRegistry::to_prometheus() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::ostringstream out;
+    out.precision(10);
+
+    for (std::map<std::string, Counter*>::iterator it = _counters.begin(); it != _counters.end(); ++it) {
+        if (_help[it->first].size()) out << "# HELP " << it->first << " " << _help[it->first] << "\n";
+        out << "# TYPE " << it->first << " counter\n";
+        out << it->first << " " << it->second->value() << "\n";
+    }
+    for (std::map<std::string, Gauge*>::iterator it = _gauges.begin(); it != _gauges.end(); ++it) {
+        if (_help[it->first].size()) out << "# HELP " << it->first << " " << _help[it->first] << "\n";
+        out << "# TYPE " << it->first << " gauge\n";
+        out << it->first << " " << it->second->value() << "\n";
+    }
+    for (std::map<std::string, Histogram*>::iterator it = _histograms.begin(); it != _histograms.end(); ++it) {
+        Histogram* h = it->second;
+        if (_help[it->first].size()) out << "# HELP " << it->first << " " << _help[it->first] << "\n";
+        out << "# TYPE " << it->first << " histogram\n";
+
+        // Prometheus buckets are cumulative
+        unsigned long long cumulative = 0;
+        for (int ii = 0; ii < h->bounds.size(); ++ii) {
+            cumulative += h->bucket_count(ii);
+            out << it->first << "_bucket{le=\"" << h->bounds[ii] << "\"} " << cumulative << "\n";
+        }
+        cumulative += h->bucket_count(h->bounds.size());
+        out << it->first << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+        out << it->first << "_sum " << h->sum() << "\n";
+        out << it->first << "_count " << cumulative << "\n";
+    }
+
+    return out.str();
+}
+
+/*
+ * write()
+ *
+ * Write the metrics to a file. JSON lines are appended to the file, the Prometheus format replaces
+ * the file. That is done through a temporary file and a rename, so a scraper never reads a half
+ * written file.
+ */
+bool MetricsRegistry::write(std::string path, unsigned format) {
+    if (format == metrics::JSON_LINES) {
+        std::ofstream file(path.c_str(), std::ios::app);
+        if (!file.is_open()) {
+            std::cerr << "[WARN] Could not open metrics file " << path << std::endl;
+            return false;
+        }
+        file << to_json_line();
+        return file.good();
+    }
+
+    if (format == metrics::PROMETHEUS) {
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary.c_str(), std::ios::trunc);
+            if (!file.is_open()) {
+                std::cerr << "[WARN] Could not open metrics file " << temporary << std::endl;
+                return false;
+            }
+            file << to_prometheus();
+            if (!file.good()) {
+                return false;
+            }
+        }
+#ifdef _WIN32
+        // rename does not replace an existing file on Windows
+        std::remove(path.c_str());
+#endif
+        return std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    std::cerr << "[WARN] Unknown metrics format " << format << std::endl;
+    return false;
+}
+
+/*
+ * start_flushing()
+ *
+ * Start a background thread that writes the metrics every interval seconds. The metrics are written
+ * a final time when flushing is stopped, so short runs also leave a result.
+ */
+void MetricsRegistry::start_flushing(std::string path, unsigned format, double interval) {
+    stop_flushing();
+
+    _flushing = true;
+    _flusher = std::thread([this, path, format, interval]() {
+        std::unique_lock<std::mutex> lock(_flushMutex);
+        while (_flushing) {
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+                    + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval));
+            _flushWake.wait_until(lock, deadline, [this]() { return !_flushing; });
+            // Do not hold the lock while writing, stop_flushing() should not have to wait for the disk
+            lock.unlock();
+            write(path, format);
+            lock.lock();
+        }
+    });
+}
+
+void MetricsRegistry::stop_flushing() {
+    {
+        std::lock_guard<std::mutex> lock(_flushMutex);
+        if (!_flushing) {
+            return;
+        }
+        _flushing = false;
+    }
+    _flushWake.notify_all();
+    _flusher.join();
+}
+
+/*
+ * SimulationMetrics constructor
+ *
+ * Register all metrics of the physics engine. The histogram buckets for the phase times range from
+ * 10 microseconds to 1 second.
+ */
+SimulationMetrics::SimulationMetrics(MetricsRegistry &registry) {
+    std::vector<double> phaseBuckets = {1e-5, 3e-5, 1e-4, 3e-4, 1e-3, 3e-3, 1e-2, 3e-2, 1e-1, 3e-1, 1};
+
+    steps       = registry.counter("pie_steps_total", "Physics iterations done");
+    time_units  = registry.counter("pie_time_units_total", "Time units (frames) simulated");
+    pair_tests  = registry.counter("pie_pair_tests_total", "Object pairs tested for a collision");
+    contacts    = registry.counter("pie_contacts_resolved_total", "Object collisions resolved");
+    wall_hits   = registry.counter("pie_wall_hits_total", "Wall collisions resolved");
+
+    objects             = registry.gauge("pie_objects", "Objects in the universe");
+    steps_per_second    = registry.gauge("pie_steps_per_second", "Physics iterations per second of wall time");
+    kinetic_energy      = registry.gauge("pie_kinetic_energy", "Total kinetic energy of all objects");
+    potential_energy    = registry.gauge("pie_potential_energy", "Total gravitational energy of all object pairs");
+    momentum_x          = registry.gauge("pie_momentum_x", "Total momentum of all objects, x component");
+    momentum_y          = registry.gauge("pie_momentum_y", "Total momentum of all objects, y component");
+
+    integrate_time  = registry.histogram("pie_integrate_seconds", phaseBuckets, "Time per physics iteration spent on integrating");
+    collide_time    = registry.histogram("pie_collide_seconds", phaseBuckets, "Time per physics iteration spent on collisions");
+
+    last_sample = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,142 @@
+//
+// Counters, gauges and histograms of the simulation, with a file sink for monitoring.
+//
+
+#ifndef PIE_GITHUB_FRAMEWORK_H
+
+#include "framework.h"
+
+#endif
+
+#ifndef PIE_GITHUB_METRICS_H
+#define PIE_GITHUB_METRICS_H
+
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <condition_variable>
+
+// Output formats of the metrics file sink
+namespace metrics{
+    const unsigned JSON_LINES = 0;  // Append one JSON object per flush to the file
+    const unsigned PROMETHEUS = 1;  // Rewrite the file in Prometheus text format on every flush
+}
+
+/*
+ * All metric types are written to from the simulation thread and read from the flushing thread. The
+ * updates use relaxed atomics, so an increment costs about the same as a normal addition. A flush
+ * does not give a consistent snapshot across metrics, which is fine for monitoring.
+ */
+
+// Monotonically increasing value, e.g. amount of physics steps done
+class Counter{
+private:
+    std::atomic<unsigned long long> _value;
+public:
+    Counter() : _value(0) {}
+    void add(unsigned long long n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+    unsigned long long value() const { return _value.load(std::memory_order_relaxed); }
+};
+
+// A value that can go up and down, e.g. energy of the universe
+class Gauge{
+private:
+    std::atomic<double> _value;
+public:
+    Gauge() : _value(0) {}
+    void set(double value) { _value.store(value, std::memory_order_relaxed); }
+    double value() const { return _value.load(std::memory_order_relaxed); }
+};
+
+// Distribution of observed values over fixed buckets, e.g. time spent per physics phase [s]
+class Histogram{
+private:
+    std::vector<double> _bounds;                    // Upper bounds of the buckets (without the +Inf bucket)
+    std::atomic<unsigned long long>* _buckets;      // Amount of observations per bucket (not cumulative)
+    std::atomic<unsigned long long> _count;
+    std::atomic<double> _sum;
+public:
+    Histogram(std::vector<double> bounds);
+    ~Histogram();
+
+    void observe(double value);
+
+    const std::vector<double> &bounds;
+    unsigned long long bucket_count(unsigned bucket) const;    // bucket == bounds.size() is the +Inf bucket
+    unsigned long long count() const { return _count.load(std::memory_order_relaxed); }
+    double sum() const { return _sum.load(std::memory_order_relaxed); }
+};
+
+// Storage of all metrics with their names, and a file sink that periodically writes them
+class MetricsRegistry{
+private:
+    // Registered metrics, stored by name so that the output is sorted
+    std::map<std::string, Counter*> _counters;
+    std::map<std::string, Gauge*> _gauges;
+    std::map<std::string, Histogram*> _histograms;
+    std::map<std::string, std::string> _help;
+
+    // Guards the maps above against registration while exporting
+    std::mutex _mutex;
+
+    // Background flushing of the metrics
+    std::thread _flusher;
+    std::mutex _flushMutex;
+    std::condition_variable _flushWake;
+    bool _flushing = false;
+
+    std::chrono::steady_clock::time_point _created;
+
+public:
+    MetricsRegistry();
+    ~MetricsRegistry();
+
+    // Get a metric by name, it is created when it does not exist yet. The returned pointer stays valid
+    // for the lifetime of the registry, so hot code should keep it instead of looking it up again.
+    Counter* counter(std::string name, std::string help = "");
+    Gauge* gauge(std::string name, std::string help = "");
+    Histogram* histogram(std::string name, std::vector<double> bounds, std::string help = "");
+
+    // Export all metrics in one of the formats
+    std::string to_json_line();
+    std::string to_prometheus();
+
+    // Write the metrics to a file in the format given by a metrics:: constant
+    bool write(std::string path, unsigned format);
+
+    // Write the metrics every interval seconds from a background thread, until stop_flushing() is called
+    void start_flushing(std::string path, unsigned format, double interval);
+    void stop_flushing();
+};
+
+// Handles to the metrics the physics engine reports, bind one to Universe::metrics to enable them
+struct SimulationMetrics{
+    SimulationMetrics(MetricsRegistry &registry);
+
+    Counter* steps;             // Physics iterations done
+    Counter* time_units;        // Calls to simulate_one_time_unit
+    Counter* pair_tests;        // Object pairs tested for a collision
+    Counter* contacts;          // Object collisions resolved
+    Counter* wall_hits;         // Wall collisions resolved
+
+    Gauge* objects;             // Amount of objects in the universe
+    Gauge* steps_per_second;    // Physics iterations per second of wall time since the last sample
+    Gauge* kinetic_energy;      // Total kinetic energy of all objects
+    Gauge* potential_energy;    // Total gravitational energy of all object pairs
+    Gauge* momentum_x;          // Total momentum of all objects
+    Gauge* momentum_y;
+
+    Histogram* integrate_time;  // Time spent calculating new positions and velocities [s]
+    Histogram* collide_time;    // Time spent on object and wall collisions [s]
+
+    // Energy and momentum are sampled (from simulate_one_time_unit) at most once per this many seconds,
+    // because the potential energy costs as much as a physics iteration
+    double sample_interval = 1.0;
+    std::chrono::steady_clock::time_point last_sample;
+    unsigned long long last_sample_steps = 0;
+};
+
+#include "metrics.cpp"
+
+#endif //PIE_GITHUB_METRICS_H
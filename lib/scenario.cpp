@@ -0,0 +1,266 @@
+//
+// Scenario files: initial conditions of a universe, in a binary and a text form.
+//
+
+#include "scenario.h"
+
+#include <cstdio>
+
+/*
+ * load()
+ *
+ * Map the file and hand it to the loader of its format. Binary files start with the magic string,
+ * everything else is read as text.
+ */
+bool Scenario::load(std::string path, Universe &universe) {
+    MappedFile file;
+    if (!file.open(path)) {
+        return false;
+    }
+    file.advise_sequential();
+
+    if (file.size() >= sizeof(ScenarioHeader) && std::memcmp(file.data(), "PIESCEN", 8) == 0) {
+        return load_binary(file, universe, path);
+    }
+    return load_text(file, universe, path);
+}
+
+/*
+ * load_binary()
+ *
+ * Check the header and all values first, so an invalid file leaves the universe as it was, then
+ * copy the columns into one block of objects.
+ */
+bool Scenario::load_binary(const MappedFile &file, Universe &universe, std::string path) {
+    ScenarioHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.version != 1 || header.header_size < sizeof(ScenarioHeader) || header.header_size % sizeof(double) != 0) {
+        std::cerr << "[WARN] Unsupported scenario file version " << header.version << " in " << path << std::endl;
+        return false;
+    }
+    if (header.header_size > file.size()) {
+        std::cerr << "[WARN] Scenario file " << path << " is shorter than its header" << std::endl;
+        return false;
+    }
+    size_t n = header.object_count;
+    if (header.object_count > (file.size() - header.header_size) / (COLUMNS * sizeof(double))) {
+        std::cerr << "[WARN] Scenario file " << path << " is too short for " << header.object_count << " objects" << std::endl;
+        return false;
+    }
+    if (!(header.width > 0 && header.height > 0 && header.timestep > 0)) {
+        std::cerr << "[WARN] Invalid universe size or timestep in " << path << std::endl;
+        return false;
+    }
+
+    // The mapping is page aligned and the header size a multiple of 8, so the columns can be used in place
+    const double* columns = (const double*)(file.data() + header.header_size);
+    const double* x = columns;
+    const double* y = columns + n;
+    const double* vx = columns + 2 * n;
+    const double* vy = columns + 3 * n;
+    const double* mass = columns + 4 * n;
+    const double* radius = columns + 5 * n;
+    const double* bounciness = columns + 6 * n;
+    const double* colour = columns + 7 * n;
+
+    for (size_t ii = 0; ii < n; ++ii) {
+        if (!(mass[ii] > 0 && radius[ii] > 0 && bounciness[ii] > 0 && bounciness[ii] <= 1)) {
+            std::cerr << "[WARN] Invalid mass, radius or bounciness of object " << ii << " in " << path << std::endl;
+            return false;
+        }
+    }
+
+    universe.resize(header.width, header.height);
+    universe.physics.G = header.G;
+    universe.physics.timestep = header.timestep;
+
+    Object* block = universe.add_objects(n);
+    for (size_t ii = 0; ii < n; ++ii) {
+        Object &obj = block[ii];
+        obj._position[0] = x[ii];
+        obj._position[1] = y[ii];
+        obj._velocity[0] = vx[ii];
+        obj._velocity[1] = vy[ii];
+        obj._mass = mass[ii];
+        obj._radius = radius[ii];
+        obj._bounciness = bounciness[ii];
+        for (int cc = 0; cc < 4; ++cc) {
+            obj._colour[cc] = std::min(1.0, std::max(0.0, colour[cc * n + ii]));
+        }
+    }
+
+    return true;
+}
+
+/*
+ * load_text()
+ *
+ * Parse the statements into columns first, so an invalid file leaves the universe as it was. Numbers
+ * are read with strtod on the whole text instead of stream extraction, which is several times faster.
+ */
+bool Scenario::load_text(const MappedFile &file, Universe &universe, std::string path) {
+    // A copy with a trailing zero, so strtod always stops
+    std::string text(file.data(), file.size());
+
+    double width = universe.width;
+    double height = universe.height;
+    double G = universe.physics.G;
+    double timestep = universe.physics.timestep;
+    std::vector<double> columns[COLUMNS];
+
+    const char* cursor = text.c_str();
+    unsigned line = 0;
+    while (*cursor) {
+        ++line;
+        const char* lineEnd = std::strchr(cursor, '\n');
+        if (lineEnd == NULL) {
+            lineEnd = cursor + std::strlen(cursor);
+        }
+
+        // Keyword, followed by numbers up to the end of the line or a comment
+        while (cursor < lineEnd && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) ++cursor;
+        const char* keyword = cursor;
+        while (cursor < lineEnd && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '#') ++cursor;
+        std::string name(keyword, cursor);
+
+        double values[COLUMNS];
+        unsigned count = 0;
+        bool valid = true;
+        while (cursor < lineEnd) {
+            while (cursor < lineEnd && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) ++cursor;
+            if (cursor >= lineEnd || *cursor == '#') {
+                break;
+            }
+            char* end;
+            double value = std::strtod(cursor, &end);
+            if (end == cursor || end > lineEnd || count == COLUMNS) {
+                valid = false;
+                break;
+            }
+            values[count++] = value;
+            cursor = end;
+        }
+        cursor = *lineEnd ? lineEnd + 1 : lineEnd;
+
+        if (name.empty()) {
+            continue;
+        }
+        if (valid && name == "object" && count >= 7 && count != 8 && count != 9) {
+            if (!(values[4] > 0 && values[5] > 0 && values[6] > 0 && values[6] <= 1)) {
+                std::cerr << "[WARN] Invalid mass, radius or bounciness on line " << line << " of " << path << std::endl;
+                return false;
+            }
+            // Objects without a colour get a random one, like new objects do
+            if (count == 7) {
+                for (int cc = 0; cc < 3; ++cc) values[7 + cc] = (double)std::rand() / RAND_MAX;
+            }
+            if (count < COLUMNS) {
+                values[10] = 1.0;
+            }
+            for (unsigned cc = 0; cc < COLUMNS; ++cc) {
+                columns[cc].push_back(values[cc]);
+            }
+        } else if (valid && name == "universe" && count == 2 && values[0] > 0 && values[1] > 0) {
+            width = values[0];
+            height = values[1];
+        } else if (valid && name == "G" && count == 1) {
+            G = values[0];
+        } else if (valid && name == "timestep" && count == 1 && values[0] > 0) {
+            timestep = values[0];
+        } else if (valid && name == "objects" && count == 1 && values[0] >= 0) {
+            for (unsigned cc = 0; cc < COLUMNS; ++cc) {
+                columns[cc].reserve((size_t)values[0]);
+            }
+        } else {
+            std::cerr << "[WARN] Could not read line " << line << " of scenario " << path << std::endl;
+            return false;
+        }
+    }
+
+    universe.resize(width, height);
+    universe.physics.G = G;
+    universe.physics.timestep = timestep;
+
+    size_t n = columns[0].size();
+    Object* block = universe.add_objects(n);
+    for (size_t ii = 0; ii < n; ++ii) {
+        Object &obj = block[ii];
+        obj._position[0] = columns[0][ii];
+        obj._position[1] = columns[1][ii];
+        obj._velocity[0] = columns[2][ii];
+        obj._velocity[1] = columns[3][ii];
+        obj._mass = columns[4][ii];
+        obj._radius = columns[5][ii];
+        obj._bounciness = columns[6][ii];
+        for (int cc = 0; cc < 4; ++cc) {
+            obj._colour[cc] = std::min(1.0, std::max(0.0, columns[7 + cc][ii]));
+        }
+    }
+
+    return true;
+}
+
+/*
+ * save()
+ *
+ * Write all objects of the universe. Subclasses like Player are stored as plain objects.
+ */
+bool Scenario::save(std::string path, Universe &universe, unsigned format) {
+    FILE* file = std::fopen(path.c_str(), format == scenario::TEXT ? "w" : "wb");
+    if (file == NULL) {
+        std::cerr << "[WARN] Could not open scenario file " << path << std::endl;
+        return false;
+    }
+
+    size_t n = universe.objects.size();
+    bool ok = true;
+
+    if (format == scenario::TEXT) {
+        ok = std::fprintf(file, "# Space Debris Evaders scenario\nuniverse %.17g %.17g\nG %.17g\ntimestep %.17g\nobjects %lu\n",
+                          universe.width, universe.height, universe.physics.G, universe.physics.timestep, (unsigned long)n) > 0;
+        ok = ok && std::fprintf(file, "# object x y vx vy mass radius bounciness red green blue alpha\n") > 0;
+        for (size_t ii = 0; ii < n && ok; ++ii) {
+            Object* obj = universe.objects[ii];
+            ok = std::fprintf(file, "object %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.9g %.9g %.9g %.9g\n",
+                              obj->position[0], obj->position[1], obj->velocity[0], obj->velocity[1], obj->mass,
+                              obj->radius, obj->bounciness, obj->colour[0], obj->colour[1], obj->colour[2], obj->colour[3]) > 0;
+        }
+    } else {
+        ScenarioHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "PIESCEN", 8);
+        header.version = 1;
+        header.header_size = sizeof(ScenarioHeader);
+        header.object_count = n;
+        header.width = universe.width;
+        header.height = universe.height;
+        header.G = universe.physics.G;
+        header.timestep = universe.physics.timestep;
+        ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+        // Gather one column at a time
+        std::vector<double> column(n);
+        for (unsigned cc = 0; cc < COLUMNS && ok; ++cc) {
+            for (size_t ii = 0; ii < n; ++ii) {
+                Object* obj = universe.objects[ii];
+                switch (cc) {
+                    case 0: column[ii] = obj->position[0]; break;
+                    case 1: column[ii] = obj->position[1]; break;
+                    case 2: column[ii] = obj->velocity[0]; break;
+                    case 3: column[ii] = obj->velocity[1]; break;
+                    case 4: column[ii] = obj->mass; break;
+                    case 5: column[ii] = obj->radius; break;
+                    case 6: column[ii] = obj->bounciness; break;
+                    default: column[ii] = obj->colour[cc - 7]; break;
+                }
+            }
+            ok = n == 0 || std::fwrite(&column[0], sizeof(double), n, file) == n;
+        }
+    }
+
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok) {
+        std::cerr << "[WARN] Could not write scenario file " << path << std::endl;
+    }
+    return ok;
+}
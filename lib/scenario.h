@@ -0,0 +1,74 @@
+//
+// Scenario files: initial conditions of a universe, in a binary and a text form.
+//
+
+#ifndef PIE_GITHUB_FRAMEWORK_H
+
+#include "framework.h"
+
+#endif
+
+#ifndef PIE_GITHUB_SCENARIO_H
+#define PIE_GITHUB_SCENARIO_H
+
+#include <cstdint>
+#include <cstring>
+
+#include "mapped_file.h"
+
+// Scenario file formats
+namespace scenario{
+    const unsigned BINARY = 0;
+    const unsigned TEXT = 1;
+}
+
+/*
+ * Binary layout (all values little endian):
+ *
+ *   ScenarioHeader
+ *   columns x, y, vx, vy, mass, radius, bounciness, red, green, blue, alpha
+ *
+ * Each column holds object_count doubles, so loading is a straight copy per property.
+ *
+ * Text layout, one statement per line, everything after a # is a comment:
+ *
+ *   universe <width> <height>
+ *   G <value>
+ *   timestep <value>
+ *   objects <amount>                  (optional, reserves memory)
+ *   object <x> <y> <vx> <vy> <mass> <radius> <bounciness> [<red> <green> <blue> [<alpha>]]
+ */
+struct ScenarioHeader{
+    char magic[8];          // "PIESCEN" with a trailing zero
+    uint32_t version;
+    uint32_t header_size;   // sizeof(ScenarioHeader), offset of the first column
+    uint64_t object_count;
+    double width;           // Universe dimensions
+    double height;
+    double G;               // Physics constants
+    double timestep;
+};
+
+// Loads and saves scenarios. Loading creates the objects with Universe::add_objects() and fills
+// them directly, so a million objects cost one allocation instead of a million.
+class Scenario {
+private:
+    static bool load_binary(const MappedFile &file, Universe &universe, std::string path);
+    static bool load_text(const MappedFile &file, Universe &universe, std::string path);
+
+public:
+    // Number of double columns in a binary scenario
+    static const unsigned COLUMNS = 11;
+
+    // Set the size and physics of the universe and add the objects of a scenario file. The format
+    // is detected from the file. Returns false (with a warning) if the file is invalid, in that
+    // case the universe is not changed.
+    static bool load(std::string path, Universe &universe);
+
+    // Write the current state of the universe to a scenario file in a scenario:: format
+    static bool save(std::string path, Universe &universe, unsigned format = scenario::BINARY);
+};
+
+#include "scenario.cpp"
+
+#endif //PIE_GITHUB_SCENARIO_H
@@ -38,6 +38,9 @@ private:
     // Colour vector of this object {red, green, blue, alpha}. All values are between 1 and 0
     std::array<double, 4> _colour = {{(double)std::rand()/RAND_MAX,(double)std::rand()/RAND_MAX,(double)std::rand()/RAND_MAX,1.0}};
 
+    // Scenario files fill the properties of many objects directly (see scenario.h)
+    friend class Scenario;
+
 
 public:
     // Constructor
@@ -122,6 +125,13 @@ private:
     // Score of the game, as defined as physics time steps survived
     long unsigned _score = 0;
 
+    // Blocks of objects created by add_objects(), these are deleted as a whole by the destructor
+    std::vector<Object*> _blocks;
+    std::vector<size_t> _blockSizes;
+
+    // Check if an object is part of one of the blocks
+    bool in_block (Object* obj);
+
 
 public:
     // Constructor functions
@@ -146,6 +156,9 @@ public:
     void add_object (Object* obj);
     Object* add_object ();
 
+    // Add amount objects that are allocated together in one block, returns the first of them
+    Object* add_objects (size_t amount);
+
     // Remove objects, either by pointer or index
     void remove_object_by_index(int obj_index);
     void remove_object (Object* obj);
@@ -160,6 +173,12 @@ public:
     void physics_runtime_iteration ();
     void simulate_one_time_unit (double fps);
 
+    // Metrics reported by the physics engine, NULL to disable them (see metrics.h)
+    SimulationMetrics* metrics = NULL;
+
+    // Update the energy, momentum and speed gauges of the bound metrics
+    void sample_metrics ();
+
 };
 
 class Player : public Object {
@@ -0,0 +1,872 @@
+//
+// Binary trajectory output of the simulation, written by a background thread.
+//
+
+#include "trajectory.h"
+
+TrajectoryWriter::TrajectoryWriter() {
+    std::memset(&_header, 0, sizeof(_header));
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+    close();
+}
+
+bool TrajectoryWriter::is_open() {
+    return _file != NULL;
+}
+
+unsigned long long TrajectoryWriter::frames() {
+    return _frames;
+}
+
+void TrajectoryWriter::set_encoding(uint32_t encoding, double quantisation, unsigned keyframe_every) {
+    if (encoding != trajectory::RAW && encoding != trajectory::DELTA) {
+        std::cerr << "[WARN] Invalid trajectory encoding " << encoding << ", using raw frames" << std::endl;
+        encoding = trajectory::RAW;
+    }
+    _encoding = encoding;
+    _quantisation = quantisation > 0 ? quantisation : 1e-5;
+    _keyframeEvery = std::max(1u, keyframe_every);
+}
+
+/*
+ * open()
+ *
+ * Create the file, write the header and start the writer thread. The amount of buffered frames is
+ * chosen such that roughly 64 MB can wait for the disk. DELTA encoded files keep doubles in the frame
+ * buffers, they are only quantised by the writer thread.
+ */
+bool TrajectoryWriter::open(std::string path, Universe &universe, uint32_t fields, uint32_t precision, unsigned record_every) {
+    close();
+
+    if (precision != trajectory::FLOAT32 && precision != trajectory::FLOAT64) {
+        std::cerr << "[WARN] Invalid trajectory precision " << precision << ", using float" << std::endl;
+        precision = trajectory::FLOAT32;
+    }
+    if ((fields & (trajectory::POSITION | trajectory::VELOCITY)) == 0) {
+        std::cerr << "[WARN] No trajectory fields selected, storing positions" << std::endl;
+        fields = trajectory::POSITION;
+    }
+    if (record_every < 1) {
+        record_every = 1;
+    }
+    if (_encoding == trajectory::DELTA) {
+        precision = trajectory::FLOAT64;
+    }
+
+    _file = std::fopen(path.c_str(), "wb");
+    if (_file == NULL) {
+        std::cerr << "[WARN] Could not open trajectory file " << path << std::endl;
+        return false;
+    }
+    // The writer thread already writes in large chunks, stdio buffering would only add a copy
+    std::setvbuf(_file, NULL, _IONBF, 0);
+
+    unsigned columns = ((fields & trajectory::POSITION) ? 2 : 0) + ((fields & trajectory::VELOCITY) ? 2 : 0);
+
+    std::memset(&_header, 0, sizeof(_header));
+    std::memcpy(_header.magic, "PIETRAJ", 8);
+    _header.version = 3;
+    _header.header_size = sizeof(TrajectoryHeader);
+    _header.object_count = universe.objects.size();
+    _header.fields = fields;
+    _header.precision = precision;
+    _header.record_every = record_every;
+    _header.timestep = universe.physics.timestep;
+    _header.width = universe.width;
+    _header.height = universe.height;
+    _frameSize = sizeof(uint64_t) + (uint64_t)columns * _header.object_count * precision;
+    _header.encoding = _encoding;
+    if (_encoding == trajectory::DELTA) {
+        // Encoded frames have no fixed size. Velocities are rounded relative to crossing the universe
+        // in one second.
+        _header.keyframe_every = _keyframeEvery;
+        _header.position_quantum = _quantisation * std::max(universe.width, universe.height);
+        _header.velocity_quantum = _header.position_quantum;
+    } else {
+        _header.frame_size = _frameSize;
+    }
+
+    if (std::fwrite(&_header, sizeof(_header), 1, _file) != 1) {
+        std::cerr << "[WARN] Could not write trajectory header to " << path << std::endl;
+        std::fclose(_file);
+        _file = NULL;
+        return false;
+    }
+
+    // Buffer space: write to disk in chunks of at least 4 MB, and let at most 64 MB of frames wait
+    _chunkSize = std::max<size_t>(4 << 20, _frameSize);
+    _chunk.clear();
+    _chunk.reserve(_chunkSize);
+    _maxQueued = std::max<uint64_t>(2, (64 << 20) / _frameSize);
+    _previous.assign((size_t)columns * _header.object_count, 0);
+    _previous2.assign((size_t)columns * _header.object_count, 0);
+
+    _steps = 0;
+    _frames = 0;
+    _written = 0;
+    _index.clear();
+    _closing = false;
+    _failed = false;
+    _writer = std::thread(&TrajectoryWriter::writer_loop, this);
+
+    return true;
+}
+
+/*
+ * record()
+ *
+ * Copy the positions and/or velocities of all objects into a frame buffer and hand it to the writer
+ * thread. Only blocks when the disk cannot keep up and the queue is full.
+ */
+void TrajectoryWriter::record(Universe &universe) {
+    if (_file == NULL) {
+        return;
+    }
+
+    unsigned n = _header.object_count;
+    if (universe.objects.size() != n) {
+        std::cerr << "[WARN] Amount of objects changed from " << n << " to " << universe.objects.size()
+                  << " while recording a trajectory" << std::endl;
+        n = std::min<size_t>(n, universe.objects.size());
+    }
+
+    // Get a free buffer, or wait until the writer is done with one
+    std::vector<char>* frame;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _frameFree.wait(lock, [this]() { return _free.size() || _full.size() < _maxQueued || _failed; });
+        if (_failed) {
+            return;
+        }
+        if (_free.size()) {
+            frame = _free.back();
+            _free.pop_back();
+        } else {
+            frame = new std::vector<char>;
+        }
+    }
+    frame->resize(_frameSize);
+    if (n < _header.object_count) {
+        // Objects that disappeared are stored as zeros
+        std::fill(frame->begin(), frame->end(), 0);
+    }
+
+    // Fill the frame: step number, then the columns
+    uint64_t step = _steps;
+    std::memcpy(&(*frame)[0], &step, sizeof(step));
+    char* column = &(*frame)[sizeof(step)];
+    size_t columnSize = (size_t)_header.object_count * _header.precision;
+
+    for (int field = 0; field < 4; ++field) {
+        // Field 0 and 1 are the position, 2 and 3 the velocity
+        if (field < 2 && !(_header.fields & trajectory::POSITION)) continue;
+        if (field >= 2 && !(_header.fields & trajectory::VELOCITY)) continue;
+
+        if (_header.precision == trajectory::FLOAT32) {
+            float* values = (float*)column;
+            for (unsigned ii = 0; ii < n; ++ii) {
+                values[ii] = field < 2 ? universe.objects[ii]->position[field] : universe.objects[ii]->velocity[field - 2];
+            }
+        } else {
+            double* values = (double*)column;
+            for (unsigned ii = 0; ii < n; ++ii) {
+                values[ii] = field < 2 ? universe.objects[ii]->position[field] : universe.objects[ii]->velocity[field - 2];
+            }
+        }
+        column += columnSize;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _full.push_back(frame);
+    }
+    _frameReady.notify_one();
+    ++_frames;
+}
+
+void TrajectoryWriter::step(Universe &universe) {
+    if (_file == NULL) {
+        return;
+    }
+    if (_steps % _header.record_every == 0) {
+        record(universe);
+    }
+    ++_steps;
+}
+
+/*
+ * writer_loop()
+ *
+ * Runs on the writer thread: collect frames into a large chunk and write it when it is full.
+ */
+void TrajectoryWriter::writer_loop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _frameReady.wait(lock, [this]() { return _full.size() || _closing; });
+        if (_full.empty() && _closing) {
+            break;
+        }
+
+        std::vector<char>* frame = _full.front();
+        _full.pop_front();
+        lock.unlock();
+
+        // Add the frame to the index, the step number is at the start of the frame
+        TrajectoryIndexEntry entry;
+        std::memcpy(&entry.step, &(*frame)[0], sizeof(entry.step));
+        entry.offset = _header.header_size + _written + _chunk.size();
+        _index.push_back(entry);
+
+        if (_header.encoding == trajectory::DELTA) {
+            encode_frame(*frame);
+        } else {
+            _chunk.insert(_chunk.end(), frame->begin(), frame->end());
+        }
+        if (_chunk.size() + _frameSize > _chunkSize) {
+            write_chunk();
+        }
+
+        lock.lock();
+        _free.push_back(frame);
+        _frameFree.notify_one();
+    }
+    lock.unlock();
+
+    write_chunk();
+}
+
+/*
+ * Entropy coding of DELTA frames
+ *
+ * A difference is coded as its class, the bit length of its zigzag value (0 to 64), followed by the
+ * bits below the leading one. Classes are coded with a canonical Huffman code that is built for every
+ * frame, separately for positions and velocities, and stored in front of the bit stream as one 4 bit
+ * code length per class. Codes are at most TRAJECTORY_MAX_CODE bits so decoding is one table lookup.
+ */
+const unsigned TRAJECTORY_CLASSES = 65;
+const unsigned TRAJECTORY_MAX_CODE = 12;
+const unsigned TRAJECTORY_TABLE_BYTES = (TRAJECTORY_CLASSES + 1) / 2;
+
+static inline unsigned trajectory_class(uint64_t value) {
+    return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+// Bits are written from the least significant end, so the reader can work with shifts only
+struct TrajectoryBitWriter{
+    unsigned char* out;
+    uint64_t bits;
+    unsigned count;
+
+    // Add up to 32 bits, whole 32 bit words go to the output (little endian, like the rest of the file)
+    void put(uint64_t value, unsigned length) {
+        bits |= value << count;
+        count += length;
+        if (count >= 32) {
+            uint32_t word = (uint32_t)bits;
+            std::memcpy(out, &word, sizeof(word));
+            out += sizeof(word);
+            bits >>= 32;
+            count -= 32;
+        }
+    }
+
+    void flush() {
+        while (count > 0) {
+            *out++ = (unsigned char)bits;
+            bits >>= 8;
+            count = count > 8 ? count - 8 : 0;
+        }
+        bits = 0;
+    }
+};
+
+struct TrajectoryBitReader{
+    const unsigned char* in;
+    const unsigned char* end;
+    uint64_t bits;
+    unsigned count;
+    size_t padding;         // Zero bytes added after the end, more than eight means the data was too short
+
+    void refill() {
+        while (count <= 56) {
+            if (in < end) {
+                bits |= (uint64_t)*in++ << count;
+            } else {
+                ++padding;
+            }
+            count += 8;
+        }
+    }
+
+    // Take up to 32 bits
+    uint64_t get(unsigned length) {
+        refill();
+        uint64_t value = bits & ((1ull << length) - 1);
+        bits >>= length;
+        count -= length;
+        return value;
+    }
+};
+
+/*
+ * trajectory_code_lengths()
+ *
+ * Huffman code lengths for the class frequencies. Code lengths above TRAJECTORY_MAX_CODE are avoided by
+ * flattening the frequencies and building the code again, which only happens for very skewed frames.
+ */
+static void trajectory_code_lengths(const uint64_t* frequency, unsigned char* lengths) {
+    std::vector<uint64_t> weight(frequency, frequency + TRAJECTORY_CLASSES);
+    while (true) {
+        // Nodes 0 to TRAJECTORY_CLASSES-1 are the classes, merged nodes are added after them
+        std::vector<uint64_t> nodeWeight;
+        std::vector<int> parent;
+        std::vector<int> active;
+        for (unsigned ii = 0; ii < TRAJECTORY_CLASSES; ++ii) {
+            nodeWeight.push_back(weight[ii]);
+            parent.push_back(-1);
+            if (weight[ii]) {
+                active.push_back(ii);
+            }
+        }
+
+        std::memset(lengths, 0, TRAJECTORY_CLASSES);
+        if (active.size() == 1) {
+            lengths[active[0]] = 1;
+            return;
+        }
+
+        // Merge the two lightest nodes until one is left, the amount of classes is small enough for
+        // a linear search
+        while (active.size() > 1) {
+            int merged = nodeWeight.size();
+            nodeWeight.push_back(0);
+            parent.push_back(-1);
+            for (int pick = 0; pick < 2; ++pick) {
+                unsigned lightest = 0;
+                for (unsigned ii = 1; ii < active.size(); ++ii) {
+                    if (nodeWeight[active[ii]] < nodeWeight[active[lightest]]) lightest = ii;
+                }
+                nodeWeight[merged] += nodeWeight[active[lightest]];
+                parent[active[lightest]] = merged;
+                active.erase(active.begin() + lightest);
+            }
+            active.push_back(merged);
+        }
+
+        unsigned longest = 0;
+        for (unsigned ii = 0; ii < TRAJECTORY_CLASSES; ++ii) {
+            if (weight[ii] == 0) continue;
+            unsigned length = 0;
+            for (int node = ii; parent[node] >= 0; node = parent[node]) ++length;
+            lengths[ii] = length;
+            longest = std::max(longest, length);
+        }
+        if (longest <= TRAJECTORY_MAX_CODE) {
+            return;
+        }
+        for (unsigned ii = 0; ii < TRAJECTORY_CLASSES; ++ii) {
+            if (weight[ii]) weight[ii] = (weight[ii] >> 1) | 1;
+        }
+    }
+}
+
+/*
+ * trajectory_canonical_codes()
+ *
+ * Assign canonical codes to the code lengths: shorter codes first, equal lengths in class order. The
+ * codes are bit reversed, because the bit stream starts with the least significant bit.
+ */
+static void trajectory_canonical_codes(const unsigned char* lengths, uint32_t* codes) {
+    uint32_t code = 0;
+    for (unsigned length = 1; length <= TRAJECTORY_MAX_CODE; ++length) {
+        for (unsigned ii = 0; ii < TRAJECTORY_CLASSES; ++ii) {
+            if (lengths[ii] != length) continue;
+            uint32_t reversed = 0;
+            for (unsigned bit = 0; bit < length; ++bit) {
+                reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+            }
+            codes[ii] = reversed;
+            ++code;
+        }
+        code <<= 1;
+    }
+}
+
+/*
+ * trajectory_decode_table()
+ *
+ * Lookup table from the next TRAJECTORY_MAX_CODE bits to class (low byte) and code length (high byte).
+ * Returns false when the code lengths do not form a valid code.
+ */
+static bool trajectory_decode_table(const unsigned char* lengths, std::vector<uint16_t> &table) {
+    uint32_t codes[TRAJECTORY_CLASSES];
+    uint64_t used = 0;
+    for (unsigned ii = 0; ii < TRAJECTORY_CLASSES; ++ii) {
+        if (lengths[ii] > TRAJECTORY_MAX_CODE) return false;
+        if (lengths[ii]) used += 1ull << (TRAJECTORY_MAX_CODE - lengths[ii]);
+    }
+    if (used > (1ull << TRAJECTORY_MAX_CODE)) {
+        return false;
+    }
+    trajectory_canonical_codes(lengths, codes);
+
+    // Entries that stay zero are not a code
+    table.assign(1 << TRAJECTORY_MAX_CODE, 0);
+    for (unsigned ii = 0; ii < TRAJECTORY_CLASSES; ++ii) {
+        if (lengths[ii] == 0) continue;
+        for (uint32_t fill = codes[ii]; fill < table.size(); fill += 1u << lengths[ii]) {
+            table[fill] = ii | (lengths[ii] << 8);
+        }
+    }
+    return true;
+}
+
+/*
+ * encode_frame()
+ *
+ * Runs on the writer thread: quantise the values of a frame, predict them from the previous frames
+ * and append the entropy coded differences to the chunk (see the file layout in trajectory.h).
+ */
+void TrajectoryWriter::encode_frame(const std::vector<char> &frame) {
+    size_t n = _header.object_count;
+    size_t count = _previous.size();
+    uint64_t frameNumber = _index.size() - 1;
+    unsigned history = std::min<uint64_t>(2, frameNumber % _header.keyframe_every);
+    uint32_t keyframe = history == 0;
+
+    // The first two columns are positions, unless only velocities are stored. Table 0 codes the
+    // positions, table 1 the velocities.
+    size_t velocityStart = (_header.fields & trajectory::POSITION) ? 2 * n : 0;
+    const double* values = (const double*)&frame[sizeof(uint64_t)];
+    uint64_t frequency[2][TRAJECTORY_CLASSES];
+    std::memset(frequency, 0, sizeof(frequency));
+    _residuals.resize(count);
+    double scales[2] = {1.0 / _header.position_quantum, 1.0 / _header.velocity_quantum};
+
+    for (size_t ii = 0; ii < count; ++ii) {
+        bool velocity = ii >= velocityStart;
+        double scale = scales[velocity];
+        // Round to the nearest step, the cast is much cheaper than std::floor
+        double scaled = values[ii] * scale;
+        int64_t quantised = (int64_t)(scaled + (scaled < 0 ? -0.5 : 0.5));
+
+        int64_t prediction = history == 0 ? 0 : history == 1 ? _previous[ii] : 2 * _previous[ii] - _previous2[ii];
+        // The second previous frame is not needed anymore, it becomes the current frame below
+        _previous2[ii] = quantised;
+
+        uint64_t difference = (uint64_t)(quantised - prediction);
+        uint64_t zigzag = (difference << 1) ^ (uint64_t)((int64_t)difference >> 63);
+        _residuals[ii] = zigzag;
+        ++frequency[velocity][trajectory_class(zigzag)];
+    }
+    _previous.swap(_previous2);
+
+    // Worst case every value takes its longest code and 63 bits, the chunk is shrunk afterwards
+    size_t start = _chunk.size();
+    _chunk.resize(start + sizeof(uint64_t) + 2 * sizeof(uint32_t) + 2 * TRAJECTORY_TABLE_BYTES + 10 * count + 8);
+    char* out = &_chunk[start];
+    std::memcpy(out, &frame[0], sizeof(uint64_t));
+    std::memcpy(out + sizeof(uint64_t) + sizeof(uint32_t), &keyframe, sizeof(keyframe));
+    unsigned char* payload = (unsigned char*)out + sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+    // Code tables of the stored quantities
+    unsigned char lengths[2][TRAJECTORY_CLASSES];
+    uint32_t codes[2][TRAJECTORY_CLASSES];
+    unsigned char* table = payload;
+    for (int type = 0; type < 2; ++type) {
+        if (type == 0 && !(_header.fields & trajectory::POSITION)) continue;
+        if (type == 1 && !(_header.fields & trajectory::VELOCITY)) continue;
+        trajectory_code_lengths(frequency[type], lengths[type]);
+        trajectory_canonical_codes(lengths[type], codes[type]);
+        std::memset(table, 0, TRAJECTORY_TABLE_BYTES);
+        for (unsigned ii = 0; ii < TRAJECTORY_CLASSES; ++ii) {
+            table[ii / 2] |= lengths[type][ii] << (4 * (ii % 2));
+        }
+        table += TRAJECTORY_TABLE_BYTES;
+    }
+
+    TrajectoryBitWriter writer = {table, 0, 0};
+    for (size_t ii = 0; ii < count; ++ii) {
+        int type = ii >= velocityStart;
+        uint64_t zigzag = _residuals[ii];
+        unsigned size = trajectory_class(zigzag);
+        writer.put(codes[type][size], lengths[type][size]);
+        // The leading one is implied by the class
+        if (size > 33) {
+            writer.put(zigzag & 0xffffffff, 32);
+            writer.put((zigzag >> 32) & ((1ull << (size - 33)) - 1), size - 33);
+        } else if (size > 1) {
+            writer.put(zigzag & ((1ull << (size - 1)) - 1), size - 1);
+        }
+    }
+    writer.flush();
+
+    uint32_t payloadSize = writer.out - payload;
+    std::memcpy(&_chunk[start + sizeof(uint64_t)], &payloadSize, sizeof(payloadSize));
+    _chunk.resize((char*)writer.out - &_chunk[0]);
+}
+
+void TrajectoryWriter::write_chunk() {
+    // After a failed write the remaining frames are dropped
+    if (_chunk.empty() || _failed) {
+        _chunk.clear();
+        return;
+    }
+    if (std::fwrite(&_chunk[0], 1, _chunk.size(), _file) == _chunk.size()) {
+        _written += _chunk.size();
+    } else {
+        std::cerr << "[WARN] Could not write to trajectory file, stopped recording" << std::endl;
+        std::lock_guard<std::mutex> lock(_mutex);
+        _failed = true;
+        _frameFree.notify_all();
+    }
+    _chunk.clear();
+}
+
+/*
+ * close()
+ *
+ * Flush all waiting frames, write the frame index after the frames and the final frame count and
+ * index position into the header, then close the file.
+ */
+bool TrajectoryWriter::close() {
+    if (_file == NULL) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closing = true;
+    }
+    _frameReady.notify_one();
+    _writer.join();
+
+    bool ok = !_failed;
+    if (ok) {
+        TrajectoryIndexHeader indexHeader;
+        std::memcpy(indexHeader.magic, "PIEINDX", 8);
+        indexHeader.frame_count = _index.size();
+        ok = std::fwrite(&indexHeader, sizeof(indexHeader), 1, _file) == 1;
+        if (ok && _index.size()) {
+            ok = std::fwrite(&_index[0], sizeof(TrajectoryIndexEntry), _index.size(), _file) == _index.size();
+        }
+
+        _header.frame_count = _index.size();
+        _header.index_offset = _header.header_size + _written;
+        ok = ok && std::fseek(_file, 0, SEEK_SET) == 0 && std::fwrite(&_header, sizeof(_header), 1, _file) == 1;
+    }
+    ok = (std::fclose(_file) == 0) && ok;
+    _file = NULL;
+
+    for (int ii = 0; ii < _free.size(); ++ii) {
+        delete _free[ii];
+    }
+    _free.clear();
+
+    return ok;
+}
+
+TrajectoryReader::TrajectoryReader() : header(_header) {
+    std::memset(&_header, 0, sizeof(_header));
+    _decodedFrame = UINT64_MAX;
+    _decodedHistory = 0;
+}
+
+/*
+ * open()
+ *
+ * Map the file and check the header and the frame index. Nothing else is read, the frames are only
+ * loaded from disk when they are accessed.
+ */
+bool TrajectoryReader::open(std::string path) {
+    close();
+
+    if (!_file.open(path)) {
+        return false;
+    }
+
+    if (_file.size() < sizeof(TrajectoryHeader) || std::memcmp(_file.data(), "PIETRAJ", 8) != 0) {
+        std::cerr << "[WARN] " << path << " is not a trajectory file" << std::endl;
+        close();
+        return false;
+    }
+    std::memcpy(&_header, _file.data(), sizeof(_header));
+    if (_header.version != 3 || _header.header_size < sizeof(TrajectoryHeader)) {
+        std::cerr << "[WARN] Unsupported trajectory file version " << _header.version << " in " << path << std::endl;
+        close();
+        return false;
+    }
+    if (_header.header_size > _file.size()) {
+        std::cerr << "[WARN] Trajectory file " << path << " is shorter than its header" << std::endl;
+        close();
+        return false;
+    }
+    if (_header.encoding == trajectory::DELTA) {
+        if (_header.index_offset == 0 || _header.keyframe_every == 0 || _header.precision != trajectory::FLOAT64) {
+            std::cerr << "[WARN] " << path << " was not closed properly, its encoded frames cannot be found" << std::endl;
+            close();
+            return false;
+        }
+    } else if (_header.encoding != trajectory::RAW) {
+        std::cerr << "[WARN] Unknown trajectory encoding " << _header.encoding << " in " << path << std::endl;
+        close();
+        return false;
+    }
+
+    // Use the index when it is there, otherwise the frames follow each other directly
+    if (_header.index_offset) {
+        const TrajectoryIndexHeader* indexHeader = (const TrajectoryIndexHeader*)(_file.data() + _header.index_offset);
+        if (_header.index_offset > _file.size() - sizeof(TrajectoryIndexHeader) ||
+                std::memcmp(indexHeader->magic, "PIEINDX", 8) != 0 ||
+                indexHeader->frame_count > (_file.size() - _header.index_offset - sizeof(TrajectoryIndexHeader)) / sizeof(TrajectoryIndexEntry)) {
+            std::cerr << "[WARN] The frame index of " << path << " is damaged" << std::endl;
+            close();
+            return false;
+        }
+        _header.frame_count = indexHeader->frame_count;
+        _index = (const TrajectoryIndexEntry*)(indexHeader + 1);
+
+        size_t values = (size_t)column_count() * _header.object_count;
+        _previous.assign(values, 0);
+        _previous2.assign(values, 0);
+    } else {
+        // A file that was not closed properly has no frame count, use whatever frames are complete
+        uint64_t available = _header.frame_size ? (_file.size() - _header.header_size) / _header.frame_size : 0;
+        if (_header.frame_count == 0 || _header.frame_count > available) {
+            _header.frame_count = available;
+        }
+    }
+
+    return true;
+}
+
+void TrajectoryReader::close() {
+    _file.close();
+    _index = NULL;
+    std::memset(&_header, 0, sizeof(_header));
+    _decodedFrame = UINT64_MAX;
+    _decodedHistory = 0;
+    _previous.clear();
+    _previous2.clear();
+}
+
+uint64_t TrajectoryReader::frames() const {
+    return _header.frame_count;
+}
+
+const char* TrajectoryReader::frame_data(uint64_t frame) const {
+    if (frame >= _header.frame_count) {
+        return NULL;
+    }
+    if (_index != NULL) {
+        return _file.data() + _index[frame].offset;
+    }
+    return _file.data() + _header.header_size + frame * _header.frame_size;
+}
+
+uint64_t TrajectoryReader::frame_step(uint64_t frame) const {
+    if (_index != NULL && frame < _header.frame_count) {
+        return _index[frame].step;
+    }
+    const char* data = frame_data(frame);
+    uint64_t step = 0;
+    if (data != NULL) {
+        std::memcpy(&step, data, sizeof(step));
+    }
+    return step;
+}
+
+unsigned TrajectoryReader::column_count() const {
+    return ((_header.fields & trajectory::POSITION) ? 2 : 0) + ((_header.fields & trajectory::VELOCITY) ? 2 : 0);
+}
+
+long TrajectoryReader::column_offset(unsigned quantity) const {
+    bool position = _header.fields & trajectory::POSITION;
+    bool velocity = _header.fields & trajectory::VELOCITY;
+    if (quantity > trajectory::VY || (quantity < trajectory::VX && !position) || (quantity >= trajectory::VX && !velocity)) {
+        return -1;
+    }
+
+    // Velocity columns come after the position columns, when those are stored
+    unsigned column = (quantity >= trajectory::VX && !position) ? quantity - 2 : quantity;
+    return sizeof(uint64_t) + (long)column * _header.object_count * _header.precision;
+}
+
+/*
+ * column()
+ *
+ * Return the values of a quantity for all objects in a frame. The frame layout makes this a pointer
+ * into the mapping.
+ */
+template<typename T>
+TrajectorySpan<T> TrajectoryReader::column(uint64_t frame, unsigned quantity) const {
+    TrajectorySpan<T> span = {NULL, 0};
+    const char* data = frame_data(frame);
+    long offset = column_offset(quantity);
+    if (data == NULL || offset < 0 || sizeof(T) != _header.precision || _header.encoding != trajectory::RAW) {
+        return span;
+    }
+    span.data = (const T*)(data + offset);
+    span.count = _header.object_count;
+    return span;
+}
+
+/*
+ * object()
+ *
+ * Return the values of a quantity of one object over a range of frames. All frames have the same size,
+ * so this is a strided span into the mapping. The range is clipped to the available frames.
+ */
+template<typename T>
+TrajectoryStridedSpan<T> TrajectoryReader::object(unsigned object, unsigned quantity, uint64_t first, uint64_t count) const {
+    TrajectoryStridedSpan<T> span = {NULL, 0, 0};
+    long offset = column_offset(quantity);
+    if (object >= _header.object_count || first >= _header.frame_count || offset < 0 || sizeof(T) != _header.precision ||
+            _header.encoding != trajectory::RAW) {
+        return span;
+    }
+    if (count > _header.frame_count - first) {
+        count = _header.frame_count - first;
+    }
+    span.data = frame_data(first) + offset + (size_t)object * sizeof(T);
+    span.stride = _header.frame_size;
+    span.count = count;
+    return span;
+}
+
+/*
+ * decode_frame()
+ *
+ * Decode a DELTA frame into _previous. Decoding starts at the keyframe before the frame, or continues
+ * from the last decoded frame when that is on the way, so reading frames in order costs one frame each.
+ */
+bool TrajectoryReader::decode_frame(uint64_t frame) const {
+    if (frame >= _header.frame_count) {
+        return false;
+    }
+    uint64_t first = frame - frame % _header.keyframe_every;
+    bool continuing = _decodedFrame != UINT64_MAX && _decodedFrame >= first && _decodedFrame <= frame;
+    if (continuing) {
+        if (_decodedFrame == frame) {
+            return true;
+        }
+        first = _decodedFrame + 1;
+    }
+
+    size_t n = _header.object_count;
+    size_t count = _previous.size();
+    size_t velocityStart = (_header.fields & trajectory::POSITION) ? 2 * n : 0;
+    const size_t frameHeader = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+    const char* end = _file.data() + _file.size();
+    std::vector<uint16_t> tables[2];
+
+    for (uint64_t ff = first; ff <= frame; ++ff) {
+        const char* data = frame_data(ff);
+        uint32_t payloadSize, keyframe;
+        if (data + frameHeader > end) {
+            break;
+        }
+        std::memcpy(&payloadSize, data + sizeof(uint64_t), sizeof(payloadSize));
+        std::memcpy(&keyframe, data + sizeof(uint64_t) + sizeof(uint32_t), sizeof(keyframe));
+        const unsigned char* payload = (const unsigned char*)(data + frameHeader);
+        if (data + frameHeader + payloadSize > end || (ff == first && !continuing && !keyframe)) {
+            break;
+        }
+
+        // Code tables of the stored quantities
+        const unsigned char* in = payload;
+        bool damaged = false;
+        for (int type = 0; type < 2; ++type) {
+            if (type == 0 && !(_header.fields & trajectory::POSITION)) continue;
+            if (type == 1 && !(_header.fields & trajectory::VELOCITY)) continue;
+            unsigned char lengths[TRAJECTORY_CLASSES];
+            for (unsigned ii = 0; ii < TRAJECTORY_CLASSES; ++ii) {
+                lengths[ii] = (in[ii / 2] >> (4 * (ii % 2))) & 0xf;
+            }
+            in += TRAJECTORY_TABLE_BYTES;
+            if (in > payload + payloadSize || !trajectory_decode_table(lengths, tables[type])) {
+                damaged = true;
+            }
+        }
+        if (damaged) {
+            break;
+        }
+
+        unsigned history = keyframe ? 0 : _decodedHistory;
+        TrajectoryBitReader reader = {in, payload + payloadSize, 0, 0, 0};
+        for (size_t ii = 0; ii < count; ++ii) {
+            int type = ii >= velocityStart;
+            reader.refill();
+            uint16_t entry = tables[type][reader.bits & ((1u << TRAJECTORY_MAX_CODE) - 1)];
+            if (entry == 0) {
+                damaged = true;
+                break;
+            }
+            reader.get(entry >> 8);
+
+            // Add the bits below the leading one
+            unsigned size = entry & 0xff;
+            uint64_t zigzag = 0;
+            if (size > 33) {
+                zigzag = reader.get(32);
+                zigzag |= (reader.get(size - 33) | (1ull << (size - 33))) << 32;
+            } else if (size > 0) {
+                zigzag = reader.get(size - 1) | (1ull << (size - 1));
+            }
+
+            int64_t difference = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+            int64_t prediction = history == 0 ? 0 : history == 1 ? _previous[ii] : 2 * _previous[ii] - _previous2[ii];
+            _previous2[ii] = prediction + difference;
+        }
+        // Reading beyond the payload only gives zero bits, so check afterwards if it happened
+        if (damaged || (reader.in - payload + reader.padding) * 8 - reader.count > payloadSize * 8ull) {
+            break;
+        }
+
+        _previous.swap(_previous2);
+        _decodedHistory = std::min(2u, history + 1);
+        _decodedFrame = ff;
+    }
+
+    if (_decodedFrame != frame) {
+        std::cerr << "[WARN] Could not decode trajectory frame " << frame << std::endl;
+        _decodedFrame = UINT64_MAX;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * read_frame()
+ *
+ * Copy the values of all stored columns of a frame as doubles.
+ */
+bool TrajectoryReader::read_frame(uint64_t frame, std::vector<double> &values) const {
+    size_t n = _header.object_count;
+    size_t count = (size_t)column_count() * n;
+    const char* data = frame_data(frame);
+    if (data == NULL) {
+        return false;
+    }
+    values.resize(count);
+
+    if (_header.encoding == trajectory::DELTA) {
+        if (!decode_frame(frame)) {
+            return false;
+        }
+        size_t velocityStart = (_header.fields & trajectory::POSITION) ? 2 * n : 0;
+        for (size_t ii = 0; ii < count; ++ii) {
+            bool velocity = ii >= velocityStart;
+            values[ii] = _previous[ii] * (velocity ? _header.velocity_quantum : _header.position_quantum);
+        }
+    } else if (_header.precision == trajectory::FLOAT32) {
+        const float* columns = (const float*)(data + sizeof(uint64_t));
+        std::copy(columns, columns + count, values.begin());
+    } else {
+        const double* columns = (const double*)(data + sizeof(uint64_t));
+        std::copy(columns, columns + count, values.begin());
+    }
+    return true;
+}
@@ -0,0 +1,236 @@
+//
+// Binary trajectory output of the simulation, written by a background thread.
+//
+
+#ifndef PIE_GITHUB_FRAMEWORK_H
+
+#include "framework.h"
+
+#endif
+
+#ifndef PIE_GITHUB_TRAJECTORY_H
+#define PIE_GITHUB_TRAJECTORY_H
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include "mapped_file.h"
+
+// Fields that can be stored per object in a trajectory frame (bit flags)
+namespace trajectory{
+    const uint32_t POSITION = 1;    // x and y column
+    const uint32_t VELOCITY = 2;    // vx and vy column
+
+    const uint32_t FLOAT32 = 4;     // Store values as float
+    const uint32_t FLOAT64 = 8;     // Store values as double
+
+    // Frame encodings
+    const uint32_t RAW = 0;         // Columns of float or double values
+    const uint32_t DELTA = 1;       // Quantised values, delta coded against a linear prediction
+
+    // Quantities that can be read per object
+    const unsigned X = 0;
+    const unsigned Y = 1;
+    const unsigned VX = 2;
+    const unsigned VY = 3;
+}
+
+/*
+ * File layout (all values little endian):
+ *
+ *   TrajectoryHeader
+ *   frame 0, frame 1, ..., frame n-1
+ *   TrajectoryIndexHeader
+ *   TrajectoryIndexEntry for frame 0, ..., frame n-1
+ *
+ * Every frame has the same size: the physics step number (uint64) followed by one column per value,
+ * in the order x, y, vx, vy (only the fields that are stored). Each column holds object_count values
+ * of precision bytes. Storing columns instead of objects makes reading one quantity for all objects
+ * a single contiguous read.
+ *
+ * The frame index at the end of the file is written when the file is closed, so frame k is found
+ * without reading any other frame. A RAW file that was not closed properly has no index, its frames
+ * are found from the frame size.
+ *
+ * DELTA encoded frames have a variable size and are only found through the index. They
+ * hold the step number, the payload size (uint32), a keyframe flag (uint32) and the payload. Every
+ * value is quantised to a multiple of position_quantum or velocity_quantum and predicted from the
+ * same value in earlier frames: nothing for a keyframe, the previous value for the frame after it,
+ * and the linear extrapolation 2 * previous - second previous otherwise. The payload holds the
+ * differences with the predictions, column after column, entropy coded with code tables that are
+ * stored in the frame (see encode_frame() in trajectory.cpp). Every keyframe_every-th frame is a
+ * keyframe, so a frame is decoded from at most keyframe_every frames.
+ */
+struct TrajectoryHeader{
+    char magic[8];          // "PIETRAJ" with a trailing zero
+    uint32_t version;
+    uint32_t header_size;   // sizeof(TrajectoryHeader), offset of the first frame
+    uint32_t object_count;
+    uint32_t fields;        // trajectory::POSITION | trajectory::VELOCITY
+    uint32_t precision;     // trajectory::FLOAT32 or trajectory::FLOAT64
+    uint32_t record_every;  // Physics iterations between two frames
+    double timestep;        // Physics timestep [s]
+    double width;           // Universe dimensions
+    double height;
+    uint64_t frame_count;   // Amount of frames, written when the file is closed
+    uint64_t frame_size;    // Size of one frame in bytes
+    uint64_t index_offset;  // Offset of the TrajectoryIndexHeader, written when the file is closed
+    uint32_t encoding;      // trajectory::RAW or trajectory::DELTA
+    uint32_t keyframe_every; // Frames from one keyframe to the next in DELTA files
+    double position_quantum; // Quantisation step of positions in DELTA files
+    double velocity_quantum; // Quantisation step of velocities in DELTA files
+};
+
+struct TrajectoryIndexHeader{
+    char magic[8];          // "PIEINDX" with a trailing zero
+    uint64_t frame_count;   // Amount of entries that follow
+};
+
+struct TrajectoryIndexEntry{
+    uint64_t step;          // Physics step of the frame
+    uint64_t offset;        // Offset of the frame from the start of the file
+};
+
+// A column of values in a mapped trajectory file, valid as long as the reader is open
+template<typename T>
+struct TrajectorySpan{
+    const T* data;
+    size_t count;
+
+    const T &operator[](size_t ii) const { return data[ii]; }
+    const T* begin() const { return data; }
+    const T* end() const { return data + count; }
+};
+
+// Values with a fixed distance in bytes between them, for instance one object over many frames
+template<typename T>
+struct TrajectoryStridedSpan{
+    const char* data;
+    size_t stride;
+    size_t count;
+
+    const T &operator[](size_t ii) const { return *(const T*)(data + ii * stride); }
+};
+
+// Writes frames of a universe to a trajectory file. The objects are copied into a frame buffer on
+// the calling thread, formatting and disk writes happen on a background thread.
+class TrajectoryWriter{
+private:
+    FILE* _file = NULL;
+    TrajectoryHeader _header;
+
+    // Frame buffers are recycled between the simulation and the writer thread
+    std::vector<std::vector<char>*> _free;
+    std::deque<std::vector<char>*> _full;
+    unsigned _maxQueued;                // Amount of frames that can wait for the disk
+    std::mutex _mutex;
+    std::condition_variable _frameReady;
+    std::condition_variable _frameFree;
+    bool _closing = false;
+    bool _failed = false;
+    std::thread _writer;
+
+    // Bytes collected by the writer thread before going to disk, so every fwrite is large
+    std::vector<char> _chunk;
+    size_t _chunkSize;
+    uint64_t _written = 0;              // Bytes of frames written to the file
+
+    // Frame index, filled by the writer thread and written when the file is closed
+    std::vector<TrajectoryIndexEntry> _index;
+
+    unsigned long long _steps = 0;      // Physics iterations seen by step()
+    unsigned long long _frames = 0;     // Frames handed to the writer thread
+
+    // Encoding settings, and the quantised values of the last two frames for the DELTA prediction
+    uint32_t _encoding = trajectory::RAW;
+    double _quantisation = 1e-5;
+    unsigned _keyframeEvery = 60;
+    uint64_t _frameSize;                // Size of the frame buffers
+    std::vector<int64_t> _previous;
+    std::vector<int64_t> _previous2;
+    std::vector<uint64_t> _residuals;   // Zigzag coded prediction errors of the frame being encoded
+
+    void writer_loop();
+    void write_chunk();
+    void encode_frame(const std::vector<char> &frame);
+
+public:
+    TrajectoryWriter();
+    ~TrajectoryWriter();
+
+    // Open a file for a universe, its amount of objects is fixed from now on. fields and precision are
+    // trajectory:: constants, a frame is recorded every record_every physics iterations.
+    bool open(std::string path, Universe &universe, uint32_t fields = trajectory::POSITION | trajectory::VELOCITY,
+              uint32_t precision = trajectory::FLOAT32, unsigned record_every = 1);
+
+    // Use the DELTA encoding for the next open(): values are rounded to quantisation times the largest
+    // universe dimension (velocities the same per second), and every keyframe_every-th frame is a keyframe. RAW switches it off again.
+    void set_encoding(uint32_t encoding, double quantisation = 1e-5, unsigned keyframe_every = 60);
+
+    // Record the current state of the universe as a frame
+    void record(Universe &universe);
+
+    // Call after every physics iteration, records a frame every record_every iterations
+    void step(Universe &universe);
+
+    // Wait for all frames to be on disk and close the file
+    bool close();
+
+    bool is_open();
+    unsigned long long frames();
+};
+
+// Reads a trajectory file through a memory mapping. Frames and columns are returned as spans into
+// the mapping, so nothing is parsed or copied and seeking to any frame is O(1).
+class TrajectoryReader{
+private:
+    MappedFile _file;
+    TrajectoryHeader _header;
+    const TrajectoryIndexEntry* _index = NULL;  // Points into the mapping, NULL when the file has no index
+
+    // State of the DELTA decoder, so reading frames in order decodes every frame only once
+    mutable uint64_t _decodedFrame;
+    mutable unsigned _decodedHistory;   // Frames decoded since the last keyframe, up to 2
+    mutable std::vector<int64_t> _previous;
+    mutable std::vector<int64_t> _previous2;
+
+    // Offset of a column within a frame, or -1 if the quantity is not stored
+    long column_offset(unsigned quantity) const;
+    unsigned column_count() const;
+    bool decode_frame(uint64_t frame) const;
+
+public:
+    TrajectoryReader();
+
+    bool open(std::string path);
+    void close();
+
+    const TrajectoryHeader &header;
+
+    uint64_t frames() const;
+    uint64_t frame_step(uint64_t frame) const;
+
+    // Start of the record of a frame (the step number followed by the columns)
+    const char* frame_data(uint64_t frame) const;
+
+    // Copy all stored columns of a frame into values as doubles, in the order of the frame layout. Works
+    // for every encoding, DELTA frames are decoded.
+    bool read_frame(uint64_t frame, std::vector<double> &values) const;
+
+    // All objects' values of a trajectory:: quantity in one frame. T must match the precision of the
+    // file (float or double), otherwise an empty span is returned. DELTA files always return empty
+    // spans, use read_frame() for them.
+    template<typename T>
+    TrajectorySpan<T> column(uint64_t frame, unsigned quantity) const;
+
+    // The values of one object for frames first up to first + count
+    template<typename T>
+    TrajectoryStridedSpan<T> object(unsigned object, unsigned quantity, uint64_t first, uint64_t count) const;
+};
+
+#include "trajectory.cpp"
+
+#endif //PIE_GITHUB_TRAJECTORY_H
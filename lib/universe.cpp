@@ -85,6 +85,37 @@ Object* Universe::add_object () {
     return obj;
 }
 
+/*
+ * add_objects()
+ *
+ * Add many objects at once. They are allocated as a single array, instead of one heap allocation
+ * per object, and stay in memory until the universe is destroyed (also when they are removed).
+ */
+Object* Universe::add_objects (size_t amount) {
+    if (amount == 0) {
+        return NULL;
+    }
+    Object* block = new Object[amount];
+    _blocks.push_back(block);
+    _blockSizes.push_back(amount);
+
+    objects.reserve(objects.size() + amount);
+    for (size_t ii = 0; ii < amount; ++ii) {
+        objects.push_back(block + ii);
+    }
+
+    return block;
+}
+
+bool Universe::in_block (Object* obj) {
+    for (int ii = 0; ii < _blocks.size(); ++ii) {
+        if (obj >= _blocks[ii] && obj < _blocks[ii] + _blockSizes[ii]) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /*
  * remove_object_by_index()
  *
@@ -97,8 +128,10 @@ void Universe::remove_object_by_index(int obj_index) {
     // Remove the object from the vector of objects
     objects.erase(objects.begin() + obj_index);
 
-    // Remove it from heap memory
-    delete X;
+    // Remove it from heap memory, objects in a block are freed with their block
+    if (!in_block(X)) {
+        delete X;
+    }
 }
 
 /*
@@ -123,12 +156,17 @@ void Universe::remove_object(Object* obj)  {
  * Remove all objects in the objects vector, so that the heap memory is cleared
  */
 Universe::~Universe() {
-    // Delete all objects stored in the universe
-    int n = this->objects.size();
+    // Delete all objects stored in the universe. Removing them one by one with remove_object_by_index()
+    // would shift the whole vector every time, which is O(n^2) for large universes.
+    for (int ii = 0; ii < this->objects.size(); ++ii) {
+        if (_blocks.empty() || !in_block(this->objects[ii])) {
+            delete this->objects[ii];
+        }
+    }
+    this->objects.clear();
 
-    // Remove the first item n times
-    for (int ii = 0; ii < n; ++ii) {
-        this->remove_object_by_index(0);
+    for (int ii = 0; ii < _blocks.size(); ++ii) {
+        delete[] _blocks[ii];
     }
 
 }
@@ -161,6 +199,12 @@ void Universe::resize(double width, double height) {
  * Do not use this function for stepping the world! Use simulate_one_time_unit() for that.
  */
 void Universe::physics_runtime_iteration () {
+    // Keep track of the time per phase, only when metrics are enabled
+    std::chrono::steady_clock::time_point phase_start;
+    if (metrics != NULL) {
+        phase_start = std::chrono::steady_clock::now();
+    }
+
     // Temporary result storage
     std::map<Object*, std::array<vec2d, 2>> new_pos_vel_universe;
 
@@ -176,6 +220,16 @@ void Universe::physics_runtime_iteration () {
         objects[ii]->set_velocity(new_pos_vel_universe[objects[ii]][1]);
     }
 
+    if (metrics != NULL) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        metrics->integrate_time->observe(std::chrono::duration<double>(now - phase_start).count());
+        phase_start = now;
+    }
+
+    // Count collisions locally, the metrics are only updated once per iteration
+    unsigned long contacts = 0;
+    unsigned long wall_hits = 0;
+
     // Check for collisions
     for (int ii = 0; ii < objects.size(); ++ii) {
         for (int jj = ii + 1; jj < objects.size(); ++jj) {
@@ -185,6 +239,7 @@ void Universe::physics_runtime_iteration () {
                 // If that is the case, go fix it!
                 //std::cout << "Resolving collision...\n";
                 physics.resolve_collision(objects[ii], objects[jj]);
+                ++contacts;
                 objects[ii]->on_collide(objects[jj], this->physics);
                 objects[jj]->on_collide(objects[ii], this->physics);
             }
@@ -204,27 +259,39 @@ void Universe::physics_runtime_iteration () {
         if ( pos[0] - r < -this->_width/2 ) {
             // Do the wall collision
             physics.wall_collision(objects[ii], this->_width, this->_height, 4);
+            ++wall_hits;
         }
 
         // Colliding into the east wall
         if ( pos[0] + r > this->_width/2 ) {
             // Do the wall collision
             physics.wall_collision(objects[ii], this->_width, this->_height, 2);
+            ++wall_hits;
         }
 
         // Collide into the north wall
         if ( pos[1] + r > this->_height/2 ) {
             // Do the wall collision
             physics.wall_collision(objects[ii], this->_width, this->_height, 1);
+            ++wall_hits;
         }
 
         // Collide into the south wall
         if ( pos[1] - r < -this->_height/2 ) {
             // Do the wall collision
             physics.wall_collision(objects[ii], this->_width, this->_height, 3);
+            ++wall_hits;
         }
     }
 
+    if (metrics != NULL) {
+        metrics->collide_time->observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - phase_start).count());
+        metrics->steps->add();
+        unsigned long long n = objects.size();
+        metrics->pair_tests->add(n * (n - 1) / 2);
+        metrics->contacts->add(contacts);
+        metrics->wall_hits->add(wall_hits);
+    }
 }
 
 /*
@@ -244,5 +311,54 @@ void Universe::simulate_one_time_unit(double fps) {
 
     // Increment the score
     this->_score++;
+
+    if (metrics != NULL) {
+        metrics->time_units->add();
+        this->sample_metrics();
+    }
+}
+
+/*
+ * sample_metrics()
+ *
+ * Calculate the total energy and momentum of the universe and the amount of physics iterations per
+ * second, and store them in the bound metrics. The potential energy is as expensive as a physics
+ * iteration, so this is done at most once per metrics->sample_interval seconds.
+ */
+void Universe::sample_metrics () {
+    if (metrics == NULL) {
+        return;
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - metrics->last_sample).count();
+    if (elapsed < metrics->sample_interval) {
+        return;
+    }
+
+    double kinetic = 0;
+    double potential = 0;
+    vec2d momentum = {{0}};
+    for (int ii = 0; ii < objects.size(); ++ii) {
+        kinetic += 0.5 * objects[ii]->mass * len_squared(objects[ii]->velocity);
+        momentum = add(momentum, cmult(objects[ii]->velocity, objects[ii]->mass));
+
+        // Every pair only once
+        for (int jj = ii + 1; jj < objects.size(); ++jj) {
+            potential -= physics.G * objects[ii]->mass * objects[jj]->mass / physics.distance_between(objects[ii], objects[jj]);
+        }
+    }
+
+    unsigned long long steps = metrics->steps->value();
+
+    metrics->objects->set(objects.size());
+    metrics->kinetic_energy->set(kinetic);
+    metrics->potential_energy->set(potential);
+    metrics->momentum_x->set(momentum[0]);
+    metrics->momentum_y->set(momentum[1]);
+    metrics->steps_per_second->set((steps - metrics->last_sample_steps) / elapsed);
+
+    metrics->last_sample = now;
+    metrics->last_sample_steps = steps;
 }
 
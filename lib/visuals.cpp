@@ -77,8 +77,9 @@ void Window::stdInitWindow(){
     // Set the working space of gl to this window
     glfwMakeContextCurrent(GLFWpointer);
 
-    ///// Initialize GLEW
+    ///// Initialize GLEW (also the functions that are only exported by core profiles), LoadShaders does not do it again
     // Return error if this failed.
+    glewExperimental = GL_TRUE;
     if (glewInit() != GLEW_OK) {
         fprintf(stderr, "Failed to initialize GLEW\n");
         getchar();
@@ -186,6 +187,9 @@ void Window::changeResizeFlag(unsigned flag){
 void Window::drawGrid(int stepSize){
     // give stepSize in px
 
+    // The fixed function pipeline draws without a program
+    GLState::useProgram(0);
+
     // Start Drawing lines
     glBegin(GL_LINES);
     // set line colours
@@ -242,6 +246,7 @@ void Window::drawFilledCircle(vec2d &pos, GLdouble &r, int num_segments, std::ar
     GLdouble y = 0;
 
     //// start drawing
+    GLState::useProgram(0);     // Fixed function pipeline, no program
     // Start a surface (triangle fan) (Triangle n is drawn with points n+1, n+2 and 1)
     glBegin(GL_TRIANGLE_FAN);
     // Set colour of the triangle fan.
@@ -312,11 +317,624 @@ void Window::drawObjectList(std::vector<Object*> &objects, CircleShader* circleS
         }
     }
 }
+// Draws objects from the bound universe with the instanced shader
+void Window::drawObjectList(InstancedCircleShader* circleShader) {
+    if(this->boundUniverse==NULL){
+        std::cerr << "[WARN]: could not drawobjectlist, bound universe is missing (NULL)" << std::endl;
+    }else {
+        this->drawObjectList(this->boundUniverse->objects, circleShader);
+    }
+}
+
+void Window::drawObjectList(std::vector<Object*> &objects, InstancedCircleShader* circleShader){
+    // Without a shader use the drawFilledCircle version
+    if(circleShader == NULL){
+        this->drawObjectList(objects, (CircleShader*)NULL);
+        return;
+    }
+    // One matrix for all objects: scale from universe to [-1, 1], the positions and radii stay in universe units
+    circleShader->transformationMatrix = {
+            pixRatio * 2.0 / winWidth, 0, 0,
+            0, pixRatio * 2.0 / winHeight, 0,
+            0, 0, 1
+    };
+    if(trails && trailShader != NULL){
+        // Under the objects, with the same matrix
+        trailShader->transformationMatrix = circleShader->transformationMatrix;
+        trailShader->record(objects);
+        trailShader->draw();
+    }
+    if(visualMode == vis::DRAW_DENSITY && densityShader != NULL){
+        accumulateDensity(objects);
+        densityShader->draw();
+        return;
+    }
+    // Only what is in view, objects below a pixel become points
+    circleShader->clear();
+    circleShader->addObjects(objectsInView(objects), pixRatio);
+    circleShader->draw();
+}
+void Window::queueObjectList(InstancedCircleShader* circleShader, unsigned layer){
+    if(boundUniverse == NULL){
+        std::cerr << "[WARN]: could not queue objectlist, bound universe is missing (NULL)" << std::endl;
+        return;
+    }
+    // Without a shader draw right away with the drawFilledCircle version
+    if(circleShader == NULL){
+        drawObjectList(boundUniverse->objects, (CircleShader*)NULL);
+        return;
+    }
+    // Same matrix as drawObjectList, the circles are drawn when the queue is submitted
+    circleShader->transformationMatrix = {
+            pixRatio * 2.0 / winWidth, 0, 0,
+            0, pixRatio * 2.0 / winHeight, 0,
+            0, 0, 1
+    };
+    if(visualMode == vis::DRAW_DENSITY && densityShader != NULL){
+        accumulateDensity(boundUniverse->objects);
+        renderQueue.add(densityShader, layer);
+        return;
+    }
+    circleShader->clear();
+    circleShader->addObjects(objectsInView(boundUniverse->objects), pixRatio);
+    renderQueue.add(circleShader, layer);
+}
+void Window::queueTrails(unsigned layer){
+    if(!trails || trailShader == NULL || boundUniverse == NULL) return;
+    // Same matrix as the objects
+    trailShader->transformationMatrix = {
+            pixRatio * 2.0 / winWidth, 0, 0,
+            0, pixRatio * 2.0 / winHeight, 0,
+            0, 0, 1
+    };
+    trailShader->record(boundUniverse->objects);
+    renderQueue.add(trailShader, layer);
+}
+void Window::toggleTrails(){
+    if(trailShader == NULL){
+        std::cerr << "[WARN]: no trail shader is set for the window, trails stay off" << std::endl;
+        return;
+    }
+    trails = !trails;
+    if(trails){
+        trailShader->clear();   // The history is old, start new trails
+    }
+}
+void Window::toggleCapture(){
+    if(capture == NULL){
+        std::cerr << "[WARN]: no frame capture is set for the window, nothing is recorded" << std::endl;
+        return;
+    }
+    if(capture->is_recording()){
+        capture->stop();
+    }else{
+        // One sequence per start, named after the time it started
+        std::stringstream prefix;
+        prefix << "capture_" << std::time(NULL) << "_";
+        capture->start(prefix.str());
+    }
+}
+void Window::screenshot(){
+    if(capture == NULL){
+        std::cerr << "[WARN]: no frame capture is set for the window, no screenshot is taken" << std::endl;
+        return;
+    }
+    std::stringstream path;
+    path << "screenshot_" << std::time(NULL) << ".ppm";
+    capture->screenshot(path.str());
+}
+void Window::toggleGLStats(){
+    glStats = !glStats;
+    if(!glStats){
+        glfwSetWindowTitle(GLFWpointer, "Space Debris Evaders");
+    }
+}
+void Window::swapBuffers(){
+    if(capture != NULL){
+        // The framebuffer can have more pixels than the window (high DPI screens)
+        int width, height;
+        glfwGetFramebufferSize(GLFWpointer, &width, &height);
+        capture->frame(width, height);
+    }
+    GLState::endFrame();
+    if(glStats){
+        // Twice a second, setting the title every frame costs more than the frame itself on some systems
+        static std::chrono::steady_clock::time_point lastTitle;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if(now - lastTitle > std::chrono::milliseconds(500)){
+            lastTitle = now;
+            std::stringstream title;
+            title << "Space Debris Evaders - GL calls: " << GLState::frameCalls << ", skipped binds: " << GLState::frameSkipped;
+            glfwSetWindowTitle(GLFWpointer, title.str().c_str());
+        }
+    }
+    glfwSwapBuffers(GLFWpointer);
+}
+void Window::toggleVisualMode(){
+    if(visualMode == vis::DRAW_CIRCLES && densityShader == NULL){
+        std::cerr << "[WARN]: no density shader is set for the window, objects stay circles" << std::endl;
+        return;
+    }
+    visualMode = (visualMode == vis::DRAW_CIRCLES) ? vis::DRAW_DENSITY : vis::DRAW_CIRCLES;
+}
+void Window::accumulateDensity(std::vector<Object*> &objects){
+    // The grid covers the view around 0,0 with cells of cellPixels
+    vec2d halfView = {winWidth / (2.0 * pixRatio), winHeight / (2.0 * pixRatio)};
+    int cellPixels = std::max(1, densityShader->cellPixels);
+    densityShader->accumulate(objects, {-halfView[0], -halfView[1]}, halfView,
+                              (winWidth + cellPixels - 1) / cellPixels, (winHeight + cellPixels - 1) / cellPixels);
+}
+std::vector<Object*> &Window::objectsInView(std::vector<Object*> &objects){
+    // The window shows the universe around 0,0
+    vec2d halfView = {winWidth / (2.0 * pixRatio), winHeight / (2.0 * pixRatio)};
+    vec2d viewLower = {-halfView[0], -halfView[1]};
+
+    // About 16 cells over the width of the view, so a query visits a few hundred cells at most. The grid is rebuilt
+    // over all objects every frame, culling saves the uploads and draws of the hidden objects, not this O(N) pass.
+    viewGrid.build(objects, std::max(halfView[0], halfView[1]) / 8);
+    if(viewGrid.within(viewLower, halfView)){
+        return objects;     // Everything is visible, keep the order of the list
+    }
+    visibleObjects.clear();
+    viewGrid.query(viewLower, halfView, visibleObjects);
+    return visibleObjects;
+}
+
+/*
+ * Density section
+ */
+DensityShader::DensityShader(int cellPixels_) : Shader("shaders/density.glvs", "shaders/density.glfs", "inPosition"){ // Build the inherited class with the following constructor parameters
+    cellPixels = cellPixels_;
+    weighting = MASS;
+    columns = 0;
+    rows = 0;
+    displayMax = 0;
+    jobParts = 0;
+    jobPending = 0;
+    jobNumber = 0;
+    closing = false;
+    densityID = glGetUniformLocation(programID, "density");    // Get the location of the density sampler in the GLSL program
+
+    glGenTextures(1, &texture);
+    GLState::bindTexture(0, texture);
+    // Linear filtering smooths the low resolution grid
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+DensityShader::~DensityShader(){
+    {
+        std::lock_guard<std::mutex> lock(workMutex);
+        closing = true;
+    }
+    workReady.notify_all();
+    for(size_t tt = 0; tt < workers.size(); tt++){
+        workers[tt].join();
+    }
+    glDeleteTextures(1, &texture);  // Remove the texture reservation
+    GLState::invalidate();
+}
+void DensityShader::workerLoop(unsigned part){
+    std::unique_lock<std::mutex> lock(workMutex);
+    unsigned long long seen = 0;
+    while(true){
+        workReady.wait(lock, [&]() { return closing || jobNumber != seen; });
+        if(closing) break;
+        seen = jobNumber;
+        if(part >= jobParts) continue;  // Fewer parts than workers this frame
+
+        lock.unlock();
+        job(part);
+        lock.lock();
+        if(--jobPending == 0) workDone.notify_one();
+    }
+}
+// Run function(0) .. function(parts - 1), part 0 on the calling thread, and return when all are done
+void DensityShader::runParallel(unsigned parts, std::function<void(unsigned)> function){
+    while(workers.size() + 1 < parts){
+        workers.push_back(std::thread(&DensityShader::workerLoop, this, (unsigned)workers.size() + 1));
+    }
+    {
+        std::lock_guard<std::mutex> lock(workMutex);
+        job = function;
+        jobParts = parts;
+        jobPending = parts - 1;
+        jobNumber++;
+    }
+    workReady.notify_all();
+    function(0);    // The calling thread does a part as well
+    std::unique_lock<std::mutex> lock(workMutex);
+    workDone.wait(lock, [this]() { return jobPending == 0; });
+}
+GLuint DensityShader::sortTexture(){
+    return texture;
+}
+void DensityShader::accumulate(std::vector<Object*> &objects, vec2d lower, vec2d upper, int columns_, int rows_){
+    columns_ = std::max(1, columns_);
+    rows_ = std::max(1, rows_);
+    size_t cells = (size_t)columns_ * rows_;
+    double xScale = columns_ / (upper[0] - lower[0]);
+    double yScale = rows_ / (upper[1] - lower[1]);
+
+    // Every thread splats a contiguous part of the objects into its own grid, so no locking is needed
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = (unsigned)std::min<size_t>(threads, objects.size() / OBJECTS_PER_THREAD + 1);
+    partial.resize(threads);
+    for(unsigned tt = 0; tt < threads; tt++){
+        partial[tt].assign(cells, 0.0f);
+    }
+    const unsigned mode = weighting;
+    auto splat = [&](unsigned tt){
+        size_t first = objects.size() * tt / threads;
+        size_t last = objects.size() * (tt + 1) / threads;
+        float* cellWeights = partial[tt].data();
+        for(size_t ii = first; ii < last; ii++){
+            const Object* obj = objects[ii];
+            double x = (obj->position[0] - lower[0]) * xScale;
+            double y = (obj->position[1] - lower[1]) * yScale;
+            if(x < 0 || y < 0 || x >= columns_ || y >= rows_) continue;    // Outside the view
+            cellWeights[(size_t)y * columns_ + (size_t)x] += (mode == MASS) ? (float)obj->mass : 1.0f;
+        }
+    };
+    if(threads > 1){
+        runParallel(threads, splat);
+    }else{
+        splat(0);   // Not worth waking the workers
+    }
+
+    // Add the grids up, and find the densest and the average occupied cell for the tone mapping
+    grid.swap(partial[0]);
+    float frameMax = 0;
+    double occupiedSum = 0;
+    size_t occupied = 0;
+    for(size_t cc = 0; cc < cells; cc++){
+        float weight = grid[cc];
+        for(unsigned tt = 1; tt < threads; tt++){
+            weight += partial[tt][cc];
+        }
+        grid[cc] = weight;
+        if(weight > 0){
+            frameMax = std::max(frameMax, weight);
+            occupiedSum += weight;
+            occupied++;
+        }
+    }
+    displayMax = std::max(frameMax, 0.95f * displayMax);
+
+    // Log scale relative to the average occupied cell, so single objects are visible next to dense clusters
+    image.resize(cells);
+    float unit = occupied ? (float)(occupiedSum / occupied) : 1.0f;
+    float normalise = 1.0f / std::log(1.0f + std::max(displayMax, unit) / unit);
+    for(size_t cc = 0; cc < cells; cc++){
+        float value = grid[cc] > 0 ? std::log(1.0f + grid[cc] / unit) * normalise : 0.0f;
+        image[cc] = (unsigned char)(std::min(1.0f, value) * 255.0f + 0.5f);
+    }
+
+    // Upload, the texture is only reallocated when the grid changes size
+    GLState::bindTexture(0, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // Rows are not a multiple of 4 bytes
+    if(columns_ != columns || rows_ != rows){
+        columns = columns_;
+        rows = rows_;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, columns, rows, 0, GL_RED, GL_UNSIGNED_BYTE, image.data());
+    }else{
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, columns, rows, GL_RED, GL_UNSIGNED_BYTE, image.data());
+    }
+    GLState::count(2);
+}
+void DensityShader::draw(){
+    render(command());  // Draw right away
+}
+void DensityShader::render(const RenderCommand &){   // No per-draw state, the grid is drawn as accumulated
+    if(columns == 0) return;    // Nothing accumulated yet
+
+    GLState::useProgram(programID);    // Activate the GLSL program
+    GLState::bindTexture(0, texture);
+    glUniform1i(densityID, 0);  // Sample the grid from texture unit 0
+    bindAttributes();   // The window filling quad of Shader
+
+    glDrawArrays(GL_TRIANGLE_FAN, 0, vertexCount);
+    GLState::count(2);
+}
+
+/*
+ * Trails section
+ */
+TrailShader::TrailShader(unsigned frames_) : Shader("shaders/trail.glvs", "shaders/trail.glfs", "inAge", "projection"){ // Build the inherited class with the following constructor parameters
+    historyID = glGetUniformLocation(programID, "history");    // Get the uniform locations in the GLSL program
+    headID = glGetUniformLocation(programID, "head");
+    frameID = glGetUniformLocation(programID, "frame");
+    ringLayoutID = glGetUniformLocation(programID, "ringLayout");
+    slotID = glGetAttribLocation(programID, "inSlot");         // Get the per-instance attribute locations
+    birthID = glGetAttribLocation(programID, "inBirth");
+    colourID = glGetAttribLocation(programID, "inColour");
+
+    // The vertex shader reads float positions from a texture, and one instance is drawn per trail
+    supported = (GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays) && (GLEW_VERSION_3_0 || (GLEW_ARB_texture_float && GLEW_ARB_texture_rg));
+    if(!supported){
+        std::cerr << "[WARN]: instanced arrays or float textures are not supported, trails are not drawn" << std::endl;
+    }
+
+    frames = std::max(2u, frames_);
+    capacity = 0;
+    columns = 0;
+    rowsPerFrame = 0;
+    head = 0;
+    frameCounter = 0;
+    nextSlot = 0;
+    instancesChanged = false;
+    history = 0;
+
+    // The age of every vertex of a strip, newest first
+    std::vector<GLfloat> ages(frames);
+    for(unsigned ii = 0; ii < frames; ii++) ages[ii] = ii;
+    vertexCount = frames;
+    GLState::bindArrayBuffer(vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*frames, ages.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &instanceBuffer);
+    buildVertexArray();     // Record the age and instance attribute layout
+}
+TrailShader::~TrailShader(){
+    glDeleteBuffers(1, &instanceBuffer);    // Remove the buffer and texture reservations
+    if(history) glDeleteTextures(1, &history);
+    GLState::invalidate();
+}
+void TrailShader::setupAttributes(){
+    unsigned long perInstance = GLState::attribute(slotID) | GLState::attribute(birthID) | GLState::attribute(colourID);
+    GLState::enableAttributes(GLState::attribute(vertexPositionID) | perInstance, perInstance);
+
+    GLState::bindArrayBuffer(vertexBuffer);    // The ages
+    glVertexAttribPointer(vertexPositionID, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+    GLState::bindArrayBuffer(instanceBuffer);  // Interleaved slot, birth and colour
+    GLsizei stride = sizeof(GLfloat)*FLOATS_PER_INSTANCE;
+    glVertexAttribPointer(slotID, 1, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glVertexAttribPointer(birthID, 1, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat)));
+    glVertexAttribPointer(colourID, 4, GL_FLOAT, GL_FALSE, stride, (void*)(2*sizeof(GLfloat)));
+    GLState::count(4);
+}
+void TrailShader::allocate(unsigned capacity_){
+    // Frames are blocks of whole rows, rows are at most MAX_COLUMNS wide
+    capacity = capacity_;
+    columns = std::min(capacity, MAX_COLUMNS);
+    rowsPerFrame = (capacity + columns - 1)/columns;
+    capacity = columns*rowsPerFrame;
+
+    if(history == 0) glGenTextures(1, &history);
+    GLState::bindTexture(0, history);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, columns, rowsPerFrame*frames, 0, GL_RG, GL_FLOAT, NULL);
+    // Exact texels, no filtering between objects or frames
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    GLState::count(5);
+
+    // The old history is gone, every trail starts again at the frame being recorded
+    block.resize(2*capacity, 0.0f);
+    seen.resize(capacity, 0);
+    births.assign(capacity, frameCounter);
+    instancesChanged = true;
+}
+void TrailShader::clear(){
+    slots.clear();
+    freeSlots.clear();
+    nextSlot = 0;
+    instances.clear();
+    instancesChanged = true;
+    frameCounter = 0;
+    std::fill(seen.begin(), seen.end(), 0);
+}
+void TrailShader::record(std::vector<Object*> &objects){
+    if(!supported) return;
+    frameCounter++;
+    head = (head + 1) % frames;
+
+    // Write the positions of the objects that have a slot, remember the others
+    added.clear();
+    for(size_t ii = 0; ii < objects.size(); ii++){
+        std::unordered_map<Object*, unsigned>::iterator found = slots.find(objects[ii]);
+        if(found == slots.end()){
+            added.push_back(objects[ii]);
+            continue;
+        }
+        unsigned slot = found->second;
+        seen[slot] = frameCounter;
+        block[2*slot] = objects[ii]->position[0];
+        block[2*slot + 1] = objects[ii]->position[1];
+    }
+
+    // Objects that left the list free their slot
+    if(slots.size() > objects.size() - added.size()){
+        for(std::unordered_map<Object*, unsigned>::iterator it = slots.begin(); it != slots.end();){
+            if(seen[it->second] != frameCounter){
+                freeSlots.push_back(it->second);
+                it = slots.erase(it);
+            }else{
+                it++;
+            }
+        }
+        instancesChanged = true;
+    }
+
+    // New objects get a free slot, the texture grows when there are not enough
+    if(added.size()){
+        unsigned needed = nextSlot + (unsigned)std::max(0, (int)added.size() - (int)freeSlots.size());
+        if(needed > capacity){
+            allocate(std::max(needed, 2*capacity));
+        }
+        for(size_t ii = 0; ii < added.size(); ii++){
+            unsigned slot;
+            if(freeSlots.size()){
+                slot = freeSlots.back();
+                freeSlots.pop_back();
+            }else{
+                slot = nextSlot++;
+            }
+            slots[added[ii]] = slot;
+            seen[slot] = frameCounter;
+            births[slot] = frameCounter;   // Older frames of this slot belong to another object
+            block[2*slot] = added[ii]->position[0];
+            block[2*slot + 1] = added[ii]->position[1];
+        }
+        instancesChanged = true;
+    }
+    if(capacity == 0) return;
+
+    // One upload of this frame's block
+    GLState::bindTexture(0, history);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, head*rowsPerFrame, columns, rowsPerFrame, GL_RG, GL_FLOAT, block.data());
+    GLState::count(2);
+
+    if(instancesChanged){
+        // Only when objects come or go, the colour is the one of that moment
+        instances.clear();
+        for(std::unordered_map<Object*, unsigned>::iterator it = slots.begin(); it != slots.end(); it++){
+            const std::array<double, 4> &colour = it->first->colour;
+            GLfloat instance[FLOATS_PER_INSTANCE] = {
+                    (GLfloat)it->second, (GLfloat)births[it->second],
+                    (GLfloat)colour[0], (GLfloat)colour[1], (GLfloat)colour[2], (GLfloat)colour[3]
+            };
+            instances.insert(instances.end(), instance, instance + FLOATS_PER_INSTANCE);
+        }
+        GLState::bindArrayBuffer(instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*instances.size(), instances.data(), GL_DYNAMIC_DRAW);
+        GLState::count();
+        instancesChanged = false;
+    }
+}
+void TrailShader::draw(){
+    render(command());  // Draw right away, with the current state
+}
+void TrailShader::render(const RenderCommand &command){
+    unsigned count = instances.size()/FLOATS_PER_INSTANCE;
+    if(!supported || count == 0 || frameCounter < 2) return;
+
+    GLState::useProgram(programID);    // Activate the GLSL program
+    glUniformMatrix3fv(tMatrixID, 1, GL_FALSE, &command.matrix[0][0]);    // pass the transformation matrix to the program
+    glUniform1f(headID, head);
+    glUniform1f(frameID, frameCounter);
+    glUniform4f(ringLayoutID, frames, columns, rowsPerFrame, rowsPerFrame*frames);
+    GLState::bindTexture(0, history);
+    glUniform1i(historyID, 0);  // Read the history from texture unit 0
+    GLState::count(5);
+
+    bindAttributes();
+    glDrawArraysInstanced(GL_LINE_STRIP, 0, frames, count);     // All trails at once
+    GLState::count();
+}
+
+/*
+ * Object grid section
+ */
+ObjectGrid::ObjectGrid(){
+    cellSize = 1;
+    lower = {0, 0};
+    upper = {0, 0};
+    maxRadius = 0;
+    columns = 0;
+    rows = 0;
+    source = NULL;
+}
+void ObjectGrid::build(std::vector<Object*> &objects, double cellSize_){
+    source = &objects;
+    entries.clear();
+    cellStart.assign(1, 0);
+    columns = rows = 0;
+    maxRadius = 0;
+
+    // Bounding box of the centres. Objects with a non-finite position or radius (diverged ones) are left out of the
+    // grid, they are never found by query().
+    size_t usable = 0;
+    for(size_t ii = 0; ii < objects.size(); ii++){
+        const vec2d &position = objects[ii]->position;
+        if(!std::isfinite(position[0]) || !std::isfinite(position[1]) || !std::isfinite(objects[ii]->radius)) continue;
+        if(usable++ == 0){
+            lower = upper = position;
+        }
+        lower[0] = std::min(lower[0], position[0]);
+        lower[1] = std::min(lower[1], position[1]);
+        upper[0] = std::max(upper[0], position[0]);
+        upper[1] = std::max(upper[1], position[1]);
+        maxRadius = std::max(maxRadius, objects[ii]->radius);
+    }
+    if(usable == 0) return;
+
+    // Grow the cells until there are few enough of them. Counted in doubles, a single far away object can make the
+    // box too large for an int; half the box is taken so the width itself cannot overflow either.
+    double halfWidth = upper[0] / 2 - lower[0] / 2;
+    double halfHeight = upper[1] / 2 - lower[1] / 2;
+    cellSize = cellSize_ > 0 ? cellSize_ : 1;
+    while((std::floor(halfWidth / cellSize * 2) + 1) * (std::floor(halfHeight / cellSize * 2) + 1) > MAX_CELLS){
+        cellSize *= 2;
+    }
+    columns = (int)std::floor(halfWidth / cellSize * 2) + 1;
+    rows = (int)std::floor(halfHeight / cellSize * 2) + 1;
+
+    // Counting sort of the objects on their cell
+    const unsigned NO_CELL = ~0u;
+    cellStart.assign(columns*rows + 1, 0);
+    cellOf.resize(objects.size());
+    for(size_t ii = 0; ii < objects.size(); ii++){
+        const vec2d &position = objects[ii]->position;
+        if(!std::isfinite(position[0]) || !std::isfinite(position[1]) || !std::isfinite(objects[ii]->radius)){
+            cellOf[ii] = NO_CELL;
+            continue;
+        }
+        int column = std::min(columns - 1, (int)((position[0] / 2 - lower[0] / 2) / cellSize * 2));
+        int row = std::min(rows - 1, (int)((position[1] / 2 - lower[1] / 2) / cellSize * 2));
+        cellOf[ii] = row*columns + column;
+        cellStart[cellOf[ii] + 1]++;
+    }
+    for(int cc = 0; cc < columns*rows; cc++){
+        cellStart[cc + 1] += cellStart[cc];
+    }
+    entries.resize(usable);
+    std::vector<unsigned> fill(cellStart.begin(), cellStart.end() - 1);
+    for(size_t ii = 0; ii < objects.size(); ii++){
+        if(cellOf[ii] != NO_CELL){
+            entries[fill[cellOf[ii]]++] = objects[ii];
+        }
+    }
+}
+bool ObjectGrid::within(vec2d rectLower, vec2d rectUpper){
+    return entries.empty() ||
+           (lower[0] - maxRadius >= rectLower[0] && lower[1] - maxRadius >= rectLower[1] &&
+            upper[0] + maxRadius <= rectUpper[0] && upper[1] + maxRadius <= rectUpper[1]);
+}
+void ObjectGrid::query(vec2d rectLower, vec2d rectUpper, std::vector<Object*> &found){
+    if(entries.empty()) return;
+
+    // Cells whose objects can reach into the rectangle (clamped on both sides as doubles, the rectangle can be far
+    // outside the grid)
+    int firstColumn = (int)std::max(0.0, std::min((double)columns, std::floor((rectLower[0] - maxRadius - lower[0]) / cellSize)));
+    int lastColumn = (int)std::min(columns - 1.0, std::max(-1.0, std::floor((rectUpper[0] + maxRadius - lower[0]) / cellSize)));
+    int firstRow = (int)std::max(0.0, std::min((double)rows, std::floor((rectLower[1] - maxRadius - lower[1]) / cellSize)));
+    int lastRow = (int)std::min(rows - 1.0, std::max(-1.0, std::floor((rectUpper[1] + maxRadius - lower[1]) / cellSize)));
+    if(firstColumn > lastColumn || firstRow > lastRow) return;
+
+    for(int row = firstRow; row <= lastRow; row++){
+        // The cells of a row are next to each other in entries
+        for(unsigned ee = cellStart[row*columns + firstColumn]; ee < cellStart[row*columns + lastColumn + 1]; ee++){
+            // The bounding box of the circle has to overlap the rectangle
+            Object* obj = entries[ee];
+            double radius = obj->radius;
+            if(obj->position[0] + radius >= rectLower[0] && obj->position[0] - radius <= rectUpper[0] &&
+               obj->position[1] + radius >= rectLower[1] && obj->position[1] - radius <= rectUpper[1]){
+                found.push_back(obj);
+            }
+        }
+    }
+}
 /*
  * Draws a redbox to the middle of the screen.
  * Uses Universe scale!!!
  */
 void Window::drawBox(double Width, double Height){
+    GLState::useProgram(0);     // Fixed function pipeline, no program
 
     glBegin(GL_LINE_LOOP);
     glColor4d(1.0,0,0,1.0);
@@ -360,6 +978,8 @@ void Window::window_size_callback(int width, int height){
     }
     // Resize 'drawing canvas' to screen size
     glViewport(0,0, width, height);
+    // Cached text layouts depend on the screen size
+    TextShader::windowGeneration++;
 }
 void Window::cursor_position_callback(double xpos, double ypos){
     // Store the cursor position in normalized coordinates (-1 to 1)
@@ -371,6 +991,268 @@ vec2d Window::cursorPosition(){
     return cursorPos;
 }
 
+/*
+ * Streaming buffer section
+ */
+StreamBuffer::StreamBuffer(GLsizeiptr sectionSize_){
+    // Persistent mapping needs buffer storage (GL 4.4) and fences (GL 3.2)
+    persistent = (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) && (GLEW_VERSION_3_2 || GLEW_ARB_sync);
+    buffer = 0;
+    mapping = NULL;
+    for(unsigned ii = 0; ii < SECTIONS; ii++) fences[ii] = 0;
+    allocate(sectionSize_);
+}
+StreamBuffer::~StreamBuffer(){
+    for(unsigned ii = 0; ii < SECTIONS; ii++){
+        if(fences[ii]) glDeleteSync(fences[ii]);    // Remove the fences that are left
+    }
+    if(mapping != NULL){
+        GLState::bindArrayBuffer(buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);             // Release the persistent mapping
+    }
+    glDeleteBuffers(1, &buffer);                    // Free the buffer
+    GLState::invalidate();                          // The buffer name can be reused for a new buffer
+}
+void StreamBuffer::allocate(GLsizeiptr newSectionSize){
+    // The old storage can only be deleted when the GPU does not use it anymore
+    for(unsigned ii = 0; ii < SECTIONS; ii++){
+        if(fences[ii]){
+            glClientWaitSync(fences[ii], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1E9));
+            glDeleteSync(fences[ii]);
+            fences[ii] = 0;
+        }
+    }
+    if(buffer){
+        if(mapping != NULL){
+            GLState::bindArrayBuffer(buffer);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+        glDeleteBuffers(1, &buffer);
+        GLState::invalidate();
+    }
+
+    // Round the sections up to the alignment, so every section starts aligned
+    sectionSize = (newSectionSize + ALIGNMENT - 1)/ALIGNMENT*ALIGNMENT;
+    section = 0;
+    offset = 0;
+    mapping = NULL;
+
+    glGenBuffers(1, &buffer);
+    GLState::bindArrayBuffer(buffer);
+    if(persistent){
+        // Immutable storage that stays mapped, coherent so writes need no explicit flush
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, sectionSize*SECTIONS, NULL, flags);
+        mapping = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, sectionSize*SECTIONS, flags);
+        if(mapping == NULL){
+            std::cerr << "[WARN]: could not map the stream buffer persistently, using buffer orphaning instead" << std::endl;
+            persistent = false;
+            glDeleteBuffers(1, &buffer);
+            GLState::invalidate();
+            glGenBuffers(1, &buffer);
+            GLState::bindArrayBuffer(buffer);
+        }
+    }
+    if(!persistent){
+        glBufferData(GL_ARRAY_BUFFER, sectionSize*SECTIONS, NULL, GL_STREAM_DRAW);
+    }
+}
+void StreamBuffer::nextSection(){
+    if(persistent){
+        // Everything drawn from the current section so far has been issued, fence it
+        if(fences[section]) glDeleteSync(fences[section]);
+        fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    section = (section + 1) % SECTIONS;
+    offset = 0;
+
+    if(persistent){
+        // Wait until the GPU is done with the next section. With three sections this normally returns immediately.
+        if(fences[section]){
+            while(glClientWaitSync(fences[section], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1E6)) == GL_TIMEOUT_EXPIRED){}
+            glDeleteSync(fences[section]);
+            fences[section] = 0;
+        }
+    }else if(section == 0){
+        // Orphan the whole ring when it wraps around, the driver keeps the old storage alive for pending draws
+        GLState::bindArrayBuffer(buffer);
+        glBufferData(GL_ARRAY_BUFFER, sectionSize*SECTIONS, NULL, GL_STREAM_DRAW);
+    }
+}
+GLintptr StreamBuffer::write(const void* data, GLsizeiptr size){
+    if(size > sectionSize){
+        allocate(size*2);           // Grow, with room for a few more writes of this size
+    }else if(offset + size > sectionSize){
+        nextSection();              // Does not fit anymore, continue in the next section
+    }
+
+    GLintptr start = section*sectionSize + offset;
+    if(persistent){
+        std::memcpy(mapping + start, data, size);
+    }else{
+        GLState::bindArrayBuffer(buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, start, size, data);
+    }
+    offset += (size + ALIGNMENT - 1)/ALIGNMENT*ALIGNMENT;
+    return start;
+}
+GLuint StreamBuffer::id(){
+    return buffer;
+}
+
+/*
+ * GL state cache section
+ */
+// Everything starts unknown, the first binds are always issued
+GLuint GLState::program = GLState::UNKNOWN;
+GLuint GLState::arrayBuffer = GLState::UNKNOWN;
+GLuint GLState::vertexArray = GLState::UNKNOWN;
+unsigned GLState::activeUnit = GLState::UNKNOWN;
+GLuint GLState::textures[GLState::TEXTURE_UNITS] = {GLState::UNKNOWN, GLState::UNKNOWN, GLState::UNKNOWN, GLState::UNKNOWN,
+                                                    GLState::UNKNOWN, GLState::UNKNOWN, GLState::UNKNOWN, GLState::UNKNOWN};
+unsigned long GLState::enabled = 0;
+unsigned long GLState::instanced = 0;
+bool GLState::attributesKnown = false;
+unsigned long GLState::calls = 0;
+unsigned long GLState::skipped = 0;
+unsigned long GLState::frameCalls = 0;
+unsigned long GLState::frameSkipped = 0;
+
+void GLState::useProgram(GLuint program_){
+    if(program == program_){
+        skipped++;
+        return;
+    }
+    glUseProgram(program_);
+    program = program_;
+    calls++;
+}
+void GLState::bindArrayBuffer(GLuint buffer){
+    if(arrayBuffer == buffer){
+        skipped++;
+        return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    arrayBuffer = buffer;
+    calls++;
+}
+void GLState::bindVertexArray(GLuint array){
+    if(vertexArray == array){
+        skipped++;
+        return;
+    }
+    glBindVertexArray(array);
+    vertexArray = array;
+    calls++;
+}
+void GLState::bindTexture(unsigned unit, GLuint texture){
+    if(unit < TEXTURE_UNITS && textures[unit] == texture){
+        skipped++;
+        return;
+    }
+    if(activeUnit != unit){
+        glActiveTexture(GL_TEXTURE0 + unit);
+        activeUnit = unit;
+        calls++;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if(unit < TEXTURE_UNITS) textures[unit] = texture;
+    calls++;
+}
+void GLState::enableAttributes(unsigned long mask, unsigned long instancedMask){
+    if(vertexArray != 0 && vertexArray != UNKNOWN){
+        // Recording the layout of a vertex array object, the state is kept in the object instead of here
+        for(unsigned ii = 0; mask >> ii; ii++){
+            unsigned long bit = 1ul << ii;
+            if(mask & bit){
+                glEnableVertexAttribArray(ii);
+                if(instancedMask & bit) glVertexAttribDivisor(ii, 1);
+            }
+        }
+        return;
+    }
+    // Only the arrays that change are switched. After invalidate() the arrays of mask are enabled again: other code
+    // disables the arrays it enabled itself, but may have disabled ours.
+    unsigned long change = attributesKnown ? (enabled ^ mask) : (enabled | mask);
+    unsigned long divisors = instanced ^ instancedMask;
+    for(unsigned ii = 0; (change | divisors | mask) >> ii; ii++){
+        unsigned long bit = 1ul << ii;
+        if(change & bit){
+            if(mask & bit) glEnableVertexAttribArray(ii);
+            else glDisableVertexAttribArray(ii);
+            calls++;
+        }else if(mask & bit){
+            skipped++;
+        }
+        if(divisors & bit){
+            glVertexAttribDivisor(ii, (instancedMask & bit) ? 1 : 0);
+            calls++;
+        }
+    }
+    enabled = mask;
+    instanced = instancedMask;
+    attributesKnown = true;
+}
+bool GLState::vertexArrays(){
+    return GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object;
+}
+unsigned long GLState::attribute(GLuint location){
+    // glGetAttribLocation gives -1 for attributes that are not in the program
+    return location < 8*sizeof(unsigned long) ? 1ul << location : 0;
+}
+void GLState::count(unsigned long glCalls){
+    calls += glCalls;
+}
+void GLState::invalidate(){
+    program = UNKNOWN;
+    arrayBuffer = UNKNOWN;
+    vertexArray = UNKNOWN;
+    activeUnit = UNKNOWN;
+    for(unsigned ii = 0; ii < TEXTURE_UNITS; ii++) textures[ii] = UNKNOWN;
+    attributesKnown = false;
+}
+void GLState::endFrame(){
+    frameCalls = calls;
+    frameSkipped = skipped;
+    calls = 0;
+    skipped = 0;
+}
+
+/*
+ * Render queue section
+ */
+uint64_t RenderQueue::sortKey(unsigned layer, GLuint program, GLuint texture, GLuint buffer){
+    // 8 bits of layer, 16 bits of every object name (names are small numbers, handed out from 1)
+    return (uint64_t)(layer & 0xFF) << 56 | (uint64_t)(program & 0xFFFF) << 40 |
+           (uint64_t)(texture & 0xFFFF) << 24 | (uint64_t)(buffer & 0xFFFF) << 8;
+}
+void RenderQueue::add(Shader* shader, unsigned layer, unsigned part){
+    commands.push_back(shader->command(layer, part));
+}
+void RenderQueue::add(const RenderCommand &command){
+    commands.push_back(command);
+}
+size_t RenderQueue::size(){
+    return commands.size();
+}
+// Compares commands on their key only, for stable_sort
+static bool renderCommandBefore(const RenderCommand &a, const RenderCommand &b){
+    return a.key < b.key;
+}
+void RenderQueue::submit(){
+    // Texture loaders and other code may have changed the bindings since the last frame
+    GLState::invalidate();
+
+    std::stable_sort(commands.begin(), commands.end(), renderCommandBefore);
+    for(size_t ii = 0; ii < commands.size(); ii++){
+        commands[ii].shader->render(commands[ii]);
+    }
+    commands.clear();
+}
+void RenderQueue::clear(){
+    commands.clear();
+}
+
 /*
  * Shaders section
  */
@@ -396,12 +1278,17 @@ Shader::Shader(const char *vertexShader, const char *fragmentShader, const char
     vertexCount = sizeof(vertices)/(sizeof(GLfloat)*2); // Store amount off vertices in buffer
 
     glGenBuffers(1, &vertexBuffer);                                             // Generate a buffer and store its location ID in vertexBuffer
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);                                // Make the vertex buffer active (current)
+    GLState::bindArrayBuffer(vertexBuffer);                                // Make the vertex buffer active (current)
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);  // Write the vertices to bufferdata vertexBuffer and set the access type of this buffer
+
+    vertexArray = 0;
+    buildVertexArray();     // Record the attribute layout once
 }
 Shader::~Shader(){
     glDeleteBuffers(1, &vertexBuffer);  // Free the vertexBuffer
+    if(vertexArray) glDeleteVertexArrays(1, &vertexArray);  // Free the attribute layout
     glDeleteProgram(programID);         // Delete the shader program
+    GLState::invalidate();              // Deleted names can be reused, forget the bindings
 }
 void Shader::tMatrixReset(){
     transformationMatrix = glm::mat3(1.0f); // Set transformation matrix to Identity matrix
@@ -431,16 +1318,12 @@ void Shader::tMatrixTranslate(vec2d position) {
 }
 void Shader::setNewVertices(GLuint arraySize, const GLfloat *vertexArray) {
     vertexCount = arraySize/2;  // Safe the vertex count
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);                                           // Make the buffer active
+    GLState::bindArrayBuffer(vertexBuffer);                                           // Make the buffer active
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*arraySize, vertexArray, GL_STATIC_DRAW); // Rewrite the buffer with new vertices
 }
-void Shader::draw(){
-    glUseProgram(programID);    // Activate the Shader Program as current shader
-
-    if(tMatrixOn) glUniformMatrix3fv(tMatrixID, 1, GL_FALSE, &transformationMatrix[0][0]);  // Pass the transformation matrix to GLSL program if available
-
-    glEnableVertexAttribArray(vertexPositionID);    // Enable the GLSL attribute vertice positions
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+void Shader::setupAttributes(){
+    GLState::enableAttributes(GLState::attribute(vertexPositionID));    // Enable the GLSL attribute vertice positions
+    GLState::bindArrayBuffer(vertexBuffer);
     glVertexAttribPointer(
             vertexPositionID,  // The vertex attribute
             2,                            // size
@@ -449,11 +1332,52 @@ void Shader::draw(){
             0,                            // stride
             (void*)0                      // array buffer offset (incase you have multiple attribute elements in one buffer) not used
     );
+    GLState::count();
+}
+void Shader::buildVertexArray(){
+    if(!GLState::vertexArrays()) return;    // The attributes are set up for every draw instead
+    if(vertexArray == 0) glGenVertexArrays(1, &vertexArray);
+    GLState::bindVertexArray(vertexArray);
+    setupAttributes();
+    GLState::bindVertexArray(0);            // Keep attribute calls of other code out of the layout
+}
+void Shader::bindAttributes(){
+    if(vertexArray){
+        GLState::bindVertexArray(vertexArray);
+    }else{
+        setupAttributes();
+    }
+}
+GLuint Shader::sortTexture(){
+    return 0;   // The base shader has no texture
+}
+void Shader::capture(RenderCommand &command){
+    command.matrix = transformationMatrix;
+}
+RenderCommand Shader::command(unsigned layer, unsigned part){
+    RenderCommand newCommand;
+    newCommand.key = RenderQueue::sortKey(layer, programID, sortTexture(), vertexBuffer);
+    newCommand.shader = this;
+    newCommand.colour = glm::vec4(1.0f);
+    newCommand.part = part;
+    capture(newCommand);    // Let the shader add its own state
+    return newCommand;
+}
+void Shader::draw(){
+    render(command());  // Draw right away, with the current state
+}
+void Shader::render(const RenderCommand &command){
+    GLState::useProgram(programID);    // Activate the Shader Program as current shader
 
-    glDrawArrays(GL_TRIANGLE_FAN, 0,vertexCount);   // Draw the stored buffer
+    if(tMatrixOn){
+        glUniformMatrix3fv(tMatrixID, 1, GL_FALSE, &command.matrix[0][0]);  // Pass the transformation matrix to GLSL program if available
+        GLState::count();
+    }
 
-    glDisableVertexAttribArray(vertexPositionID);   // Disable the attribute
-    glUseProgram(0);                                // Reset program to none
+    bindAttributes();   // Bind the vertex positions
+
+    glDrawArrays(GL_TRIANGLE_FAN, 0,vertexCount);   // Draw the stored buffer
+    GLState::count();
 }
 
 TextureShader::TextureShader(GLuint texture_) : Shader("shaders/texture.glvs", "shaders/texture.glfs", "PositionVec", "MVP"){ // Build the inherited class with the following constructor parameters
@@ -469,9 +1393,13 @@ TextureShader::TextureShader(GLuint texture_) : Shader("shaders/texture.glvs", "
     };  // Store the UV buffer all most outer points from the texture matched to the UV points in Shader class
 
     glGenBuffers(1, &uvBuffer);                 // Generate a buffer for and store the location ID in uvBuffer
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);    // Make the buffer the current working buffer
+    GLState::bindArrayBuffer(uvBuffer);    // Make the buffer the current working buffer
     glBufferData(GL_ARRAY_BUFFER, sizeof(texcoords), texcoords, GL_STATIC_DRAW);    // Write the UV coordinates to the buffer
 
+    buildVertexArray();     // Add the UV coordinates to the attribute layout
+}
+void TextureShader::setTexture(GLuint texture_){
+    texture = texture_;
 }
 void TextureShader::setNewUVCoordinates(GLuint arraySize, const GLfloat *uvArray) {
     unsigned uvCount = arraySize/2;     // Amount of UV coordinates
@@ -489,35 +1417,27 @@ void TextureShader::setNewUVCoordinates(GLuint arraySize, const GLfloat *uvArray
             vertexCount = arraySize / 2;
         }
     } // Only print a warning if there is a mismatch between the UV and vertex coordinates, (drawing will not work correctly until the other the mismatch is Fixed!)
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);    // Make the buffer current (edit it)
+    GLState::bindArrayBuffer(uvBuffer);    // Make the buffer current (edit it)
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*vertexCount*2, uvArray, GL_STATIC_DRAW);  // Write the UV Array to the buffer
 }
 void TextureShader::setNewUVCoordinates(GLuint arraySize, const GLfloat *uvArray, const GLfloat *vertexArray){
     // Set both UV and vertex coordinates
     vertexCount = arraySize/2;  // update the vertexcount
 
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);    // Make UV buffer current
+    GLState::bindArrayBuffer(uvBuffer);    // Make UV buffer current
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*arraySize, uvArray, GL_STATIC_DRAW); // Write the UV array to the UV buffer
 
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);    // Make the vertex buffer current
+    GLState::bindArrayBuffer(vertexBuffer);    // Make the vertex buffer current
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*arraySize, vertexArray, GL_STATIC_DRAW);  // Write the vertex array to the vertexbuffer
 }
 TextureShader::~TextureShader(){
     glDeleteBuffers(1, &uvBuffer);      // Remove the buffer reservation
     glDeleteTextures(1, &textureID);    // Remove the texture reservation
 }
-void TextureShader::draw(unsigned texNum){
-    glUseProgram(programID);    // Activate the GLSL program
-    glUniformMatrix3fv(tMatrixID, 1, GL_FALSE, &transformationMatrix[0][0]);    // pass the trasnformation matrix to the program
-
-    // Bind our texture in Texture Unit 0
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    glUniform1i(textureID, 0);  // Give the texture sampler (from the GLSL program) the location  to sample: Texture unit 0
-
-    glEnableVertexAttribArray(vertexPositionID);    // Enable the GLSL vertex attribute
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);    // Make the vertex buffer current
+void TextureShader::setupAttributes(){
+    // Enable the GLSL vertex and UV attributes
+    GLState::enableAttributes(GLState::attribute(vertexPositionID) | GLState::attribute(vertexUVID));
+    GLState::bindArrayBuffer(vertexBuffer);    // Make the vertex buffer current
     // Bind the vertex position of the GLSL program to the vertex buffer.
     glVertexAttribPointer(
             vertexPositionID,  // The vertex attribute
@@ -528,8 +1448,7 @@ void TextureShader::draw(unsigned texNum){
             (void*)0                      // array buffer offset (incase you have multiple attribute elements in one buffer) not used
     );
 
-    glEnableVertexAttribArray(vertexUVID);      // Enable the GLSL UV attribute
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);    // make the UV buffer current
+    GLState::bindArrayBuffer(uvBuffer);    // make the UV buffer current
     // Bind the UV coordinates of the GLSL program to the uv Buffer
     glVertexAttribPointer(
             vertexUVID,                   // The UV attribute
@@ -539,12 +1458,145 @@ void TextureShader::draw(unsigned texNum){
             0,                            // stride
             (void*)0                      // array buffer offset (incase you have multiple attribute elements in one buffer) not used
     );
+    GLState::count(2);
+}
+GLuint TextureShader::sortTexture(){
+    return texture;
+}
+void TextureShader::draw(unsigned texNum){
+    render(command(0, texNum));     // Draw right away, with the current state
+}
+void TextureShader::render(const RenderCommand &command){
+    GLState::useProgram(programID);    // Activate the GLSL program
+    glUniformMatrix3fv(tMatrixID, 1, GL_FALSE, &command.matrix[0][0]);    // pass the trasnformation matrix to the program
 
-    glDrawArrays(GL_TRIANGLE_FAN, texNum*4,4); // Draw a part of the texture (part number texNum)
+    // Bind our texture in Texture Unit 0
+    GLState::bindTexture(0, texture);
+
+    glUniform1i(textureID, 0);  // Give the texture sampler (from the GLSL program) the location  to sample: Texture unit 0
+    GLState::count(2);
+
+    bindAttributes();   // Bind the vertex positions and UV coordinates
+
+    glDrawArrays(GL_TRIANGLE_FAN, command.part*4,4); // Draw a part of the texture (part number texNum)
+    GLState::count();
+}
 
-    glDisableVertexAttribArray(vertexPositionID);   // Disable the vertex position in the program
-    glDisableVertexAttribArray(vertexUVID);         // Disable the UV coordinates in the program
-    glUseProgram(0);    // Disable the Program and set it the used program to none
+int SpriteAtlas::find(std::string name) const{
+    std::map<std::string, unsigned>::const_iterator it = names.find(name);
+    if(it == names.end()){
+        std::cerr << "[WARN]: The sprite atlas has no sprite " << name << std::endl;
+        return -1;
+    }
+    return it->second;
+}
+
+bool readSpriteAtlas(const char* tablePath, SpriteAtlas &atlas){
+    std::ifstream table(tablePath);
+    if(!table){
+        std::cerr << "[WARN]: Could not open sprite atlas " << tablePath << std::endl;
+        return false;
+    }
+    atlas = SpriteAtlas();
+    std::string line;
+    for(unsigned lineNumber = 1; std::getline(table, line); lineNumber++){
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string keyword, name;
+        if(!(words >> keyword)){
+            continue;
+        }
+        Sprite sprite;
+        glm::vec2 corner;
+        if(keyword == "atlas" && words >> atlas.width >> atlas.height){
+            continue;
+        }
+        if(keyword == "sprite" && words >> name >> sprite.uvOffset.x >> sprite.uvOffset.y >> corner.x >> corner.y
+                                         >> sprite.size.x >> sprite.size.y){
+            sprite.uvSize = corner - sprite.uvOffset;
+            atlas.names[name] = atlas.sprites.size();
+            atlas.sprites.push_back(sprite);
+            continue;
+        }
+        std::cerr << "[WARN]: Could not read line " << lineNumber << " of sprite atlas " << tablePath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+SpriteBatch::SpriteBatch(GLuint texture_, const SpriteAtlas &atlas_) : Shader("shaders/texture.glvs", "shaders/texture.glfs", "PositionVec", "MVP"), vertexStream(64 << 10){ // Build the inherited class with the following constructor parameters, sprites need little stream space
+    texture = texture_;
+    atlas = atlas_;
+    vertexUVID = glGetAttribLocation(programID, "vertexUV");    // Get the location of the UV buffer from the GLSL
+    textureID  = glGetUniformLocation(programID, "tex");        // Get the location of texture sampler from GLSL
+    buildVertexArray();     // Add the UV coordinates to the attribute layout
+}
+void SpriteBatch::setTexture(GLuint texture_){
+    texture = texture_;
+}
+void SpriteBatch::add(int sprite, const glm::mat3 &matrix){
+    if(sprite < 0 || sprite >= (int)atlas.sprites.size()) return;
+    const Sprite &rect = atlas.sprites[sprite];
+
+    GLfloat u0 = rect.uvOffset.x, u1 = rect.uvOffset.x + rect.uvSize.x;
+    GLfloat v0 = rect.uvOffset.y, v1 = rect.uvOffset.y + rect.uvSize.y;    // v0 is the top of the sprite
+    const GLfloat corners[6][4] = {
+            {-1, -1, u0, v1},
+            {-1,  1, u0, v0},
+            { 1,  1, u1, v0},
+            {-1, -1, u0, v1},
+            { 1,  1, u1, v0},
+            { 1, -1, u1, v1}
+    };  // Two triangles per sprite
+
+    // Transform the corners like shaders/texture.glvs does: the matrix, plus the offset in its third row
+    for(int ii = 0; ii < 6; ii++){
+        GLfloat px = corners[ii][0], py = corners[ii][1];
+        batch.push_back(matrix[0][0]*px + matrix[1][0]*py + matrix[2][0] + matrix[0][2]);
+        batch.push_back(matrix[0][1]*px + matrix[1][1]*py + matrix[2][1] + matrix[1][2]);
+        batch.push_back(corners[ii][2]);
+        batch.push_back(corners[ii][3]);
+    }
+}
+unsigned SpriteBatch::spriteCount(){
+    return batch.size()/(6*FLOATS_PER_VERTEX);
+}
+void SpriteBatch::setupAttributes(){
+    // Interleaved positions and UV coordinates, render points them into the stream
+    GLState::enableAttributes(GLState::attribute(vertexPositionID) | GLState::attribute(vertexUVID));
+}
+GLuint SpriteBatch::sortTexture(){
+    return texture;
+}
+void SpriteBatch::capture(RenderCommand &command){
+    // The quads are already in screen coordinates
+    command.matrix = glm::mat3(1.0f);
+}
+void SpriteBatch::flush(){
+    render(command());
+}
+void SpriteBatch::render(const RenderCommand &command){
+    if (batch.empty()) return;
+
+    // Stream the quads
+    GLintptr start = vertexStream.write(batch.data(), sizeof(GLfloat)*batch.size());
+
+    GLState::useProgram(programID);    // Activate the GLSL program
+    glUniformMatrix3fv(tMatrixID, 1, GL_FALSE, &command.matrix[0][0]);
+    GLState::bindTexture(0, texture);   // Bind the atlas in Texture Unit 0
+    glUniform1i(textureID, 0);
+    GLState::count(2);
+
+    // Point both attributes into the interleaved data
+    bindAttributes();
+    GLState::bindArrayBuffer(vertexStream.id());
+    GLsizei stride = sizeof(GLfloat)*FLOATS_PER_VERTEX;
+    glVertexAttribPointer(vertexPositionID, 2, GL_FLOAT, GL_FALSE, stride, (void*)start);
+    glVertexAttribPointer(vertexUVID, 2, GL_FLOAT, GL_FALSE, stride, (void*)(start + 2*sizeof(GLfloat)));
+    GLState::count(2);
+
+    glDrawArrays(GL_TRIANGLES, 0, batch.size()/FLOATS_PER_VERTEX);    // All queued sprites at once
+    GLState::count();
+    batch.clear();
 }
 
 CircleShader::CircleShader(glm::vec4 colour_) : Shader("shaders/circle.glvs", "shaders/circle.glfs", "inPosition", "projection"){ // Build the inherited class with the following constructor parameters
@@ -560,9 +1612,10 @@ CircleShader::CircleShader(glm::vec4 colour_) : Shader("shaders/circle.glvs", "s
     };  // Store the UV buffer all most outer points from the texture matched to the UV points in Shader class
 
     glGenBuffers(1, &uvBuffer);                 // Generate a buffer for and store the location ID in uvBuffer
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);    // Make the buffer the current working buffer
+    GLState::bindArrayBuffer(uvBuffer);    // Make the buffer the current working buffer
     glBufferData(GL_ARRAY_BUFFER, sizeof(texcoords), texcoords, GL_STATIC_DRAW);    // Write the UV coordinates to the buffer
 
+    buildVertexArray();     // Add the UV coordinates to the attribute layout
 }
 void CircleShader::setNewUVCoordinates(GLuint arraySize, const GLfloat *uvArray) {
     unsigned uvCount = arraySize/2;     // Amount of UV coordinates
@@ -580,30 +1633,26 @@ void CircleShader::setNewUVCoordinates(GLuint arraySize, const GLfloat *uvArray)
             vertexCount = arraySize / 2;
         }
     } // Only print a warning if there is a mismatch between the UV and vertex coordinates, (drawing will not work correctly until the other the mismatch is Fixed!)
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);    // Make the buffer current (edit it)
+    GLState::bindArrayBuffer(uvBuffer);    // Make the buffer current (edit it)
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*vertexCount*2, uvArray, GL_STATIC_DRAW);  // Write the UV Array to the buffer
 }
 void CircleShader::setNewUVCoordinates(GLuint arraySize, const GLfloat *uvArray, const GLfloat *vertexArray){
     // Set both UV and vertex coordinates
     vertexCount = arraySize/2;  // update the vertexcount
 
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);    // Make UV buffer current
+    GLState::bindArrayBuffer(uvBuffer);    // Make UV buffer current
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*arraySize, uvArray, GL_STATIC_DRAW); // Write the UV array to the UV buffer
 
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);    // Make the vertex buffer current
+    GLState::bindArrayBuffer(vertexBuffer);    // Make the vertex buffer current
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*arraySize, vertexArray, GL_STATIC_DRAW);  // Write the vertex array to the vertexbuffer
 }
 CircleShader::~CircleShader(){
     glDeleteBuffers(1, &uvBuffer);      // Remove the buffer reservation
 }
-void CircleShader::draw(){
-    glUseProgram(programID);    // Activate the GLSL program
-    glUniformMatrix3fv(tMatrixID, 1, GL_FALSE, &transformationMatrix[0][0]);    // pass the trasnformation matrix to the program
-
-    glUniform4f(colourID, colour.r, colour.g, colour.b, colour.a);  // Pass the colour vector
-
-    glEnableVertexAttribArray(vertexPositionID);    // Enable the GLSL vertex attribute
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);    // Make the vertex buffer current
+void CircleShader::setupAttributes(){
+    // Enable the GLSL vertex and UV attributes
+    GLState::enableAttributes(GLState::attribute(vertexPositionID) | GLState::attribute(vertexUVID));
+    GLState::bindArrayBuffer(vertexBuffer);    // Make the vertex buffer current
     // Bind the vertex position of the GLSL program to the vertex buffer.
     glVertexAttribPointer(
             vertexPositionID,  // The vertex attribute
@@ -614,8 +1663,7 @@ void CircleShader::draw(){
             (void*)0                      // array buffer offset (incase you have multiple attribute elements in one buffer) not used
     );
 
-    glEnableVertexAttribArray(vertexUVID);      // Enable the GLSL UV attribute
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);    // make the UV buffer current
+    GLState::bindArrayBuffer(uvBuffer);    // make the UV buffer current
     // Bind the UV coordinates of the GLSL program to the uv Buffer
     glVertexAttribPointer(
             vertexUVID,                   // The UV attribute
@@ -625,28 +1673,213 @@ void CircleShader::draw(){
             0,                            // stride
             (void*)0                      // array buffer offset (incase you have multiple attribute elements in one buffer) not used
     );
+    GLState::count(2);
+}
+void CircleShader::capture(RenderCommand &command){
+    command.matrix = transformationMatrix;
+    command.colour = colour;
+}
+void CircleShader::draw(){
+    render(command());  // Draw right away, with the current state
+}
+void CircleShader::render(const RenderCommand &command){
+    GLState::useProgram(programID);    // Activate the GLSL program
+    glUniformMatrix3fv(tMatrixID, 1, GL_FALSE, &command.matrix[0][0]);    // pass the trasnformation matrix to the program
+
+    glUniform4f(colourID, command.colour.r, command.colour.g, command.colour.b, command.colour.a);  // Pass the colour vector
+    GLState::count(2);
+
+    bindAttributes();   // Bind the vertex positions and UV coordinates
 
     glDrawArrays(GL_TRIANGLE_FAN, 0,vertexCount);   // Draw the vertices (square) to fill with a circle
+    GLState::count();
+}
+
+PointShader::PointShader() : Shader("shaders/point.glvs", "shaders/point.glfs", "inPosition", "projection"), pointBuffer(1 << 20){ // Build the inherited class with the following constructor parameters
+    colourID = glGetAttribLocation(programID, "inColour");  // Get the per-point colour location in the GLSL program
+    buildVertexArray();     // Add the colour to the attribute layout
+}
+void PointShader::setupAttributes(){
+    // Interleaved positions and colours, render() points them into the stream buffer
+    GLState::enableAttributes(GLState::attribute(vertexPositionID) | GLState::attribute(colourID));
+}
+void PointShader::clear(){
+    points.clear();
+}
+unsigned PointShader::pointCount(){
+    return points.size()/FLOATS_PER_POINT;
+}
+void PointShader::addPoint(vec2d position, const std::array<double, 4> &colour, double coverage){
+    GLfloat point[FLOATS_PER_POINT] = {
+            (GLfloat)position[0], (GLfloat)position[1],
+            (GLfloat)colour[0], (GLfloat)colour[1], (GLfloat)colour[2], (GLfloat)(colour[3]*std::min(1.0, coverage))
+    };
+    points.insert(points.end(), point, point + FLOATS_PER_POINT);
+}
+void PointShader::draw(){
+    render(command());  // Draw right away, with the current state
+}
+void PointShader::render(const RenderCommand &command){
+    unsigned count = pointCount();
+    if(count == 0) return;
+
+    GLState::useProgram(programID);    // Activate the GLSL program
+    glUniformMatrix3fv(tMatrixID, 1, GL_FALSE, &command.matrix[0][0]);    // pass the transformation matrix to the program
+
+    GLintptr start = pointBuffer.write(points.data(), sizeof(GLfloat)*points.size());
+    bindAttributes();
+    GLState::bindArrayBuffer(pointBuffer.id());
+    GLsizei stride = sizeof(GLfloat)*FLOATS_PER_POINT;
+    glVertexAttribPointer(vertexPositionID, 2, GL_FLOAT, GL_FALSE, stride, (void*)start);
+    glVertexAttribPointer(colourID, 4, GL_FLOAT, GL_FALSE, stride, (void*)(start + 2*sizeof(GLfloat)));
+
+    glDrawArrays(GL_POINTS, 0, count);  // One pixel per point
+    GLState::count(4);
+}
+
+InstancedCircleShader::InstancedCircleShader() : Shader("shaders/circle_instanced.glvs", "shaders/circle_instanced.glfs", "inPosition", "projection"){ // Build the inherited class with the following constructor parameters
+    centreID = glGetAttribLocation(programID, "inCentre");  // Get the per-instance attribute locations in the GLSL program
+    radiusID = glGetAttribLocation(programID, "inRadius");
+    colourID = glGetAttribLocation(programID, "inColour");
 
-    glDisableVertexAttribArray(vertexPositionID);   // Disable the vertex position in the program
-    glDisableVertexAttribArray(vertexUVID);         // Disable the UV coordinates in the program
-    glUseProgram(0);    // Disable the Program and set it the used program to none
+    // Attribute divisors are core in GL 3.3, older drivers may have the extension
+    instancing = GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays;
+    if(!instancing){
+        std::cerr << "[WARN]: instanced arrays are not supported, InstancedCircleShader will use one draw call per circle" << std::endl;
+    }
+    buildVertexArray();     // Add the instance attributes to the attribute layout
+}
+void InstancedCircleShader::setupAttributes(){
+    // The quad advances per vertex, the instance attributes once per circle. Without instancing they are constant
+    // values instead of arrays.
+    unsigned long perInstance = GLState::attribute(centreID) | GLState::attribute(radiusID) | GLState::attribute(colourID);
+    if(instancing){
+        GLState::enableAttributes(GLState::attribute(vertexPositionID) | perInstance, perInstance);
+    }else{
+        GLState::enableAttributes(GLState::attribute(vertexPositionID));
+    }
+    GLState::bindArrayBuffer(vertexBuffer);    // Make the (quad) vertex buffer current
+    glVertexAttribPointer(vertexPositionID, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    GLState::count();
+}
+InstancedCircleShader::~InstancedCircleShader(){
+}
+void InstancedCircleShader::clear(){
+    instances.clear();
+    pointShader.clear();
 }
+unsigned InstancedCircleShader::circleCount(){
+    return instances.size()/FLOATS_PER_INSTANCE;
+}
+void InstancedCircleShader::addCircle(vec2d position, double radius, const std::array<double, 4> &colour){
+    GLfloat instance[FLOATS_PER_INSTANCE] = {
+            (GLfloat)position[0], (GLfloat)position[1], (GLfloat)radius,
+            (GLfloat)colour[0], (GLfloat)colour[1], (GLfloat)colour[2], (GLfloat)colour[3]
+    };
+    instances.insert(instances.end(), instance, instance + FLOATS_PER_INSTANCE);
+}
+void InstancedCircleShader::addObjects(std::vector<Object*> &objects, double pixelsPerUnit){
+    // Write straight into the vector instead of going through addCircle, this runs for every object every frame
+    size_t start = instances.size();
+    instances.resize(start + objects.size()*FLOATS_PER_INSTANCE);
+    GLfloat* instance = instances.data() + start;
+    // Objects with a diameter below a pixel
+    double pointRadius = pixelsPerUnit > 0 ? 0.5/pixelsPerUnit : 0;
+    const double pi = PI;
+    for (int ii = 0; ii < objects.size(); ii++) {
+        const Object* obj = objects[ii];
+        if (obj->radius < pointRadius) {
+            // Covers only part of its pixel, so it is drawn lighter
+            double pixelRadius = obj->radius * pixelsPerUnit;
+            pointShader.addPoint(obj->position, obj->colour, pi*pixelRadius*pixelRadius);
+            continue;
+        }
+        instance[0] = obj->position[0];
+        instance[1] = obj->position[1];
+        instance[2] = obj->radius;
+        instance[3] = obj->colour[0];
+        instance[4] = obj->colour[1];
+        instance[5] = obj->colour[2];
+        instance[6] = obj->colour[3];
+        instance += FLOATS_PER_INSTANCE;
+    }
+    instances.resize(instance - instances.data());     // Remove the room of the points
+}
+void InstancedCircleShader::draw(){
+    render(command());  // Draw right away, with the current state
+}
+void InstancedCircleShader::render(const RenderCommand &command){
+    // Points are cheaper than a quad each, they use their own program with the same matrix
+    if(pointShader.pointCount() > 0){
+        RenderCommand pointCommand = command;
+        pointCommand.shader = &pointShader;
+        pointShader.render(pointCommand);
+    }
 
-TextShader::TextShader(const char* trueTypePath, int numOfChars) : Shader("shaders/text.glvs", "shaders/text.glfs", "VertexPos", "projection"){ // Build the inherited class with the following constructor parameters
-    if (FT_Init_FreeType(&ft))  // Initiate a freetype library to ft
-        std::cout << "ERROR::FREETYPE: Could not init FreeType Library" << std::endl;
+    unsigned count = circleCount();
+    if(count == 0) return;
 
-    if (FT_New_Face(ft, trueTypePath, 0, &face))    // initiate a Face of the specified font to face
-        std::cout << "ERROR::FREETYPE: Failed to load font" << std::endl;
+    GLState::useProgram(programID);    // Activate the GLSL program
+    glUniformMatrix3fv(tMatrixID, 1, GL_FALSE, &command.matrix[0][0]);    // pass the transformation matrix to the program
+    GLState::count();
 
-    pixSize = 72; // A pixel size to draw the fonts
-    FT_Set_Pixel_Sizes(face, 0, pixSize);   // Set the size of the character to the Face
-    colour = glm::vec4(1.0f);   // Store a white colour in colour
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Disable byte-alignment restriction
+    bindAttributes();   // Bind the quad and the instance attribute layout
+
+    if(instancing){
+        // Stream the instances, without waiting for the GPU to finish drawing the previous frames
+        GLintptr start = instanceBuffer.write(instances.data(), sizeof(GLfloat)*instances.size());
+
+        // The instance data moves through the ring buffer, so only its pointers change per draw
+        GLState::bindArrayBuffer(instanceBuffer.id());
+        GLsizei stride = sizeof(GLfloat)*FLOATS_PER_INSTANCE;
+        glVertexAttribPointer(centreID, 2, GL_FLOAT, GL_FALSE, stride, (void*)start);
+        glVertexAttribPointer(radiusID, 1, GL_FLOAT, GL_FALSE, stride, (void*)(start + 2*sizeof(GLfloat)));
+        glVertexAttribPointer(colourID, 4, GL_FLOAT, GL_FALSE, stride, (void*)(start + 3*sizeof(GLfloat)));
 
+        glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, vertexCount, count);  // Draw all circles at once
+        GLState::count(4);
+    }else{
+        // Without instancing the per-circle attributes are constant values, still without a program switch per circle
+        for(unsigned ii = 0; ii < count; ii++){
+            const GLfloat* instance = &instances[ii*FLOATS_PER_INSTANCE];
+            glVertexAttrib2f(centreID, instance[0], instance[1]);
+            glVertexAttrib1f(radiusID, instance[2]);
+            glVertexAttrib4f(colourID, instance[3], instance[4], instance[5], instance[6]);
+            glDrawArrays(GL_TRIANGLE_FAN, 0, vertexCount);
+        }
+        GLState::count(4*count);
+    }
+}
+
+GlyphAtlas rasteriseFont(const char* trueTypePath, int numOfChars){
+    GlyphAtlas glyphs;
+    glyphs.pixSize = 72; // A pixel size to draw the fonts
+    glyphs.characters.assign(256, Character());
+
+    // Every call has its own FreeType library, so fonts can be rasterised on several threads at once
+    FT_Library ft;  // FreeType Library
+    FT_Face face;   // FreeType face to draw a character into a bitmap
+    if (FT_Init_FreeType(&ft)) {    // Initiate a freetype library to ft
+        std::cout << "ERROR::FREETYPE: Could not init FreeType Library" << std::endl;
+        numOfChars = 0;
+    }else if (FT_New_Face(ft, trueTypePath, 0, &face)) {    // initiate a Face of the specified font to face
+        std::cout << "ERROR::FREETYPE: Failed to load font" << std::endl;
+        FT_Done_FreeType(ft);
+        numOfChars = 0;
+    }else{
+        FT_Set_Pixel_Sizes(face, 0, glyphs.pixSize);   // Set the size of the character to the Face
+    }
+
+    // Glyphs are placed on shelves (rows) of the atlas from left to right, with a gap so linear filtering does not
+    // pick up the neighbours. Unknown characters keep an empty entry (no size, no advance).
+    if (numOfChars > 256) numOfChars = 256;
+    std::vector<Character> &Characters = glyphs.characters;
+    std::vector<std::vector<unsigned char> > bitmaps(numOfChars);
+    const int atlasWidth = 1024;
+    const int gap = 2;
+    int shelfX = gap, shelfY = gap, shelfHeight = 0;
 
-    for (GLubyte c = 0; c < numOfChars; c++)
+    for (int c = 0; c < numOfChars; c++)
     {
         // Load character glyph (render it)
         if (FT_Load_Char(face, c, FT_LOAD_RENDER))
@@ -654,72 +1887,138 @@ TextShader::TextShader(const char* trueTypePath, int numOfChars) : Shader("shade
             std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
             continue;
         }
-        // Generate texture
-        GLuint texture;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        // Write the texture as single colour channel (alpha) from the bitmap buffer generated in the face.
-        glTexImage2D(
-                GL_TEXTURE_2D,
-                0,
-                GL_RED,
-                face->glyph->bitmap.width,
-                face->glyph->bitmap.rows,
-                0,
-                GL_RED,
-                GL_UNSIGNED_BYTE,
-                face->glyph->bitmap.buffer
-        );
-
-        // Set texture options (wrap around and scaling)
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        // Now store character for later use
+        FT_Bitmap &bitmap = face->glyph->bitmap;
+        if (shelfX + (int)bitmap.width + gap > atlasWidth) {
+            // Start a new shelf
+            shelfX = gap;
+            shelfY += shelfHeight + gap;
+            shelfHeight = 0;
+        }
+
+        // Store the character with its pixel position in the atlas for now
         Character character = {
-                texture,
-                glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
+                0,
+                glm::ivec2(bitmap.width, bitmap.rows),
                 glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
-                face->glyph->advance.x
+                face->glyph->advance.x,
+                glm::vec2(shelfX, shelfY),
+                glm::vec2(bitmap.width, bitmap.rows)
         };
-        Characters.insert(std::pair<GLchar, Character>(c, character)); // add a character char part
+        Characters[c] = character;
+        bitmaps[c].assign(bitmap.buffer, bitmap.buffer + bitmap.width*bitmap.rows);
+
+        shelfX += bitmap.width + gap;
+        if ((int)bitmap.rows > shelfHeight) shelfHeight = bitmap.rows;
+    }
+    if (numOfChars > 0) {
+        FT_Done_Face(face);     // Clear face resources
+        FT_Done_FreeType(ft);   // Clear FreeType libray resources
     }
-    glBindTexture(GL_TEXTURE_2D, 0);    // remove the binding
 
-    FT_Done_Face(face);     // Clear face resources
-    FT_Done_FreeType(ft);   // Clear FreeType libray resources
+    // Copy the bitmaps into one image, the height is rounded up to a power of two
+    int atlasHeight = 1;
+    while (atlasHeight < shelfY + shelfHeight + gap) atlasHeight *= 2;
+    glyphs.image.assign(atlasWidth*atlasHeight, 0);
+    for (int c = 0; c < numOfChars; c++)
+    {
+        Character &ch = Characters[c];
+        for (int row = 0; row < ch.Size.y; row++) {
+            std::copy(bitmaps[c].begin() + row*ch.Size.x, bitmaps[c].begin() + (row+1)*ch.Size.x,
+                      glyphs.image.begin() + ((int)ch.uvOffset.y + row)*atlasWidth + (int)ch.uvOffset.x);
+        }
+    }
+    glyphs.width = atlasWidth;
+    glyphs.height = atlasHeight;
 
-    static const GLfloat texcoords[] = {
-            0.0f,1.0f,
-            0.0f,0.0f,
-            1.0f,0.0f,
-            1.0f,1.0f
-    };    // Store the UV buffer all most outer points from the texture matched to the UV points in Shader class
+    // Now that the atlas size is known, turn the pixel positions into UV coordinates
+    for (int c = 0; c < 256; c++)
+    {
+        Characters[c].uvOffset /= glm::vec2(atlasWidth, atlasHeight);
+        Characters[c].uvSize /= glm::vec2(atlasWidth, atlasHeight);
+    }
+    return glyphs;
+}
 
-    glGenBuffers(1, &uvBuffer);                 // Generate a buffer for and store the location ID in uvBuffer
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);    // Make the buffer the current working buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(texcoords), texcoords, GL_STATIC_DRAW);    // Write the UV coordinates to the buffer
+bool readFontAtlas(const char* atlasPath, GlyphAtlas &glyphs){
+    std::shared_ptr<FontAtlasFile> file(new FontAtlasFile());
+    if (!file->open(atlasPath)) {
+        return false;
+    }
+    file->prefault();
+    const FontAtlasHeader &header = file->header();
+
+    // The metrics are stored like FreeType gives them, only the UV coordinates are computed
+    glyphs.characters.assign(256, Character());
+    for (unsigned c = 0; c < header.glyph_count && c < 256; c++)
+    {
+        const FontAtlasGlyph &glyph = file->glyphs()[c];
+        Character character = {
+                0,
+                glm::ivec2(glyph.width, glyph.height),
+                glm::ivec2(glyph.bearing_x, glyph.bearing_y),
+                glyph.advance,
+                glm::vec2(glyph.x, glyph.y) / glm::vec2(header.width, header.height),
+                glm::vec2(glyph.width, glyph.height) / glm::vec2(header.width, header.height)
+        };
+        glyphs.characters[c] = character;
+    }
+    glyphs.image.clear();
+    glyphs.file = file;
+    glyphs.width = header.width;
+    glyphs.height = header.height;
+    glyphs.pixSize = header.pixel_size;
+    glyphs.distanceField = true;
+    return true;
+}
+
+TextShader::TextShader(const char* trueTypePath, int numOfChars) : TextShader(rasteriseFont(trueTypePath, numOfChars)){
+}
+TextShader::TextShader(const GlyphAtlas &glyphs) : Shader("shaders/text.glvs", glyphs.distanceField ? "shaders/textsdf.glfs" : "shaders/text.glfs", "VertexPos", "projection"), vertexStream(64 << 10){ // Build the inherited class with the following constructor parameters, text needs little stream space
+    pixSize = glyphs.pixSize;
+    colour = glm::vec4(1.0f);   // Store a white colour in colour
+    batchColour = colour;
+    layoutDraws = 0;
+    layoutGeneration = windowGeneration;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Disable byte-alignment restriction
+
+    // Generate the atlas texture. Write the texture as single colour channel (alpha).
+    glGenTextures(1, &atlas);
+    GLState::bindTexture(0, atlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, glyphs.width, glyphs.height, 0, GL_RED, GL_UNSIGNED_BYTE, glyphs.pixels());
+
+    // Set texture options (wrap around and scaling)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    GLState::bindTexture(0, 0);     // remove the binding
+
+    Characters = glyphs.characters;
+    for (int c = 0; c < 256; c++)
+    {
+        Characters[c].textureID = atlas;
+    }
 
     vertexUVID = glGetAttribLocation(programID, "vertexUV");    // Get the location of the UV coordinates in the GLSL program
     textureID  = glGetUniformLocation(programID, "text");       // Get the location of the texture (character) in the GLSL program
     textColorID = glGetUniformLocation(programID, "textColor"); // Get the location of the colour in the GLSL program
+    buildVertexArray();     // Add the UV coordinates to the attribute layout
 
 }
 TextShader::~TextShader(){
-    glDeleteBuffers(1, &uvBuffer);  // Clear the buffer reservation
-    for (map<char,Character>::iterator c = Characters.begin(); c != Characters.end(); c++){
-        glDeleteTextures(1,&(*c).second.textureID); // Clear the texture reservation for each character
+    clearCache();                   // Clear the buffers of the cached strings
+    glDeleteTextures(1, &atlas);    // Clear the texture reservation of the atlas
+    GLState::invalidate();
+}
+void TextShader::add(std::string text, vec2d position, unsigned alignment, vec2d screenDims, double height){
+    // The colour is a uniform, text in another colour needs its own draw call
+    if (batch.size() && colour != batchColour) {
+        flush();
     }
+    batchColour = colour;
+    layout(text, position, alignment, screenDims, height, batch);
 }
-void TextShader::draw(std::string text, vec2d position, unsigned alignment,vec2d screenDims, double height){
-
-    glUseProgram(programID);    // activate the correct shader program
-    glUniform3f(textColorID, colour.x, colour.y, colour.z); // pass the text colour
-    glActiveTexture(GL_TEXTURE0);   // make texture unit 0 active
-    glUniform1f(textureID, 0);      // make the GLSL texture sampler look at texture unit 0
-
+void TextShader::layout(std::string text, vec2d position, unsigned alignment, vec2d screenDims, double height, std::vector<GLfloat> &vertices){
     // Create a scale corresponding to the rendered scale and input height
     double yScale = 2 * height / pixSize;
     double xScale = yScale;
@@ -730,69 +2029,156 @@ void TextShader::draw(std::string text, vec2d position, unsigned alignment,vec2d
     // The stepScale needs to be defined (approx space between characters)
     double stepScale = xScale*2;
 
-    // Iterate through all characters to get the the width of the total line of text
-    std::string::const_iterator c;
-    double lineSize=0;
-    if (alignment!=DRAWTEXT::ALIGN_LEFT){
-        for(c=text.begin(); c!=text.end(); c++){
-            lineSize+=(Characters[*c].Advance >> 6) * stepScale;
-        }
-    }
-    // make the lineSize centre of the line if required
-    if(alignment==DRAWTEXT::ALIGN_CENTER){
-        lineSize/=2;
-    }
-    // Create the initial write position of the cursor
-    GLfloat x = position[0]-lineSize;
+    // Create the initial write position of the cursor, the alignment is applied after the line is built
+    GLfloat x = position[0];
     GLfloat y = position[1]-height*2;
+    size_t lineStart = vertices.size();
+    vertices.reserve(vertices.size() + text.size()*6*FLOATS_PER_VERTEX);
 
-    // Enable the vertexPosition in the GLSL program and bind the vertexbuffer to it
-    glEnableVertexAttribArray(vertexPositionID);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glVertexAttribPointer(
-            vertexPositionID,  // The attribute we want to configure
-            2,                            // size
-            GL_FLOAT,                     // type
-            GL_FALSE,                     // normalized?
-            0,                            // stride
-            (void*)0                      // array buffer offset
-    );
-
-    // Enable the UV coordinates in the GLSL program and bind the vertexbuffer to it
-    glEnableVertexAttribArray(vertexUVID);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
-    glVertexAttribPointer(
-            vertexUVID,                   // The attribute we want to configure
-            2,                            // size : U+V => 2
-            GL_FLOAT,                     // type
-            GL_FALSE,                     // normalized?
-            0,                            // stride
-            (void*)0                      // array buffer offset
-    );
-    // Iterate through the line of text and render each glyph on the right position
-    for (c = text.begin(); c != text.end(); c++)
+    for (std::string::const_iterator c = text.begin(); c != text.end(); c++)
     {
-        Character ch = Characters[*c];  // the character is used a lot, it's useful to store it in a seperate parameter
-
-        // Alter the transformation matrix to have the correct scale, and postion.
-        transformationMatrix[0].x = ch.Size.x * xScale;
-        transformationMatrix[0].z = x + (ch.Size.x/2.0 + ch.Bearing.x) * xScale;
-        transformationMatrix[1].y = ch.Size.y * yScale;
-        transformationMatrix[1].z = y - (ch.Size.y - ch.Bearing.y*2.0) * yScale;
-
-        // Pass the transformation matrix
-        glUniformMatrix3fv(tMatrixID,1,GL_FALSE,&transformationMatrix[0][0]);
-
-        // Render glyph texture over quad
-        glBindTexture(GL_TEXTURE_2D, ch.textureID);
+        const Character &ch = Characters[(unsigned char)*c];   // Flat table lookup, no copy
+
+        // The quad has the same centre and size as the transformation matrix of the per-character version
+        GLfloat centreX = x + (ch.Size.x/2.0 + ch.Bearing.x) * xScale;
+        GLfloat centreY = y - (ch.Size.y - ch.Bearing.y*2.0) * yScale;
+        GLfloat halfWidth = ch.Size.x * xScale;
+        GLfloat halfHeight = ch.Size.y * yScale;
+        GLfloat left = centreX - halfWidth, right = centreX + halfWidth;
+        GLfloat bottom = centreY - halfHeight, top = centreY + halfHeight;
+        GLfloat u0 = ch.uvOffset.x, u1 = ch.uvOffset.x + ch.uvSize.x;
+        GLfloat v0 = ch.uvOffset.y, v1 = ch.uvOffset.y + ch.uvSize.y;    // Bitmap rows go from top to bottom
+
+        // Two triangles per character
+        const GLfloat quad[6*FLOATS_PER_VERTEX] = {
+                left,  bottom, u0, v1,
+                left,  top,    u0, v0,
+                right, top,    u1, v0,
+                left,  bottom, u0, v1,
+                right, top,    u1, v0,
+                right, bottom, u1, v1
+        };
+        vertices.insert(vertices.end(), quad, quad + 6*FLOATS_PER_VERTEX);
 
-        // Render quad
-        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
         // Now advance cursors for next glyph (note that advance is number of 1/64 pixels)
         x += (ch.Advance >> 6) * stepScale; // Bitshift by 6 to get value in pixels (2^6 = 64)
     }
-    glBindVertexArray(0);   // Unbind the vertex array
-    glBindTexture(GL_TEXTURE_2D, 0);    // Unbind the texture
-    glUseProgram(0);        // Remove the bound program
+
+    // Shift the line by its width (right) or half its width (centre), the width is where the cursor ended
+    if(alignment!=DRAWTEXT::ALIGN_LEFT){
+        GLfloat lineSize = x - position[0];
+        if(alignment==DRAWTEXT::ALIGN_CENTER){
+            lineSize/=2;
+        }
+        for (size_t ii = lineStart; ii < vertices.size(); ii += FLOATS_PER_VERTEX) {
+            vertices[ii] -= lineSize;
+        }
+    }
 }
+void TextShader::beginDraw(GLuint buffer, GLintptr start, const glm::vec4 &textColour, const glm::mat3 &matrix){
+    GLState::useProgram(programID);    // activate the correct shader program
+    glUniform3f(textColorID, textColour.x, textColour.y, textColour.z); // pass the text colour
+    glUniformMatrix3fv(tMatrixID,1,GL_FALSE,&matrix[0][0]);
+
+    GLState::bindTexture(0, atlas);     // Bind the atlas to texture unit 0
+    glUniform1i(textureID, 0);      // make the GLSL texture sampler look at texture unit 0
+    GLState::count(3);
+
+    // Point both attributes into the interleaved data, the buffer and offset change per draw
+    bindAttributes();
+    GLState::bindArrayBuffer(buffer);
+    GLsizei stride = sizeof(GLfloat)*FLOATS_PER_VERTEX;
+    glVertexAttribPointer(vertexPositionID, 2, GL_FLOAT, GL_FALSE, stride, (void*)start);
+    glVertexAttribPointer(vertexUVID, 2, GL_FLOAT, GL_FALSE, stride, (void*)(start + 2*sizeof(GLfloat)));
+    GLState::count(2);
+}
+void TextShader::setupAttributes(){
+    // Interleaved positions and UV coordinates, beginDraw points them into the buffer that is drawn
+    GLState::enableAttributes(GLState::attribute(vertexPositionID) | GLState::attribute(vertexUVID));
+}
+GLuint TextShader::sortTexture(){
+    return atlas;
+}
+void TextShader::capture(RenderCommand &command){
+    // The quads are already in screen coordinates
+    command.matrix = glm::mat3(1.0f);
+    command.colour = batchColour;
+}
+void TextShader::flush(){
+    render(command());
+}
+void TextShader::render(const RenderCommand &command){
+    if (batch.empty()) return;
+
+    // Stream the quads
+    GLintptr start = vertexStream.write(batch.data(), sizeof(GLfloat)*batch.size());
+    beginDraw(vertexStream.id(), start, command.colour, command.matrix);
 
+    glDrawArrays(GL_TRIANGLES, 0, batch.size()/FLOATS_PER_VERTEX);    // All queued characters at once
+    GLState::count();
+    batch.clear();
+}
+void TextShader::draw(std::string text, vec2d position, unsigned alignment,vec2d screenDims, double height){
+    add(text, position, alignment, screenDims, height);
+    flush();
+}
+void TextShader::drawCached(std::string text, vec2d position, unsigned alignment, vec2d screenDims, double height){
+    // Keep the drawing order with text that is still queued
+    flush();
+
+    // A resized window changes the screen dimensions of all text, start over
+    if (layoutGeneration != windowGeneration) {
+        clearCache();
+        layoutGeneration = windowGeneration;
+    }
+
+    // The key holds everything that changes the layout. The position is not part of it: the string is laid out at
+    // 0,0 and moved with the transformation matrix.
+    std::string key = text;
+    key.push_back('\0');
+    key.append((const char*)&alignment, sizeof(alignment));
+    key.append((const char*)&screenDims[0], 2*sizeof(double));
+    key.append((const char*)&height, sizeof(height));
+
+    layoutDraws++;
+    std::map<std::string, TextLayout>::iterator cached = layouts.find(key);
+    if (cached == layouts.end()) {
+        // Remove the least recently drawn string when the cache is full
+        if (layouts.size() >= MAX_LAYOUTS) {
+            std::map<std::string, TextLayout>::iterator oldest = layouts.begin();
+            for (std::map<std::string, TextLayout>::iterator it = layouts.begin(); it != layouts.end(); it++) {
+                if (it->second.lastUse < oldest->second.lastUse) oldest = it;
+            }
+            glDeleteBuffers(1, &oldest->second.buffer);
+            GLState::invalidate();
+            layouts.erase(oldest);
+        }
+
+        std::vector<GLfloat> vertices;
+        layout(text, {0, 0}, alignment, screenDims, height, vertices);
+        TextLayout entry;
+        entry.vertexCount = vertices.size()/FLOATS_PER_VERTEX;
+        glGenBuffers(1, &entry.buffer);
+        GLState::bindArrayBuffer(entry.buffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*vertices.size(), vertices.data(), GL_STATIC_DRAW);
+        cached = layouts.insert(std::pair<std::string, TextLayout>(key, entry)).first;
+    }
+    cached->second.lastUse = layoutDraws;
+    if (cached->second.vertexCount == 0) return;
+
+    // Translation to the position (in the column layout the shaders expect, see tMatrixTranslate)
+    glm::mat3 matrix(1.0f);
+    matrix[0].z = position[0];
+    matrix[1].z = position[1];
+    beginDraw(cached->second.buffer, 0, colour, matrix);
+    glDrawArrays(GL_TRIANGLES, 0, cached->second.vertexCount);
+    GLState::count();
+}
+void TextShader::clearCache(){
+    for (std::map<std::string, TextLayout>::iterator it = layouts.begin(); it != layouts.end(); it++) {
+        glDeleteBuffers(1, &it->second.buffer);
+    }
+    GLState::invalidate();
+    layouts.clear();
+}
+unsigned long TextShader::windowGeneration = 0;
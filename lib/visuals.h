@@ -11,6 +11,10 @@
 #ifndef TUTORIALS_VISUALS_H
 #define TUTORIALS_VISUALS_H
 
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
 // Constants defining the resize methods of the universe/window
 namespace vis{
     const unsigned FIXED_SIZE_UNIVERSE = 0; // Universe does not scale when window rescales
@@ -18,6 +22,10 @@ namespace vis{
     const unsigned PROP_SIZE_UNIVERSE = 2;  // Scale the universe with the
     const unsigned NO_RESIZE = 3;           // No resize of window is possible (NOTE CAN ONLY BE SET AT INITIALISATION)
     const unsigned ZOOM_UNIVERSE = 4;       // When windows resizes the universe pixRatio scales to fit.
+
+    // How the objects are drawn (see Window::visualMode)
+    const unsigned DRAW_CIRCLES = 0;        // Every object as a lit circle
+    const unsigned DRAW_DENSITY = 1;        // A heat map of the objects (needs Window::densityShader)
 }
 
 // constants defining the alignment methods of the textshader
@@ -27,6 +35,80 @@ namespace DRAWTEXT{
     const unsigned ALIGN_RIGHT = 2;
 }
 
+// Ring buffer for vertex data that changes every frame. The buffer has SECTIONS sections; data is appended to the
+// current section and when it is full the next one is used, after waiting for the GPU to finish with it (a fence
+// is placed when a section is left). With GL_ARB_buffer_storage the buffer is mapped once and stays mapped, so a
+// write is a memcpy. Without it the buffer is orphaned when the ring wraps around and written with glBufferSubData.
+class StreamBuffer{
+private:
+    GLuint buffer;              // Buffer location of the ring
+    GLsizeiptr sectionSize;     // Size of one section in bytes
+    unsigned section;           // Section that is written to
+    GLsizeiptr offset;          // Write position within the current section
+    bool persistent;            // Whether the buffer is persistently mapped
+    char* mapping;              // Start of the persistent mapping
+    GLsync fences[3];           // Fence of every section, placed when the section was left (0 if none)
+    void allocate(GLsizeiptr newSectionSize);   // (Re)create the buffer storage
+    void nextSection();                         // Fence the current section and wait for the next one
+public:
+    static const unsigned SECTIONS = 3;
+    static const GLsizeiptr ALIGNMENT = 16;     // Every write starts at a multiple of this
+    StreamBuffer(GLsizeiptr sectionSize_ = 4 << 20);
+    ~StreamBuffer();
+    // Copy size bytes into the ring and return the offset of the copy in the buffer, for glVertexAttribPointer after
+    // binding id(). Data larger than a section makes the sections grow.
+    GLintptr write(const void* data, GLsizeiptr size);
+    GLuint id();
+};
+
+// Remembers which program, array buffer, textures and vertex attribute arrays are bound in the (single) GL context,
+// so binding what is already bound costs no GL call. All drawing in this file binds through it. Code that changes
+// these bindings directly (texture loaders, external drawing code) must call invalidate() afterwards. Shaders leave
+// their vertex array object bound, other code has to bind vertex array 0 before it sets attribute pointers.
+class GLState{
+private:
+    static GLuint program;              // Program in use
+    static GLuint arrayBuffer;          // Buffer bound to GL_ARRAY_BUFFER
+    static GLuint vertexArray;          // Bound vertex array object
+    static unsigned activeUnit;         // Active texture unit
+    static GLuint textures[8];          // GL_TEXTURE_2D binding of every texture unit
+    static unsigned long enabled;       // Bit mask of the enabled vertex attribute arrays (of vertex array 0)
+    static unsigned long instanced;     // Bit mask of the vertex attributes with a divisor of 1 (of vertex array 0)
+    static bool attributesKnown;        // False after invalidate()
+public:
+    static const unsigned TEXTURE_UNITS = 8;
+    static const GLuint UNKNOWN = ~0u;  // Binding that is not known, never equal to an object name
+    static unsigned long calls;         // GL calls issued by the drawing code in the current frame
+    static unsigned long skipped;       // Binds that were skipped in the current frame
+    static unsigned long frameCalls;    // calls and skipped of the last finished frame, shown by Window::toggleGLStats
+    static unsigned long frameSkipped;
+
+    static void useProgram(GLuint program_);
+    static void bindArrayBuffer(GLuint buffer);
+    static void bindVertexArray(GLuint array);
+    static void bindTexture(unsigned unit, GLuint texture);     // GL_TEXTURE_2D binding of a texture unit
+    // Enable exactly the vertex attribute arrays in mask (see attribute()), the ones in instancedMask advance once per
+    // instance instead of once per vertex. With a vertex array object bound this records the layout of that (new or
+    // growing) object, its arrays are only enabled.
+    static void enableAttributes(unsigned long mask, unsigned long instancedMask = 0);
+    static bool vertexArrays();     // Whether the GL has vertex array objects
+    static unsigned long attribute(GLuint location);   // Bit of an attribute location (0 if the location is invalid)
+    static void count(unsigned long glCalls = 1);      // Count GL calls that do not go through the cache (uniforms, draws)
+    static void invalidate();                           // Forget the bindings, they were changed outside the cache
+    static void endFrame();                             // Store the counters of this frame and start counting again (Window::swapBuffers)
+};
+
+class Shader;
+
+// A recorded draw: the shader with a copy of its per-draw state, and a key to sort the draws on
+struct RenderCommand{
+    uint64_t key;           // layer, program, texture and buffer (most significant first)
+    Shader* shader;         // Shader that executes the command
+    glm::mat3 matrix;       // Transformation matrix at the time of recording
+    glm::vec4 colour;       // Colour at the time of recording (for shaders that have one)
+    unsigned part;          // Texture part (see TextureShader::draw)
+};
+
 // Base shader class for easy construction and drawing of shader based graphics.
 class Shader{
 protected:
@@ -35,9 +117,15 @@ protected:
     GLuint vertexBuffer;    // Buffer location in memory for vertices
     bool tMatrixOn;         // Determine whether transfomrationMatrix is used
     unsigned vertexCount;   // Amount of vertices to store in vertexBuffer
+    GLuint vertexArray;     // Vertex array object holding the attribute layout (0 if the GL has none)
+    virtual void setupAttributes();     // Enable the attributes and point them to the buffers, recorded in vertexArray
+    void buildVertexArray();            // Record the layout of the (derived) class, call at the end of a constructor
+    void bindAttributes();              // Bind vertexArray, or set the attributes up when there is none
+    virtual GLuint sortTexture();                   // Texture that is part of the sort key (0 if none)
+    virtual void capture(RenderCommand &command);   // Copy the per-draw state into a command
 public:
     Shader(const char* vertexShader, const char* fragmentShader, const char* vertexName, const char* tMatrixName = NULL);
-    ~Shader();
+    virtual ~Shader();
     glm::mat3 transformationMatrix;             // a transformationMatrix to control positioning, scaling etc.
     void tMatrixReset();                        // set the transformationMatrix back to the identity matrix
     void tMatrixRotate(GLfloat angle);          // Multiply the tMatrix to rotate 'angle' radians (on the M2x2 part)
@@ -46,6 +134,10 @@ public:
     void setNewVertices(GLuint arraySize, const GLfloat * vertexArray);    // Change the vertices stored in the vertexBuffer
     GLuint programID;    // ID of the GLSL program
     virtual void draw();    // Draw the defined vertices with the GLSL program
+    // Record the current state as a command, for a RenderQueue (see RenderQueue::sortKey for the layer)
+    RenderCommand command(unsigned layer = 0, unsigned part = 0);
+    // Draw with the state of a command. Binds go through GLState and nothing is unbound afterwards.
+    virtual void render(const RenderCommand &command);
 };
 
 // A shader class that handles textures
@@ -55,12 +147,57 @@ private:
     GLuint textureID;   // Location of the texture sampler in the GLSL program
     GLuint uvBuffer;    // Buffer location for UV coordinates
     GLuint texture;     // Buffer location for a texture
+    void setupAttributes();
+    GLuint sortTexture();
 public:
     TextureShader(GLuint texture_);// : Shader("shaders/texture.glvs", "shaders/texture.glfs", "PositionVec", "MVP");
     ~TextureShader();
+    void setTexture(GLuint texture_);   // Draw another texture (for textures that are loaded later)
     void setNewUVCoordinates(GLuint arraySize, const GLfloat * uvArray);                            // change the UV coordinates stored in the UVbuffer
     void setNewUVCoordinates(GLuint arraySize, const GLfloat *uvArray, const GLfloat *vertexArray); // change the UV coordinates and the vertex array stored in the Buffers (overload)
     void draw(unsigned texNum = 0);     // Draw a set of UV coordinates named by texNum
+    void render(const RenderCommand &command);
+};
+
+// Rectangle of a sprite in an atlas made by pie_atlas
+struct Sprite{
+    glm::vec2 uvOffset;     // Top left corner in texture coordinates (v = 0 is the top row of the image)
+    glm::vec2 uvSize;
+    glm::ivec2 size;        // Size in pixels
+};
+// UV table of a sprite atlas (the .atlas file next to its DDS), without any GL calls so it can be read on any thread
+struct SpriteAtlas{
+    std::vector<Sprite> sprites;
+    std::map<std::string, unsigned> names;  // Index in sprites of every sprite name
+    int width = 0;
+    int height = 0;
+    int find(std::string name) const;       // Index of a sprite, -1 (with a warning) when the atlas does not have it
+};
+// Read the UV table written by pie_atlas, returns false (with a warning) if it can not be read
+bool readSpriteAtlas(const char* tablePath, SpriteAtlas &atlas);
+
+// Draws any number of sprites from one atlas texture with one draw call. A sprite is the quad -1..1 with the UV
+// rectangle of the sprite, placed with a matrix like the transformationMatrix of TextureShader. add() transforms the
+// quad on the CPU and queues it, flush() (or a RenderQueue) streams all queued quads and draws them.
+class SpriteBatch: public Shader{
+private:
+    GLuint vertexUVID;  // Location of UV coordinates in the GLSL program
+    GLuint textureID;   // Location of the texture sampler in the GLSL program
+    GLuint texture;     // The atlas
+    StreamBuffer vertexStream;  // Ring buffer the batched quads are streamed through
+    std::vector<GLfloat> batch; // Queued quads: x, y, u, v per vertex, 6 vertices per sprite
+    void setupAttributes();
+    GLuint sortTexture();
+    void capture(RenderCommand &command);
+public:
+    static const unsigned FLOATS_PER_VERTEX = 4;
+    SpriteBatch(GLuint texture_, const SpriteAtlas &atlas_);// : Shader("shaders/texture.glvs", "shaders/texture.glfs", "PositionVec", "MVP");
+    SpriteAtlas atlas;
+    void setTexture(GLuint texture_);   // Draw from another texture (for atlases that are loaded later)
+    void add(int sprite, const glm::mat3 &matrix);  // Queue a sprite (an index of atlas.sprites, -1 is skipped)
+    unsigned spriteCount();
+    void flush();       // Draw all queued sprites with one draw call
+    void render(const RenderCommand &command);  // Draws (and empties) the sprites queued at the time of rendering
 };
 
 // A shader class to draw circles with a minimalistic lighting effect
@@ -69,6 +206,8 @@ private:
     GLuint vertexUVID;  // Location of UV coordinates in the GLSL program
     GLuint colourID;    // Location of the circle colour in the GLSL program
     GLuint uvBuffer;    // Buffer location for UV coordinates
+    void setupAttributes();
+    void capture(RenderCommand &command);
 public:
     CircleShader(glm::vec4 colour_ = glm::vec4(1.0));// : Shader("shaders/circle.glvs", "shaders/circle.glfs", "inPosition", "projection");
     ~CircleShader();
@@ -76,25 +215,253 @@ public:
     void setNewUVCoordinates(GLuint arraySize, const GLfloat * uvArray);                            // change the UV coordinates stored in the UVbuffer
     void setNewUVCoordinates(GLuint arraySize, const GLfloat *uvArray, const GLfloat *vertexArray); // change the UV coordinates and the vertex array stored in the Buffers (overload)
     void draw();
+    void render(const RenderCommand &command);
+};
+
+// Draws one pixel sized point per object, for objects too small to show as a circle. The points are streamed like
+// the instances of InstancedCircleShader.
+class PointShader: public Shader{
+private:
+    GLuint colourID;        // Location of the per-point colour in the GLSL program
+    StreamBuffer pointBuffer;       // Ring buffer that the points are streamed through
+    std::vector<GLfloat> points;    // Points waiting to be drawn: x, y, r, g, b, a per point
+    void setupAttributes();
+public:
+    static const unsigned FLOATS_PER_POINT = 6;
+    PointShader();// : Shader("shaders/point.glvs", "shaders/point.glfs", "inPosition", "projection");
+    void clear();                                                               // Remove all points
+    void addPoint(vec2d position, const std::array<double, 4> &colour, double coverage = 1.0);  // Add a point (in universe coordinates), the alpha is scaled by coverage
+    unsigned pointCount();
+    void draw();    // Draw all points with the transformationMatrix (universe to screen)
+    void render(const RenderCommand &command);
+};
+
+// Draws many circles with one draw call. Every circle is an instance of the quad in vertexBuffer, the centres,
+// radii and colours are streamed into an instance buffer. Looks the same as CircleShader.
+class InstancedCircleShader: public Shader{
+private:
+    GLuint centreID;        // Location of the per-instance circle centre in the GLSL program
+    GLuint radiusID;        // Location of the per-instance radius in the GLSL program
+    GLuint colourID;        // Location of the per-instance colour in the GLSL program
+    StreamBuffer instanceBuffer;    // Ring buffer that the instance data is streamed through
+    bool instancing;        // Whether the GL supports instanced arrays (otherwise one draw call per circle is used)
+    std::vector<GLfloat> instances; // Instance data waiting to be drawn: x, y, radius, r, g, b, a per circle
+    PointShader pointShader;        // Draws the objects that are smaller than a pixel
+    void setupAttributes();
+public:
+    static const unsigned FLOATS_PER_INSTANCE = 7;
+    InstancedCircleShader();// : Shader("shaders/circle_instanced.glvs", "shaders/circle_instanced.glfs", "inPosition", "projection");
+    ~InstancedCircleShader();
+    void clear();                                                                   // Remove all circles
+    void addCircle(vec2d position, double radius, const std::array<double, 4> &colour);   // Add a circle (in universe coordinates)
+    // Add a circle for every object. With pixelsPerUnit objects smaller than a pixel become a point instead.
+    void addObjects(std::vector<Object*> &objects, double pixelsPerUnit = 0);
+    unsigned circleCount();
+    void draw();    // Draw all circles with the transformationMatrix (universe to screen)
+    void render(const RenderCommand &command);  // Draws the circles (and points) added at the time of rendering
+};
+
+// A laid out string kept on the GPU by TextShader::drawCached
+struct TextLayout{
+    GLuint buffer;          // Vertex buffer with the quads of the string (at position 0,0)
+    GLsizei vertexCount;    // Amount of vertices in buffer
+    unsigned long lastUse;  // Draw counter value of the last use, for evicting the oldest layout
+};
+
+// Glyphs of a font in one atlas image, without any GL calls so it can be made on any thread
+struct GlyphAtlas{
+    std::vector<Character> characters;  // 256 entries, uvOffset and uvSize in texture coordinates (textureID not set)
+    std::vector<unsigned char> image;   // Single channel, width x height (empty for baked atlases)
+    std::shared_ptr<FontAtlasFile> file;    // Baked atlas whose pixels are used in place
+    int width = 0;
+    int height = 0;
+    int pixSize = 0;                    // Pixel size the glyphs are rasterised at
+    bool distanceField = false;         // The pixels are a signed distance field instead of coverage
+    const unsigned char* pixels() const { return file ? file->pixels() : image.data(); }
 };
+// Rasterise the first numOfChars characters of a TrueType font (a font that cannot be read gives empty glyphs)
+GlyphAtlas rasteriseFont(const char* trueTypePath, int numOfChars = 128);
+// Map a distance field atlas baked by pie_fontbake, returns false (with a warning) if it can not be used
+bool readFontAtlas(const char* atlasPath, GlyphAtlas &glyphs);
 
 //TextShader is a class inspired by: http://learnopengl.com/#!In-Practice/Text-Rendering
+// All glyphs are packed into one texture (atlas), text is drawn as a batch of quads with one draw call. A baked distance
+// field atlas stays sharp at every text height, a rasterised one is sharpest at its pixel size.
 class TextShader: public Shader{
 private:
-    std::map<GLchar, Character> Characters; // A map between Chars and Characters containing textures and scaling
-    FT_Library ft;  // FreeType Library
-    FT_Face face;   // FreeType face to draw a character into a bitmap
+    std::vector<Character> Characters; // Flat table from char code to the glyph in the atlas (and its scaling)
     GLuint textColorID; // Location of text colour in the GLSL program
-    GLuint uvBuffer;    // Buffer location for UV coordinates
     GLuint vertexUVID;  // Location of UV coordinates in the GLSL program
     GLuint textureID;   // Location of the texture sampler in the GLSL program
+    GLuint atlas;       // Texture containing all glyphs
     int pixSize;        // pixel size of the characters (pts)
+    StreamBuffer vertexStream;  // Ring buffer the batched quads are streamed through
+    std::vector<GLfloat> batch; // Queued quads: x, y, u, v per vertex, 6 vertices per character
+    glm::vec4 batchColour;      // Colour of the queued text
+
+    // Cache of laid out strings, keyed by the string and its layout parameters
+    std::map<std::string, TextLayout> layouts;
+    unsigned long layoutDraws;          // Counts the drawCached calls
+    unsigned long layoutGeneration;     // Value of windowGeneration when the cache was filled
+
+    // Append the quads of a line of text to vertices
+    void layout(std::string text, vec2d position, unsigned alignment, vec2d screenDims, double height, std::vector<GLfloat> &vertices);
+    // Bind the program, colour, atlas and the matrix, and point the attributes to the buffer at start
+    void beginDraw(GLuint buffer, GLintptr start, const glm::vec4 &textColour, const glm::mat3 &matrix);
+    void setupAttributes();
+    GLuint sortTexture();
+    void capture(RenderCommand &command);
 public:
-    TextShader(const char* trueTypePath, int numOfChars = 128);// : Shader("shaders/text.glvs", "shaders/text.glfs", "VertexPos", "projection");
+    static const unsigned MAX_LAYOUTS = 64;     // Cached strings per TextShader, the least recently drawn is removed first
+    static unsigned long windowGeneration;      // Increased when a window is resized, which makes all cached layouts invalid
+    static const unsigned FLOATS_PER_VERTEX = 4;
+    TextShader(const char* trueTypePath, int numOfChars = 128);// : TextShader(rasteriseFont(trueTypePath, numOfChars))
+    TextShader(const GlyphAtlas &glyphs);// : Shader("shaders/text.glvs", "shaders/text.glfs" or "shaders/textsdf.glfs", "VertexPos", "projection");
     ~TextShader();
     glm::vec4 colour;   // vector containing the colour we wish to pass to the program
-    // draw command to render text in a line with in FreeType generated spacing.
+    // Queue text in a line with FreeType generated spacing, it is drawn by the next flush() (or draw()).
+    // Text with a different colour than the queued text flushes the queue first.
+    void add(std::string text, vec2d position, unsigned alignment = DRAWTEXT::ALIGN_LEFT, vec2d screenDims = {0,0}, double height = 0.1);
+    // Draw all queued text with one draw call
+    void flush();
+    void render(const RenderCommand &command);  // Draws (and empties) the text queued at the time of rendering
+    // draw command to render text in a line with in FreeType generated spacing (add() and flush()).
     void draw(std::string text, vec2d position, unsigned alignment = DRAWTEXT::ALIGN_LEFT,vec2d screenDims = {0,0}, double height = 0.1);
+    // Like draw, but the laid out string stays on the GPU, so drawing the same string again is a single draw call
+    // without any layout work. Use it for static and slowly changing text.
+    void drawCached(std::string text, vec2d position, unsigned alignment = DRAWTEXT::ALIGN_LEFT, vec2d screenDims = {0,0}, double height = 0.1);
+    // Remove all cached layouts
+    void clearCache();
+};
+
+// Draw commands of a frame. Commands are sorted on their key before they are executed, so draws with the same
+// program, texture and buffer follow each other and the GLState cache skips their binds. Draws in the same layer may
+// be reordered (commands with equal keys keep their order), use a higher layer for what has to be drawn on top.
+class RenderQueue{
+private:
+    std::vector<RenderCommand> commands;
+public:
+    static uint64_t sortKey(unsigned layer, GLuint program, GLuint texture, GLuint buffer);
+    void add(Shader* shader, unsigned layer = 0, unsigned part = 0);    // Record a draw with the shader's current state
+    void add(const RenderCommand &command);
+    size_t size();
+    void submit();      // Execute all commands in key order, empty the queue and end the GLState frame
+    void clear();
+};
+
+// Heat map of the objects for very large object counts. The objects are splatted into a low resolution grid over the
+// view by several threads (each into its own grid, which are added up afterwards), the grid is tone mapped on a log
+// scale and drawn over the whole window as a texture.
+class DensityShader: public Shader{
+private:
+    GLuint densityID;       // Location of the density sampler in the GLSL program
+    GLuint texture;         // Tone mapped grid
+    int columns;            // Grid size of the texture
+    int rows;
+    std::vector<float> grid;                    // Summed weight per cell
+    std::vector<std::vector<float> > partial;   // Grid of every thread
+    std::vector<unsigned char> image;           // Tone mapped grid, uploaded to texture
+    float displayMax;       // Weight that maps to white, follows the densest cell with a slow decay against flicker
+    GLuint sortTexture();
+
+    // Worker threads, started when a frame first needs them and kept for the next frames
+    std::vector<std::thread> workers;
+    std::mutex workMutex;
+    std::condition_variable workReady;
+    std::condition_variable workDone;
+    std::function<void(unsigned)> job;  // Splats part tt of the objects, set for every frame
+    unsigned jobParts;                  // Parts of the current job, part 0 is done by the calling thread
+    unsigned jobPending;                // Worker parts that are not done yet
+    unsigned long long jobNumber;       // Counts the jobs, so a worker sees when there is a new one
+    bool closing;
+    void workerLoop(unsigned part);
+    void runParallel(unsigned parts, std::function<void(unsigned)> function);
+
+    // Not copyable, the workers have a single owner
+    DensityShader(const DensityShader &);
+    DensityShader &operator=(const DensityShader &);
+public:
+    static const unsigned COUNT = 0;    // Every object weighs 1
+    static const unsigned MASS = 1;     // Objects weigh their mass
+    static const size_t OBJECTS_PER_THREAD = 16384;    // Less work than this is not worth a thread
+    DensityShader(int cellPixels_ = 4);// : Shader("shaders/density.glvs", "shaders/density.glfs", "inPosition");
+    ~DensityShader();
+    int cellPixels;         // Width and height of a grid cell on screen
+    unsigned weighting;     // COUNT or MASS
+    // Fill the grid (of columns x rows cells over the universe rectangle lower to upper) with the objects
+    void accumulate(std::vector<Object*> &objects, vec2d lower, vec2d upper, int columns_, int rows_);
+    void draw();
+    void render(const RenderCommand &command);
+};
+
+// Fading trails behind the objects. The positions of the last frames stay on the GPU in a history texture: a ring of
+// frames, each frame a block of rows with one texel (x, y) per object slot. Recording a frame uploads only that frame's
+// block, and all trails are drawn as one instanced draw of line strips that read the texture in the vertex shader.
+class TrailShader: public Shader{
+private:
+    GLuint historyID;       // Locations of the uniforms and per-instance attributes in the GLSL program
+    GLuint headID;
+    GLuint frameID;
+    GLuint ringLayoutID;
+    GLuint slotID;
+    GLuint birthID;
+    GLuint colourID;
+    GLuint history;         // Texture with the ring of positions
+    GLuint instanceBuffer;  // Slot, birth frame and colour of every trail
+    unsigned frames;        // Frames in the ring (length of the trails)
+    unsigned capacity;      // Object slots per frame
+    unsigned columns;       // Texels per row of the history texture
+    unsigned rowsPerFrame;  // Rows of one frame
+    unsigned head;          // Ring frame of the newest positions
+    unsigned long frameCounter;     // Frames recorded since the trails were cleared
+    bool supported;         // Whether the GL has instancing and float textures
+
+    std::unordered_map<Object*, unsigned> slots;    // Slot of every object with a trail
+    std::vector<unsigned> freeSlots;
+    unsigned nextSlot;                  // Slots from here on were never used
+    std::vector<unsigned long> seen;    // Last frame every slot was written
+    std::vector<float> births;          // First frame of every slot's trail (older frames are not valid)
+    std::vector<Object*> added;         // Objects without a slot in the frame being recorded
+    std::vector<GLfloat> block;         // Positions of the frame being recorded, by slot
+    std::vector<GLfloat> instances;     // slot, birth, r, g, b, a per trail
+    bool instancesChanged;
+
+    void allocate(unsigned capacity_); // (Re)create the history texture, this restarts all trails
+    void setupAttributes();
+public:
+    static const unsigned FLOATS_PER_INSTANCE = 6;
+    static const unsigned MAX_COLUMNS = 4096;
+    TrailShader(unsigned frames_ = 60);// : Shader("shaders/trail.glvs", "shaders/trail.glfs", "inAge", "projection");
+    ~TrailShader();
+    void record(std::vector<Object*> &objects);    // Add the current positions of the objects as the newest frame
+    void clear();                                   // Remove all trails
+    void draw();    // Draw all trails with the transformationMatrix (universe to screen)
+    void render(const RenderCommand &command);
+};
+
+// Uniform grid over the objects of a frame, to find the objects in a rectangle without testing all of them. Objects are
+// put in the cell of their centre; queries look maxRadius further, so objects that stick into the rectangle are found.
+class ObjectGrid{
+private:
+    double cellSize;
+    vec2d lower;                        // Bounding box of the object centres
+    vec2d upper;
+    double maxRadius;                   // Largest object radius
+    int columns;
+    int rows;
+    std::vector<unsigned> cellStart;    // First entry of every cell (columns*rows + 1 values)
+    std::vector<unsigned> cellOf;       // Cell of every object, while building
+    std::vector<Object*> entries;       // The objects, ordered by cell
+    std::vector<Object*>* source;       // Objects of the last build
+public:
+    static const int MAX_CELLS = 1 << 16;
+    ObjectGrid();
+    // Sort the objects into cells of (about) cellSize, the cells are made larger when there would be too many
+    void build(std::vector<Object*> &objects, double cellSize_);
+    // Whether every object lies within the rectangle
+    bool within(vec2d rectLower, vec2d rectUpper);
+    // Append the objects whose circle overlaps the rectangle to found
+    void query(vec2d rectLower, vec2d rectUpper, std::vector<Object*> &found);
 };
 
 class Window{
@@ -117,6 +484,10 @@ private:
     // Basic initiation function called by all window constructors
     void stdInitWindow();
 
+    // Objects in view of the last objectsInView() call, and the grid used to find them
+    ObjectGrid viewGrid;
+    std::vector<Object*> visibleObjects;
+
 public:
     // The universe that is bound to the window (the window can control its size)
     Universe* boundUniverse;
@@ -164,6 +535,32 @@ public:
     void drawObjectList(std::vector<Object *> &objects, CircleShader* circleShader = NULL);
     // Use the bound universe
     void drawObjectList(CircleShader* circleShader = NULL);
+    // Draw all objects in a single instanced draw call
+    void drawObjectList(std::vector<Object *> &objects, InstancedCircleShader* circleShader);
+    void drawObjectList(InstancedCircleShader* circleShader);
+    // The objects that overlap the visible part of the universe: objects itself when everything is in view, otherwise
+    // a list that is valid until the next call
+    std::vector<Object*> &objectsInView(std::vector<Object*> &objects);
+    // Fill the instanced shader with the objects and record the draw in renderQueue instead of drawing now
+    void queueObjectList(InstancedCircleShader* circleShader, unsigned layer = 0);
+
+    // Draw commands of the current frame, see RenderQueue
+    RenderQueue renderQueue;
+
+    // How objects are drawn (vis::DRAW_CIRCLES or vis::DRAW_DENSITY) and the shader for the density mode (not owned,
+    // without it objects are always drawn as circles)
+    unsigned visualMode = vis::DRAW_CIRCLES;
+    DensityShader* densityShader = NULL;
+    void toggleVisualMode();
+    // Trails behind the objects (not owned, NULL for none), drawn while trails is true
+    TrailShader* trailShader = NULL;
+    bool trails = false;
+    void toggleTrails();
+    // Record the positions of the bound universe's objects in the trails and queue the trails (when they are on). Use
+    // a layer below the objects.
+    void queueTrails(unsigned layer = 0);
+    // Fill the density shader with the objects in view
+    void accumulateDensity(std::vector<Object*> &objects);
 
     // Draws a simple red box in the middle of the screen.
     void drawBox(double Width, double Height);
@@ -171,6 +568,17 @@ public:
     // For frame pacing
     void pace_frame();
 
+    // Show the GL calls and skipped binds of the last frame in the window title (see GLState), updated by swapBuffers()
+    bool glStats = false;
+    void toggleGLStats();
+
+    // Screenshots and frame sequences (not owned, NULL for none), fed by swapBuffers()
+    FrameCapture* capture = NULL;
+    void toggleCapture();
+    void screenshot();
+    // Hand the finished frame to the capture and show it, this ends the frame for the GLState counters
+    void swapBuffers();
+
     //Get window size or cursor position
     vec2d windowSize();
     vec2d cursorPosition();
@@ -0,0 +1,354 @@
+//
+// Sprite atlas packing: copies the UI images out of their DDS files into one DDS atlas and writes the table of their
+// UV rectangles, used by SpriteBatch at runtime.
+//
+
+#define PIE_ONLY_BACKEND
+#include "framework.h"
+
+#include <cstdio>
+#include <cstring>
+
+void print_usage() {
+    std::cout << "Usage: pie_atlas SPRITES.txt ATLAS.DDS [options]\n"
+              << "  --width N        width of the atlas in pixels (default 1024)\n"
+              << "  --levels N       mipmap levels of the atlas (default 3)\n"
+              << "\n"
+              << "SPRITES.txt has one sprite per line, everything after a # is a comment:\n"
+              << "  sprite <name> <image.DDS> [<x> <y> <width> <height>]\n"
+              << "The rectangle is in pixels from the top left of the image, without one the whole image is used. Images\n"
+              << "are found relative to SPRITES.txt and have to be DXT compressed in one format. The UV table is written\n"
+              << "next to the atlas, with the extension .atlas.\n";
+}
+
+// A DXT compressed DDS file, mapped
+struct DDSSource {
+    MappedFile file;
+    unsigned fourCC = 0;
+    unsigned width = 0;
+    unsigned height = 0;
+    std::vector<size_t> levels;     // Offset of every mipmap level in the file
+};
+
+// A sprite: where it comes from and where it goes, in pixels
+struct SpriteRect {
+    std::string name;
+    unsigned source;                // Index of the image
+    int x, y, width, height;        // Rectangle in the image
+    int blockX, blockY;             // Aligned rectangle that is copied
+    int blockWidth, blockHeight;
+    int atlasX = 0, atlasY = 0;     // Position of the aligned rectangle in the atlas
+};
+
+const unsigned FOURCC_DXT1 = 0x31545844;
+const unsigned FOURCC_DXT3 = 0x33545844;
+const unsigned FOURCC_DXT5 = 0x35545844;
+
+unsigned block_bytes(unsigned fourCC) {
+    return fourCC == FOURCC_DXT1 ? 8 : 16;
+}
+
+/*
+ * read_dds()
+ *
+ * Map a DDS file and find its mipmap levels, like readDDS() does for the game (which needs a GL context).
+ */
+bool read_dds(std::string path, DDSSource &image) {
+    if (!image.file.open(path)) {
+        return false;
+    }
+    const unsigned char* data = (const unsigned char*)image.file.data();
+    unsigned header[31];
+    if (image.file.size() < 128 || std::memcmp(data, "DDS ", 4) != 0) {
+        std::cerr << "[ERROR] " << path << " is not a DDS file" << std::endl;
+        return false;
+    }
+    std::memcpy(header, data + 4, sizeof(header));
+    image.height = header[2];
+    image.width = header[3];
+    image.fourCC = (header[19] & 0x4) ? header[20] : 0;
+    unsigned count = (header[1] & 0x20000) && header[6] > 0 ? header[6] : 1;
+    if (image.fourCC != FOURCC_DXT1 && image.fourCC != FOURCC_DXT3 && image.fourCC != FOURCC_DXT5) {
+        std::cerr << "[ERROR] " << path << " is not DXT1, DXT3 or DXT5 compressed" << std::endl;
+        return false;
+    }
+
+    size_t offset = 128;
+    unsigned width = image.width, height = image.height;
+    for (unsigned level = 0; level < count; ++level) {
+        size_t size = (size_t)((width + 3) / 4) * ((height + 3) / 4) * block_bytes(image.fourCC);
+        if (offset + size > image.file.size()) {
+            break;
+        }
+        image.levels.push_back(offset);
+        offset += size;
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+    }
+    return true;
+}
+
+/*
+ * pack_skyline()
+ *
+ * Place the rectangles (in units of align pixels) in a strip of the given width with the skyline bottom-left
+ * heuristic: every rectangle, tallest first, goes where its top ends lowest, leftmost on ties. The skyline is
+ * the height of the filled part over every column range. Returns the height that was used.
+ */
+int pack_skyline(std::vector<SpriteRect> &sprites, int width, int align) {
+    struct Segment { int x, y, width; };
+    std::vector<Segment> skyline(1, Segment{0, 0, width});
+
+    std::vector<size_t> order(sprites.size());
+    for (size_t ii = 0; ii < order.size(); ++ii) order[ii] = ii;
+    std::stable_sort(order.begin(), order.end(), [&sprites](size_t a, size_t b) {
+        if (sprites[a].blockHeight != sprites[b].blockHeight) return sprites[a].blockHeight > sprites[b].blockHeight;
+        return sprites[a].blockWidth > sprites[b].blockWidth;
+    });
+
+    int used = 0;
+    for (size_t oo = 0; oo < order.size(); ++oo) {
+        SpriteRect &sprite = sprites[order[oo]];
+        int w = sprite.blockWidth / align;
+        int h = sprite.blockHeight / align;
+
+        // The rectangle starting at segment ss rests on the highest segment it covers
+        int bestTop = -1, bestX = 0, bestY = 0;
+        for (size_t ss = 0; ss < skyline.size(); ++ss) {
+            int x = skyline[ss].x;
+            if (x + w > width) break;
+            int y = 0;
+            for (size_t cc = ss; cc < skyline.size() && skyline[cc].x < x + w; ++cc) {
+                y = std::max(y, skyline[cc].y);
+            }
+            if (bestTop < 0 || y + h < bestTop) {
+                bestTop = y + h;
+                bestX = x;
+                bestY = y;
+            }
+        }
+        if (bestTop < 0) {
+            std::cerr << "[ERROR] Sprite " << sprite.name << " is wider than the atlas" << std::endl;
+            return -1;
+        }
+        sprite.atlasX = bestX * align;
+        sprite.atlasY = bestY * align;
+        used = std::max(used, bestTop);
+
+        // Raise the skyline under the rectangle: cut the segments it covers and insert one on top of it
+        std::vector<Segment> raised;
+        for (size_t ss = 0; ss < skyline.size(); ++ss) {
+            Segment segment = skyline[ss];
+            int end = segment.x + segment.width;
+            if (end <= bestX || segment.x >= bestX + w) {
+                raised.push_back(segment);
+                continue;
+            }
+            if (segment.x < bestX) raised.push_back(Segment{segment.x, segment.y, bestX - segment.x});
+            if (segment.x <= bestX) raised.push_back(Segment{bestX, bestTop, w});
+            if (end > bestX + w) raised.push_back(Segment{bestX + w, segment.y, end - bestX - w});
+        }
+        // Merge neighbours of the same height
+        skyline.clear();
+        for (size_t ss = 0; ss < raised.size(); ++ss) {
+            if (skyline.size() && skyline.back().y == raised[ss].y) {
+                skyline.back().width += raised[ss].width;
+            } else {
+                skyline.push_back(raised[ss]);
+            }
+        }
+    }
+    return used * align;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        print_usage();
+        return 1;
+    }
+    std::string spritesPath = argv[1];
+    std::string atlasPath = argv[2];
+    int atlasWidth = 1024;
+    int levels = 3;
+
+    for (int ii = 3; ii < argc; ++ii) {
+        std::string arg = argv[ii];
+        if (ii + 1 >= argc) {
+            std::cerr << "[ERROR] Missing value for " << arg << std::endl;
+            print_usage();
+            return 1;
+        }
+        if (arg == "--width") {
+            atlasWidth = std::atoi(argv[++ii]);
+        } else if (arg == "--levels") {
+            levels = std::atoi(argv[++ii]);
+        } else {
+            std::cerr << "[ERROR] Unknown option " << arg << std::endl;
+            print_usage();
+            return 1;
+        }
+    }
+    // Every level of every sprite has to be whole 4x4 blocks, so sprites are placed on multiples of align pixels
+    if (levels <= 0 || levels > 8) {
+        std::cerr << "[ERROR] Levels has to be 1 to 8" << std::endl;
+        return 1;
+    }
+    const int align = 4 << (levels - 1);
+    if (atlasWidth <= 0 || atlasWidth % align != 0) {
+        std::cerr << "[ERROR] The width has to be a positive multiple of " << align << std::endl;
+        return 1;
+    }
+
+    // Read the sprite list, the images are relative to it
+    std::ifstream list(spritesPath.c_str());
+    if (!list) {
+        std::cerr << "[ERROR] Could not open " << spritesPath << std::endl;
+        return 1;
+    }
+    std::string directory = spritesPath.substr(0, spritesPath.find_last_of("/\\") + 1);
+    std::vector<std::string> sourcePaths;
+    std::vector<std::unique_ptr<DDSSource> > sources;
+    std::vector<SpriteRect> sprites;
+    std::string line;
+    for (unsigned lineNumber = 1; std::getline(list, line); ++lineNumber) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string keyword, name, image;
+        if (!(words >> keyword)) {
+            continue;
+        }
+        SpriteRect sprite;
+        int count = 0;
+        if (keyword == "sprite" && words >> name >> image) {
+            int values[4] = {0, 0, 0, 0};
+            while (count < 4 && words >> values[count]) ++count;
+            sprite.x = values[0]; sprite.y = values[1]; sprite.width = values[2]; sprite.height = values[3];
+        }
+        std::string rest;
+        if (name.empty() || (count != 0 && count != 4) || (words.clear(), words >> rest)) {
+            std::cerr << "[ERROR] Could not read line " << lineNumber << " of " << spritesPath << std::endl;
+            return 1;
+        }
+
+        // Every image is mapped once
+        std::string path = directory + image;
+        size_t source = std::find(sourcePaths.begin(), sourcePaths.end(), path) - sourcePaths.begin();
+        if (source == sourcePaths.size()) {
+            sourcePaths.push_back(path);
+            sources.push_back(std::unique_ptr<DDSSource>(new DDSSource()));
+            if (!read_dds(path, *sources.back())) {
+                return 1;
+            }
+            if (sources.back()->fourCC != sources[0]->fourCC) {
+                std::cerr << "[ERROR] " << path << " is compressed in another format than " << sourcePaths[0] << std::endl;
+                return 1;
+            }
+            if (sources.back()->levels.size() < (size_t)levels) {
+                std::cerr << "[ERROR] " << path << " has fewer than " << levels << " mipmap levels" << std::endl;
+                return 1;
+            }
+        }
+        const DDSSource &dds = *sources[source];
+        if (count == 0) {
+            sprite.x = 0; sprite.y = 0; sprite.width = dds.width; sprite.height = dds.height;
+        }
+        if (sprite.width <= 0 || sprite.height <= 0 || sprite.x < 0 || sprite.y < 0 ||
+            sprite.x + sprite.width > (int)dds.width || sprite.y + sprite.height > (int)dds.height) {
+            std::cerr << "[ERROR] Sprite " << name << " is not within " << path << std::endl;
+            return 1;
+        }
+        sprite.name = name;
+        sprite.source = source;
+        sprite.blockX = sprite.x / align * align;
+        sprite.blockY = sprite.y / align * align;
+        sprite.blockWidth = (sprite.x + sprite.width + align - 1) / align * align - sprite.blockX;
+        sprite.blockHeight = (sprite.y + sprite.height + align - 1) / align * align - sprite.blockY;
+        sprites.push_back(sprite);
+    }
+    if (sprites.empty()) {
+        std::cerr << "[ERROR] No sprites in " << spritesPath << std::endl;
+        return 1;
+    }
+
+    int atlasHeight = pack_skyline(sprites, atlasWidth / align, align);
+    if (atlasHeight < 0) {
+        return 1;
+    }
+
+    // Copy the blocks of every level. The blocks around a sprite come along with it, they keep filtering at its
+    // border the same as in the image it came from.
+    unsigned fourCC = sources[0]->fourCC;
+    unsigned blockSize = block_bytes(fourCC);
+    std::vector<std::vector<char> > atlasLevels(levels);
+    for (int level = 0; level < levels; ++level) {
+        int atlasColumns = (atlasWidth >> level) / 4;
+        int atlasRows = (atlasHeight >> level) / 4;
+        atlasLevels[level].assign((size_t)atlasColumns * atlasRows * blockSize, 0);
+        for (size_t ss = 0; ss < sprites.size(); ++ss) {
+            const SpriteRect &sprite = sprites[ss];
+            const DDSSource &dds = *sources[sprite.source];
+            int sourceColumns = (int)((std::max(1u, dds.width >> level) + 3) / 4);
+            int sourceRows = (int)((std::max(1u, dds.height >> level) + 3) / 4);
+            const char* sourceLevel = dds.file.data() + dds.levels[level];
+            int columns = (sprite.blockWidth >> level) / 4;
+            int rows = (sprite.blockHeight >> level) / 4;
+            int fromColumn = (sprite.blockX >> level) / 4, fromRow = (sprite.blockY >> level) / 4;
+            int toColumn = (sprite.atlasX >> level) / 4, toRow = (sprite.atlasY >> level) / 4;
+            for (int row = 0; row < rows && fromRow + row < sourceRows; ++row) {
+                int copied = std::min(columns, sourceColumns - fromColumn);
+                std::memcpy(&atlasLevels[level][((size_t)(toRow + row) * atlasColumns + toColumn) * blockSize],
+                            sourceLevel + ((size_t)(fromRow + row) * sourceColumns + fromColumn) * blockSize,
+                            (size_t)copied * blockSize);
+            }
+        }
+    }
+
+    // DDS header: caps, height, width, pixel format, mipmap count and linear size are set
+    unsigned header[31];
+    std::memset(header, 0, sizeof(header));
+    header[0] = 124;
+    header[1] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;
+    header[2] = atlasHeight;
+    header[3] = atlasWidth;
+    header[4] = atlasLevels[0].size();
+    header[6] = levels;
+    header[18] = 32;
+    header[19] = 0x4;
+    header[20] = fourCC;
+    header[26] = 0x1000 | (levels > 1 ? 0x8 | 0x400000 : 0);
+
+    FILE* file = std::fopen(atlasPath.c_str(), "wb");
+    bool ok = file != NULL && std::fwrite("DDS ", 4, 1, file) == 1 && std::fwrite(header, sizeof(header), 1, file) == 1;
+    for (int level = 0; level < levels && ok; ++level) {
+        ok = std::fwrite(&atlasLevels[level][0], 1, atlasLevels[level].size(), file) == atlasLevels[level].size();
+    }
+    ok = file != NULL && std::fclose(file) == 0 && ok;
+    if (!ok) {
+        std::cerr << "[ERROR] Could not write " << atlasPath << std::endl;
+        return 1;
+    }
+
+    // UV table, in the text form of the scenario files: rectangles in texture coordinates, v = 0 at the top row
+    std::string tablePath = atlasPath.substr(0, atlasPath.find_last_of('.')) + ".atlas";
+    file = std::fopen(tablePath.c_str(), "w");
+    ok = file != NULL && std::fprintf(file, "# Space Debris Evaders sprite atlas, made by pie_atlas from %s\n"
+                                            "atlas %d %d\n# sprite name u0 v0 u1 v1 width height\n",
+                                      spritesPath.c_str(), atlasWidth, atlasHeight) > 0;
+    for (size_t ss = 0; ss < sprites.size() && ok; ++ss) {
+        const SpriteRect &sprite = sprites[ss];
+        double left = sprite.atlasX + sprite.x - sprite.blockX;
+        double top = sprite.atlasY + sprite.y - sprite.blockY;
+        ok = std::fprintf(file, "sprite %s %.9g %.9g %.9g %.9g %d %d\n", sprite.name.c_str(),
+                          left / atlasWidth, top / atlasHeight, (left + sprite.width) / atlasWidth,
+                          (top + sprite.height) / atlasHeight, sprite.width, sprite.height) > 0;
+    }
+    ok = file != NULL && std::fclose(file) == 0 && ok;
+    if (!ok) {
+        std::cerr << "[ERROR] Could not write " << tablePath << std::endl;
+        return 1;
+    }
+
+    std::cout << "Packed " << sprites.size() << " sprites into a " << atlasWidth << "x" << atlasHeight << " atlas "
+              << atlasPath << " with " << levels << " levels" << std::endl;
+    return 0;
+}
@@ -0,0 +1,230 @@
+//
+// Font baking: rasterises a TrueType font into a signed distance field atlas file, used by TextShader at runtime.
+//
+
+#define PIE_ONLY_BACKEND
+#include "framework.h"
+
+#include <cstring>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+void print_usage() {
+    std::cout << "Usage: pie_fontbake FONT.ttf ATLAS.pfnt [options]\n"
+              << "  --size N         pixels per em of the baked glyphs (default 48)\n"
+              << "  --spread N       pixels of distance stored around the outlines (default 6)\n"
+              << "  --chars N        character codes 0 to N-1 are baked (default 128)\n"
+              << "  --oversample N   glyphs are rasterised N times larger before the distances are taken (default 8)\n";
+}
+
+/*
+ * distance_transform_1d()
+ *
+ * Exact squared Euclidean distance transform of one row or column (Felzenszwalb and Huttenlocher): every
+ * output value is the minimum of (q - p)^2 + f[p] over all p, found from the lower envelope of the parabolas.
+ */
+void distance_transform_1d(const std::vector<double> &f, std::vector<double> &d, std::vector<int> &v, std::vector<double> &z) {
+    int n = f.size();
+    int k = 0;
+    v[0] = 0;
+    z[0] = -1e30;
+    z[1] = 1e30;
+    for (int q = 1; q < n; ++q) {
+        // Drop the parabolas that are hidden by the new one (z[0] is below every intersection, so k stays >= 0)
+        double s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+        while (s <= z[k]) {
+            --k;
+            s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = 1e30;
+    }
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (z[k + 1] < q) ++k;
+        d[q] = (double)(q - v[k]) * (q - v[k]) + f[v[k]];
+    }
+}
+
+// Squared distance of every pixel to the nearest pixel with a zero in grid (the others hold a large value)
+void distance_transform_2d(std::vector<double> &grid, int width, int height) {
+    int n = std::max(width, height);
+    std::vector<double> f(n), d(n), z(n + 1);
+    std::vector<int> v(n);
+
+    f.resize(height); d.resize(height);
+    for (int x = 0; x < width; ++x) {
+        for (int y = 0; y < height; ++y) f[y] = grid[y * width + x];
+        distance_transform_1d(f, d, v, z);
+        for (int y = 0; y < height; ++y) grid[y * width + x] = d[y];
+    }
+    f.resize(width); d.resize(width);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) f[x] = grid[y * width + x];
+        distance_transform_1d(f, d, v, z);
+        for (int x = 0; x < width; ++x) grid[y * width + x] = d[x];
+    }
+}
+
+/*
+ * bake_glyph()
+ *
+ * Turn a large coverage bitmap into a distance field of oversample times fewer pixels per side, with spread
+ * pixels of margin. Distances are taken between pixel centres of the large bitmap, to the nearest pixel on the
+ * other side of the outline, and sampled at the centres of the small pixels.
+ */
+void bake_glyph(const FT_Bitmap &bitmap, int oversample, int spread, int &width, int &height, std::vector<unsigned char> &field) {
+    int margin = spread * oversample;
+    int bigWidth = bitmap.width + 2 * margin;
+    int bigHeight = bitmap.rows + 2 * margin;
+    width = (bigWidth + oversample - 1) / oversample;
+    height = (bigHeight + oversample - 1) / oversample;
+    bigWidth = width * oversample;
+    bigHeight = height * oversample;
+
+    const double far = 1e20;
+    std::vector<double> toInside(bigWidth * bigHeight, far);
+    std::vector<double> toOutside(bigWidth * bigHeight, 0);
+    for (unsigned row = 0; row < bitmap.rows; ++row) {
+        for (unsigned column = 0; column < bitmap.width; ++column) {
+            if (bitmap.buffer[row * bitmap.pitch + column] >= 128) {
+                size_t index = (row + margin) * bigWidth + column + margin;
+                toInside[index] = 0;
+                toOutside[index] = far;
+            }
+        }
+    }
+    distance_transform_2d(toInside, bigWidth, bigHeight);
+    distance_transform_2d(toOutside, bigWidth, bigHeight);
+
+    field.assign(width * height, 0);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            size_t index = (y * oversample + oversample / 2) * bigWidth + x * oversample + oversample / 2;
+            // Positive inside, in small pixels. Half a pixel puts the outline between the two sides.
+            double distance = toInside[index] > 0 ? -(std::sqrt(toInside[index]) - 0.5) : std::sqrt(toOutside[index]) - 0.5;
+            distance /= oversample;
+            double value = 128 + 127 * distance / spread;
+            field[y * width + x] = (unsigned char)std::min(255.0, std::max(0.0, std::floor(value + 0.5)));
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        print_usage();
+        return 1;
+    }
+    std::string fontPath = argv[1];
+    std::string atlasPath = argv[2];
+    int pixelSize = 48;
+    int spread = 6;
+    int characters = 128;
+    int oversample = 8;
+
+    for (int ii = 3; ii < argc; ++ii) {
+        std::string arg = argv[ii];
+        if (ii + 1 >= argc) {
+            std::cerr << "[ERROR] Missing value for " << arg << std::endl;
+            print_usage();
+            return 1;
+        }
+        if (arg == "--size") {
+            pixelSize = std::atoi(argv[++ii]);
+        } else if (arg == "--spread") {
+            spread = std::atoi(argv[++ii]);
+        } else if (arg == "--chars") {
+            characters = std::min(256, std::atoi(argv[++ii]));
+        } else if (arg == "--oversample") {
+            oversample = std::atoi(argv[++ii]);
+        } else {
+            std::cerr << "[ERROR] Unknown option " << arg << std::endl;
+            print_usage();
+            return 1;
+        }
+    }
+    if (pixelSize <= 0 || spread <= 0 || characters <= 0 || oversample <= 0) {
+        std::cerr << "[ERROR] Size, spread, chars and oversample have to be positive" << std::endl;
+        return 1;
+    }
+
+    FT_Library ft;
+    FT_Face face;
+    if (FT_Init_FreeType(&ft) || FT_New_Face(ft, fontPath.c_str(), 0, &face)) {
+        std::cerr << "[ERROR] Could not load font " << fontPath << std::endl;
+        return 1;
+    }
+    FT_Set_Pixel_Sizes(face, 0, pixelSize * oversample);
+
+    // Glyphs are placed on shelves (rows) of the atlas from left to right, like TextShader does at runtime. The
+    // fields already fade to zero at their borders, a gap of one pixel keeps linear filtering from mixing glyphs.
+    const int atlasWidth = 512;
+    const int gap = 1;
+    int shelfX = gap, shelfY = gap, shelfHeight = 0;
+    std::vector<FontAtlasGlyph> glyphs(characters);
+    std::vector<std::vector<unsigned char> > fields(characters);
+    std::memset(&glyphs[0], 0, glyphs.size() * sizeof(FontAtlasGlyph));
+
+    for (int c = 0; c < characters; ++c) {
+        if (FT_Load_Char(face, c, FT_LOAD_RENDER)) {
+            continue;
+        }
+        FT_GlyphSlot slot = face->glyph;
+        FontAtlasGlyph &glyph = glyphs[c];
+        glyph.advance = (slot->advance.x + oversample / 2) / oversample;
+        if (slot->bitmap.width == 0 || slot->bitmap.rows == 0) {
+            continue;   // Spaces only move the pen
+        }
+
+        int width, height;
+        bake_glyph(slot->bitmap, oversample, spread, width, height, fields[c]);
+        if (shelfX + width + gap > atlasWidth) {
+            shelfX = gap;
+            shelfY += shelfHeight + gap;
+            shelfHeight = 0;
+        }
+        glyph.width = width;
+        glyph.height = height;
+        glyph.bearing_x = (int)std::floor((double)slot->bitmap_left / oversample + 0.5) - spread;
+        glyph.bearing_y = (int)std::floor((double)slot->bitmap_top / oversample + 0.5) + spread;
+        glyph.x = shelfX;
+        glyph.y = shelfY;
+        shelfX += width + gap;
+        shelfHeight = std::max(shelfHeight, height);
+    }
+    FT_Done_Face(face);
+    FT_Done_FreeType(ft);
+
+    // Copy the fields into one image, the height is rounded up to a power of two
+    int atlasHeight = 1;
+    while (atlasHeight < shelfY + shelfHeight + gap) atlasHeight *= 2;
+    std::vector<unsigned char> pixels(atlasWidth * atlasHeight, 0);
+    for (int c = 0; c < characters; ++c) {
+        const FontAtlasGlyph &glyph = glyphs[c];
+        for (int row = 0; row < glyph.height; ++row) {
+            std::copy(fields[c].begin() + row * glyph.width, fields[c].begin() + (row + 1) * glyph.width,
+                      pixels.begin() + (glyph.y + row) * atlasWidth + glyph.x);
+        }
+    }
+
+    FontAtlasHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "PIEFONT", 8);
+    header.version = 1;
+    header.header_size = sizeof(FontAtlasHeader);
+    header.width = atlasWidth;
+    header.height = atlasHeight;
+    header.glyph_count = characters;
+    header.pixel_size = pixelSize;
+    header.spread = spread;
+    header.pixel_offset = sizeof(FontAtlasHeader) + characters * sizeof(FontAtlasGlyph);
+    if (!FontAtlasFile::save(atlasPath, header, glyphs, pixels)) {
+        return 1;
+    }
+
+    std::cout << "Baked " << characters << " characters of " << fontPath << " into a " << atlasWidth << "x" << atlasHeight
+              << " atlas " << atlasPath << std::endl;
+    return 0;
+}
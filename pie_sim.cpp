@@ -0,0 +1,211 @@
+//
+// Headless simulation: runs a universe without a window and streams its trajectory to a binary file.
+//
+
+#define PIE_ONLY_BACKEND
+#include "framework.h"
+
+#include <cstring>
+
+void print_usage() {
+    std::cout << "Usage: pie_sim [options]\n"
+              << "  --objects N           amount of random objects (default 100)\n"
+              << "  --scenario FILE       load the universe from a scenario file instead\n"
+              << "  --save-scenario FILE  write the initial universe to a scenario file\n"
+              << "  --scenario-format F   binary or text, for --save-scenario (default binary)\n"
+              << "  --seed N              random seed of the objects (default 1)\n"
+              << "  --size W H            universe width and height (default 100 100)\n"
+              << "  --steps N             physics iterations to simulate (default 10000)\n"
+              << "  --output FILE         trajectory file, empty for none (default trajectory.ptrj)\n"
+              << "  --record-every N      physics iterations per recorded frame (default 1)\n"
+              << "  --fields F            pos, vel or posvel (default posvel)\n"
+              << "  --precision P         32 or 64 bits per value (default 32)\n"
+              << "  --compress Q          delta encode frames, rounding to Q times the universe size\n"
+              << "  --keyframe-every N    frames between keyframes of compressed files (default 60)\n"
+              << "  --metrics FILE        write simulation metrics to FILE\n"
+              << "  --metrics-format F    json or prometheus (default json)\n"
+              << "  --metrics-interval S  seconds between metric writes (default 1)\n"
+              << "  -h, --help            show this help\n";
+}
+
+/*
+ * add_random_objects()
+ *
+ * Spread objects over the universe with a random velocity. Every object gets its own cell of a grid, so
+ * they never overlap and no collision checks are needed while placing them (which is O(n^2) otherwise).
+ */
+void add_random_objects(Universe &universe, unsigned seed, int amount) {
+    std::srand(seed);
+
+    int columns = std::ceil(std::sqrt(amount * universe.width / universe.height));
+    int rows = std::ceil((double)amount / columns);
+    double cellWidth = universe.width / columns;
+    double cellHeight = universe.height / rows;
+    double maxRadius = 0.4 * std::min(cellWidth, cellHeight);
+
+    universe.objects.reserve(universe.objects.size() + amount);
+    for (int ii = 0; ii < amount; ++ii) {
+        Object* A = universe.add_object();
+
+        double radius = maxRadius * (0.5 + 0.5 * std::rand() / RAND_MAX);
+        A->set_radius(radius);
+        A->set_mass(0.5 + 9.5 * std::rand() / RAND_MAX);
+        A->set_bounciness(0.5 + 0.4 * std::rand() / RAND_MAX);
+        A->set_velocity(2.0 * std::rand() / RAND_MAX - 1, 2.0 * std::rand() / RAND_MAX - 1);
+
+        // Random position within the cell, such that the object stays inside the cell
+        double x = -universe.width/2 + (ii % columns + 0.5) * cellWidth;
+        double y = -universe.height/2 + (ii / columns + 0.5) * cellHeight;
+        x += (cellWidth/2 - radius) * (2.0 * std::rand() / RAND_MAX - 1);
+        y += (cellHeight/2 - radius) * (2.0 * std::rand() / RAND_MAX - 1);
+        A->set_position(x, y);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // Default settings
+    int objectAmount = 100;
+    unsigned seed = 1;
+    double width = 100;
+    double height = 100;
+    long steps = 10000;
+    std::string output = "trajectory.ptrj";
+    unsigned recordEvery = 1;
+    uint32_t fields = trajectory::POSITION | trajectory::VELOCITY;
+    uint32_t precision = trajectory::FLOAT32;
+    double quantisation = 0;
+    unsigned keyframeEvery = 60;
+    std::string scenarioPath;
+    std::string saveScenarioPath;
+    unsigned scenarioFormat = scenario::BINARY;
+    std::string metricsPath;
+    unsigned metricsFormat = metrics::JSON_LINES;
+    double metricsInterval = 1;
+
+    // Parse the command line
+    for (int ii = 1; ii < argc; ++ii) {
+        std::string arg = argv[ii];
+        if (arg == "--help" || arg == "-h") {
+            print_usage();
+            return 0;
+        }
+        // Amount of values that should follow this option
+        int values = (arg == "--size") ? 2 : 1;
+        if (ii + values >= argc) {
+            std::cerr << "[ERROR] Missing value for " << arg << std::endl;
+            print_usage();
+            return 1;
+        }
+        std::string value = argv[ii + 1];
+        bool valid = true;
+
+        if (arg == "--objects") {
+            objectAmount = std::atoi(argv[++ii]);
+        } else if (arg == "--scenario") {
+            scenarioPath = argv[++ii];
+        } else if (arg == "--save-scenario") {
+            saveScenarioPath = argv[++ii];
+        } else if (arg == "--scenario-format") {
+            ++ii;
+            valid = value == "text" || value == "binary";
+            scenarioFormat = (value == "text") ? scenario::TEXT : scenario::BINARY;
+        } else if (arg == "--seed") {
+            seed = std::strtoul(argv[++ii], NULL, 10);
+        } else if (arg == "--size") {
+            width = std::atof(argv[++ii]);
+            height = std::atof(argv[++ii]);
+        } else if (arg == "--steps") {
+            steps = std::atol(argv[++ii]);
+        } else if (arg == "--output") {
+            output = argv[++ii];
+        } else if (arg == "--record-every") {
+            recordEvery = std::atoi(argv[++ii]);
+        } else if (arg == "--fields") {
+            ++ii;
+            valid = value == "pos" || value == "vel" || value == "posvel";
+            fields = (value == "pos") ? trajectory::POSITION : (value == "vel") ? trajectory::VELOCITY
+                                                                              : trajectory::POSITION | trajectory::VELOCITY;
+        } else if (arg == "--precision") {
+            ++ii;
+            valid = value == "32" || value == "64";
+            precision = (value == "64") ? trajectory::FLOAT64 : trajectory::FLOAT32;
+        } else if (arg == "--compress") {
+            quantisation = std::atof(argv[++ii]);
+        } else if (arg == "--keyframe-every") {
+            keyframeEvery = std::atoi(argv[++ii]);
+        } else if (arg == "--metrics") {
+            metricsPath = argv[++ii];
+        } else if (arg == "--metrics-format") {
+            ++ii;
+            valid = value == "json" || value == "prometheus";
+            metricsFormat = (value == "prometheus") ? metrics::PROMETHEUS : metrics::JSON_LINES;
+        } else if (arg == "--metrics-interval") {
+            metricsInterval = std::atof(argv[++ii]);
+        } else {
+            std::cerr << "[ERROR] Unknown option " << arg << std::endl;
+            print_usage();
+            return 1;
+        }
+        if (!valid) {
+            std::cerr << "[ERROR] Invalid value " << value << " for " << arg << std::endl;
+            print_usage();
+            return 1;
+        }
+    }
+
+    // Create the universe, from a scenario or with random objects
+    Universe universe(width, height);
+    if (scenarioPath.size()) {
+        std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+        if (!Scenario::load(scenarioPath, universe)) {
+            return 1;
+        }
+        std::cout << "Loaded " << universe.objects.size() << " objects from " << scenarioPath << " in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count() << " s" << std::endl;
+    } else {
+        add_random_objects(universe, seed, objectAmount);
+    }
+    if (saveScenarioPath.size() && !Scenario::save(saveScenarioPath, universe, scenarioFormat)) {
+        return 1;
+    }
+
+    // Optional metrics
+    MetricsRegistry registry;
+    SimulationMetrics simMetrics(registry);
+    if (metricsPath.size()) {
+        universe.metrics = &simMetrics;
+        registry.start_flushing(metricsPath, metricsFormat, metricsInterval);
+    }
+
+    // Optional trajectory
+    TrajectoryWriter writer;
+    if (quantisation > 0) {
+        writer.set_encoding(trajectory::DELTA, quantisation, keyframeEvery);
+    }
+    if (output.size() && !writer.open(output, universe, fields, precision, recordEvery)) {
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (long ii = 0; ii < steps; ++ii) {
+        writer.step(universe);
+        universe.physics_runtime_iteration();
+        universe.sample_metrics();
+    }
+    // Also store the final state
+    writer.record(universe);
+
+    bool ok = !writer.is_open() || writer.close();
+    registry.stop_flushing();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Simulated " << steps << " steps of " << universe.objects.size() << " objects in " << seconds
+              << " s (" << steps / seconds << " steps/s)";
+    if (output.size()) {
+        std::cout << ", wrote " << writer.frames() << " frames to " << output;
+    }
+    std::cout << std::endl;
+
+    return ok ? 0 : 1;
+}